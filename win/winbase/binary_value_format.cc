@@ -0,0 +1,553 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "winbase\binary_value_format.h"
+
+#include <string.h>
+
+#include <cmath>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "winbase\logging.h"
+#include "winbase\numerics\safe_conversions.h"
+#include "winbase\strings\string_util.h"
+
+namespace winbase {
+
+namespace {
+
+const char kMagic[4] = {'W', 'B', 'V', 'B'};
+
+constexpr size_t kSlotSize = 8;
+constexpr size_t kHeaderSize = 8 + kSlotSize;
+constexpr size_t kRootSlot = 8;
+
+// Lists and dictionaries start with their count and size.
+constexpr size_t kContainerHeaderSize = 8;
+constexpr size_t kDictEntrySize = 4 + kSlotSize;
+
+constexpr size_t kAlignment = 4;
+
+// The type byte of a slot. These must not change within a version of the
+// format.
+enum SlotType : uint8_t {
+  SLOT_NONE = 0,
+  SLOT_BOOLEAN = 1,
+  SLOT_INTEGER = 2,
+  SLOT_DOUBLE = 3,
+  SLOT_STRING = 4,
+  SLOT_BINARY = 5,
+  SLOT_DICTIONARY = 6,
+  SLOT_LIST = 7,
+};
+
+uint32_t ReadUint32(span<const uint8_t> data, size_t offset) {
+  uint32_t value;
+  memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+// Returns the bytes of the key record at |key| without checking that they are
+// UTF-8, or nullopt if the record does not fit in |data|. Keys may be shared
+// with earlier dictionaries, so they can be anywhere.
+Optional<StringPiece> ReadKeyRecord(span<const uint8_t> data, size_t key) {
+  if (key > data.size() || data.size() - key < 4)
+    return nullopt;
+  size_t length = ReadUint32(data, key);
+  if (length > data.size() - key - 4)
+    return nullopt;
+  return StringPiece(reinterpret_cast<const char*>(data.data() + key + 4),
+                     length);
+}
+
+class Writer {
+ public:
+  explicit Writer(std::string* output) : output_(output) {}
+
+  // Fills in the slot at |slot| for |value| at |depth| and appends the record
+  // of |value| if it needs one. Returns false if |value| is nested too deeply
+  // or holds a string that is too long.
+  bool WriteValue(const Value& value, size_t slot, int depth) {
+    switch (value.type()) {
+      case Value::Type::NONE:
+        PutSlot(slot, SLOT_NONE, 0);
+        return true;
+      case Value::Type::BOOLEAN:
+        PutSlot(slot, SLOT_BOOLEAN, value.GetBool() ? 1 : 0);
+        return true;
+      case Value::Type::INTEGER:
+        PutSlot(slot, SLOT_INTEGER, static_cast<uint32_t>(value.GetInt()));
+        return true;
+      case Value::Type::DOUBLE: {
+        PutSlot(slot, SLOT_DOUBLE, CurrentOffset());
+        double number = value.GetDouble();
+        AppendBytes(&number, sizeof(number));
+        return true;
+      }
+      case Value::Type::STRING: {
+        const std::string& string = value.GetString();
+        return WriteBytes(slot, SLOT_STRING, string.data(), string.size());
+      }
+      case Value::Type::BINARY: {
+        const Value::BlobStorage& blob = value.GetBlob();
+        return WriteBytes(slot, SLOT_BINARY, blob.data(), blob.size());
+      }
+      case Value::Type::DICTIONARY:
+        return depth < BinaryValueWriter::kMaxDepth &&
+               WriteDictionary(value, slot, depth);
+      case Value::Type::LIST:
+        return depth < BinaryValueWriter::kMaxDepth &&
+               WriteList(value, slot, depth);
+    }
+    WINBASE_NOTREACHED();
+    return false;
+  }
+
+ private:
+  bool WriteBytes(size_t slot, SlotType type, const void* data, size_t size) {
+    if (!IsValueInRangeForNumericType<uint32_t>(size))
+      return false;
+    PutSlot(slot, type, CurrentOffset());
+    AppendUint32(static_cast<uint32_t>(size));
+    AppendBytes(data, size);
+    Pad();
+    return true;
+  }
+
+  bool WriteList(const Value& list, size_t slot, int depth) {
+    const Value::ListStorage& elements = list.GetList();
+    size_t record = AppendContainerHeader(slot, SLOT_LIST, elements.size());
+    size_t slots = output_->size();
+    output_->resize(slots + elements.size() * kSlotSize);
+
+    for (size_t i = 0; i < elements.size(); ++i) {
+      if (!WriteValue(elements[i], slots + i * kSlotSize, depth + 1))
+        return false;
+    }
+    FinishContainer(record);
+    return true;
+  }
+
+  bool WriteDictionary(const Value& dict, size_t slot, int depth) {
+    // DictItems() is sorted by key, so the entries come out sorted as well.
+    size_t record =
+        AppendContainerHeader(slot, SLOT_DICTIONARY, dict.DictSize());
+    size_t entry = output_->size();
+    output_->resize(entry + dict.DictSize() * kDictEntrySize);
+
+    for (const auto& item : dict.DictItems()) {
+      if (!WriteKey(item.first, entry) ||
+          !WriteValue(item.second, entry + 4, depth + 1)) {
+        return false;
+      }
+      entry += kDictEntrySize;
+    }
+    FinishContainer(record);
+    return true;
+  }
+
+  // Fills in the key of the dictionary entry at |entry|, appending a record
+  // for |key| unless one was written before.
+  bool WriteKey(const std::string& key, size_t entry) {
+    if (!IsValueInRangeForNumericType<uint32_t>(key.size()))
+      return false;
+    auto inserted = key_offsets_.insert(
+        std::make_pair(StringPiece(key), CurrentOffset()));
+    if (inserted.second) {
+      AppendUint32(static_cast<uint32_t>(key.size()));
+      output_->append(key);
+      Pad();
+    }
+    PutUint32(entry, inserted.first->second);
+    return true;
+  }
+
+  // Fills in |slot| for a list or dictionary with |count| children and
+  // appends its header with a placeholder for its size. Returns the offset of
+  // the record.
+  size_t AppendContainerHeader(size_t slot, SlotType type, size_t count) {
+    size_t record = output_->size();
+    PutSlot(slot, type, CurrentOffset());
+    // A larger count makes the output exceed 4 GiB, so Write() fails anyway.
+    AppendUint32(static_cast<uint32_t>(count));
+    AppendUint32(0);
+    return record;
+  }
+
+  // Fills in the size of the list or dictionary at |record| once all of its
+  // children have been written.
+  void FinishContainer(size_t record) {
+    PutUint32(record + 4, static_cast<uint32_t>(output_->size() - record));
+  }
+
+  void PutSlot(size_t slot, SlotType type, uint32_t value) {
+    (*output_)[slot] = static_cast<char>(type);
+    PutUint32(slot + 4, value);
+  }
+
+  void AppendUint32(uint32_t value) { AppendBytes(&value, sizeof(value)); }
+
+  void AppendBytes(const void* data, size_t size) {
+    output_->append(static_cast<const char*>(data), size);
+  }
+
+  void PutUint32(size_t offset, uint32_t value) {
+    memcpy(&(*output_)[offset], &value, sizeof(value));
+  }
+
+  void Pad() {
+    output_->resize((output_->size() + kAlignment - 1) & ~(kAlignment - 1));
+  }
+
+  // The offset of the next record. Truncated if the output has grown past
+  // 4 GiB, in which case Write() fails.
+  uint32_t CurrentOffset() const {
+    return static_cast<uint32_t>(output_->size());
+  }
+
+  std::string* const output_;
+
+  // The offset of the record of every key written so far. The keys point into
+  // the Value that is being written.
+  std::unordered_map<StringPiece, uint32_t, StringPieceHash> key_offsets_;
+};
+
+}  // namespace
+
+const uint32_t BinaryValueWriter::kVersion = 1;
+const int BinaryValueWriter::kMaxDepth = 1000;
+
+// static
+bool BinaryValueWriter::Write(const Value& value, std::string* output) {
+  output->assign(kMagic, sizeof(kMagic));
+  output->append(reinterpret_cast<const char*>(&kVersion), sizeof(kVersion));
+  output->resize(kHeaderSize);
+  Writer writer(output);
+  if (!writer.WriteValue(value, kRootSlot, 0) ||
+      !IsValueInRangeForNumericType<uint32_t>(output->size())) {
+    output->clear();
+    return false;
+  }
+  return true;
+}
+
+BinaryValueReader::BinaryValueReader(span<const uint8_t> data) : data_(data) {}
+
+BinaryValueReader::~BinaryValueReader() = default;
+
+Optional<BinaryValueReader::Node> BinaryValueReader::root() const {
+  if (data_.size() < kHeaderSize ||
+      memcmp(data_.data(), kMagic, sizeof(kMagic)) != 0 ||
+      ReadUint32(data_, sizeof(kMagic)) != BinaryValueWriter::kVersion) {
+    return nullopt;
+  }
+  return Node::ReadSlot(data_, kRootSlot, kHeaderSize, data_.size());
+}
+
+// static
+Optional<BinaryValueReader::Node> BinaryValueReader::Node::ReadSlot(
+    span<const uint8_t> data,
+    size_t slot,
+    size_t begin,
+    size_t end) {
+  uint32_t value = ReadUint32(data, slot + 4);
+  switch (data[slot]) {
+    case SLOT_NONE:
+      if (value != 0)
+        return nullopt;
+      return Node(data, Value::Type::NONE, value, 0, 0);
+    case SLOT_BOOLEAN:
+      if (value > 1)
+        return nullopt;
+      return Node(data, Value::Type::BOOLEAN, value, 0, 0);
+    case SLOT_INTEGER:
+      return Node(data, Value::Type::INTEGER, value, 0, 0);
+  }
+
+  // The other types have a record, which must fit.
+  size_t record = value;
+  if (record < begin || record > end)
+    return nullopt;
+  size_t available = end - record;
+
+  switch (data[slot]) {
+    case SLOT_DOUBLE: {
+      double number;
+      if (available < sizeof(number))
+        return nullopt;
+      // Value only holds finite doubles.
+      memcpy(&number, data.data() + record, sizeof(number));
+      if (!std::isfinite(number))
+        return nullopt;
+      return Node(data, Value::Type::DOUBLE, 0, record,
+                  record + sizeof(number));
+    }
+    case SLOT_STRING:
+    case SLOT_BINARY: {
+      if (available < 4)
+        return nullopt;
+      uint32_t length = ReadUint32(data, record);
+      if (length > available - 4)
+        return nullopt;
+      size_t bytes = record + 4;
+      if (data[slot] == SLOT_BINARY)
+        return Node(data, Value::Type::BINARY, length, bytes, bytes + length);
+      // Value only holds UTF-8 strings.
+      if (!IsStringUTF8(StringPiece(
+              reinterpret_cast<const char*>(data.data() + bytes), length))) {
+        return nullopt;
+      }
+      return Node(data, Value::Type::STRING, length, bytes, bytes + length);
+    }
+    case SLOT_DICTIONARY:
+    case SLOT_LIST: {
+      if (available < kContainerHeaderSize)
+        return nullopt;
+      uint32_t count = ReadUint32(data, record);
+      uint32_t size = ReadUint32(data, record + 4);
+      bool is_dict = data[slot] == SLOT_DICTIONARY;
+      size_t entry_size = is_dict ? kDictEntrySize : kSlotSize;
+      if (size < kContainerHeaderSize || size > available ||
+          count > (size - kContainerHeaderSize) / entry_size) {
+        return nullopt;
+      }
+      return Node(data, is_dict ? Value::Type::DICTIONARY : Value::Type::LIST,
+                  count, record, record + size);
+    }
+  }
+  return nullopt;
+}
+
+BinaryValueReader::Node::Node(span<const uint8_t> data,
+                              Value::Type type,
+                              uint32_t value,
+                              size_t offset,
+                              size_t end)
+    : data_(data), type_(type), value_(value), offset_(offset), end_(end) {}
+
+bool BinaryValueReader::Node::GetBool() const {
+  WINBASE_CHECK(is_bool());
+  return value_ != 0;
+}
+
+int BinaryValueReader::Node::GetInt() const {
+  WINBASE_CHECK(is_int());
+  return static_cast<int32_t>(value_);
+}
+
+double BinaryValueReader::Node::GetDouble() const {
+  if (is_double()) {
+    double number;
+    memcpy(&number, data_.data() + offset_, sizeof(number));
+    return number;
+  }
+  if (is_int())
+    return GetInt();
+  WINBASE_CHECK(false);
+  return 0.0;
+}
+
+StringPiece BinaryValueReader::Node::GetString() const {
+  WINBASE_CHECK(is_string());
+  return StringPiece(reinterpret_cast<const char*>(data_.data() + offset_),
+                     value_);
+}
+
+span<const uint8_t> BinaryValueReader::Node::GetBlob() const {
+  WINBASE_CHECK(is_blob());
+  return data_.subspan(offset_, value_);
+}
+
+size_t BinaryValueReader::Node::size() const {
+  WINBASE_CHECK(is_list() || is_dict());
+  return value_;
+}
+
+Optional<BinaryValueReader::Node> BinaryValueReader::Node::GetListElement(
+    size_t index) const {
+  WINBASE_CHECK(is_list());
+  WINBASE_CHECK_LT(index, value_);
+  return ReadSlot(data_, offset_ + kContainerHeaderSize + index * kSlotSize,
+                  children_begin(), end_);
+}
+
+Optional<StringPiece> BinaryValueReader::Node::GetDictKey(size_t index) const {
+  WINBASE_CHECK(is_dict());
+  WINBASE_CHECK_LT(index, value_);
+  Optional<StringPiece> key = ReadKeyRecord(data_, GetDictKeyOffset(index));
+  // Keys are UTF-8, like string values.
+  if (!key || !IsStringUTF8(*key))
+    return nullopt;
+  return key;
+}
+
+Optional<BinaryValueReader::Node> BinaryValueReader::Node::GetDictValue(
+    size_t index) const {
+  WINBASE_CHECK(is_dict());
+  WINBASE_CHECK_LT(index, value_);
+  size_t entry = offset_ + kContainerHeaderSize + index * kDictEntrySize;
+  return ReadSlot(data_, entry + 4, children_begin(), end_);
+}
+
+Optional<BinaryValueReader::Node> BinaryValueReader::Node::FindKey(
+    StringPiece key) const {
+  WINBASE_CHECK(is_dict());
+  size_t low = 0;
+  size_t high = value_;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    // Only the key that matches needs to be checked for UTF-8.
+    Optional<StringPiece> middle_key =
+        ReadKeyRecord(data_, GetDictKeyOffset(middle));
+    if (!middle_key)
+      return nullopt;
+    int result = middle_key->compare(key);
+    if (result == 0) {
+      if (!IsStringUTF8(*middle_key))
+        return nullopt;
+      return GetDictValue(middle);
+    }
+    if (result < 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return nullopt;
+}
+
+Optional<BinaryValueReader::Node> BinaryValueReader::Node::FindPath(
+    std::initializer_list<StringPiece> path) const {
+  return FindPath(make_span(path.begin(), path.size()));
+}
+
+Optional<BinaryValueReader::Node> BinaryValueReader::Node::FindPath(
+    span<const StringPiece> path) const {
+  Optional<Node> cur = *this;
+  for (const StringPiece component : path) {
+    if (!cur->is_dict() || !(cur = cur->FindKey(component)))
+      return nullopt;
+  }
+  return cur;
+}
+
+// A key record is usually shared by many dictionaries, so it is checked and
+// turned into a ValueKey only the first time it is reached.
+class BinaryValueReader::Node::KeyCache {
+ public:
+  // Keys are interned in |table| unless it is null.
+  explicit KeyCache(ValueKeyTable* table) : table_(table) {}
+  KeyCache(const KeyCache&) = delete;
+  KeyCache& operator=(const KeyCache&) = delete;
+
+  // Returns the key whose record is at |offset| in |data|, or null if the
+  // record is invalid.
+  const ValueKey* Get(span<const uint8_t> data, size_t offset) {
+    auto found = keys_.find(offset);
+    if (found != keys_.end())
+      return &found->second;
+    Optional<StringPiece> key = ReadKeyRecord(data, offset);
+    if (!key || !IsStringUTF8(*key))
+      return nullptr;
+    return &keys_
+                .emplace(offset, table_ ? table_->Intern(*key) : ValueKey(*key))
+                .first->second;
+  }
+
+ private:
+  ValueKeyTable* const table_;
+  std::unordered_map<size_t, ValueKey> keys_;
+};
+
+Optional<Value> BinaryValueReader::Node::ToValue() const {
+  KeyCache keys(nullptr);
+  return ToValueAtDepth(0, &keys);
+}
+
+Optional<Value> BinaryValueReader::Node::ToValue(ValueKeyTable* keys) const {
+  WINBASE_DCHECK(keys);
+  KeyCache cache(keys);
+  return ToValueAtDepth(0, &cache);
+}
+
+size_t BinaryValueReader::Node::children_begin() const {
+  return offset_ + kContainerHeaderSize +
+         value_ * (is_dict() ? kDictEntrySize : kSlotSize);
+}
+
+size_t BinaryValueReader::Node::GetDictKeyOffset(size_t index) const {
+  return ReadUint32(data_,
+                    offset_ + kContainerHeaderSize + index * kDictEntrySize);
+}
+
+Optional<Value> BinaryValueReader::Node::ToValueAtDepth(int depth,
+                                                        KeyCache* keys) const {
+  switch (type_) {
+    case Value::Type::NONE:
+      return Value();
+    case Value::Type::BOOLEAN:
+      return Value(GetBool());
+    case Value::Type::INTEGER:
+      return Value(GetInt());
+    case Value::Type::DOUBLE:
+      return Value(GetDouble());
+    case Value::Type::STRING:
+      return Value(GetString());
+    case Value::Type::BINARY: {
+      span<const uint8_t> blob = GetBlob();
+      return Value(Value::BlobStorage(blob.begin(), blob.end()));
+    }
+    case Value::Type::DICTIONARY: {
+      if (depth >= BinaryValueWriter::kMaxDepth)
+        return nullopt;
+      std::vector<Value::DictStorage::value_type> entries;
+      entries.reserve(value_);
+      // Every value must start after the record of the one before, as the
+      // writer lays them out, so no record is decoded twice.
+      size_t begin = children_begin();
+      for (size_t i = 0; i < value_; ++i) {
+        size_t entry = offset_ + kContainerHeaderSize + i * kDictEntrySize;
+        const ValueKey* key = keys->Get(data_, ReadUint32(data_, entry));
+        Optional<Node> node = ReadSlot(data_, entry + 4, begin, end_);
+        if (!key || !node)
+          return nullopt;
+        if (node->has_record())
+          begin = node->end_;
+        Optional<Value> value = node->ToValueAtDepth(depth + 1, keys);
+        if (!value)
+          return nullopt;
+        entries.emplace_back(*key, std::move(*value));
+      }
+      return Value(Value::DictStorage(std::move(entries)));
+    }
+    case Value::Type::LIST: {
+      if (depth >= BinaryValueWriter::kMaxDepth)
+        return nullopt;
+      Value::ListStorage elements;
+      elements.reserve(value_);
+      // As for dictionaries, every element must follow the one before.
+      size_t begin = children_begin();
+      for (size_t i = 0; i < value_; ++i) {
+        Optional<Node> node =
+            ReadSlot(data_, offset_ + kContainerHeaderSize + i * kSlotSize,
+                     begin, end_);
+        if (!node)
+          return nullopt;
+        if (node->has_record())
+          begin = node->end_;
+        Optional<Value> value = node->ToValueAtDepth(depth + 1, keys);
+        if (!value)
+          return nullopt;
+        elements.push_back(std::move(*value));
+      }
+      return Value(std::move(elements));
+    }
+  }
+  WINBASE_NOTREACHED();
+  return nullopt;
+}
+
+}  // namespace winbase
@@ -0,0 +1,198 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// A compact binary encoding of Value that can be read in place. Writing a
+// Value tree with BinaryValueWriter and reading it back through a
+// MemoryMappedFile with BinaryValueReader avoids parsing the whole tree on
+// load: only the records that are visited are touched.
+//
+//   std::string data;
+//   BinaryValueWriter::Write(prefs, &data);
+//   ImportantFileWriter::WriteFileAtomically(path, data);
+//
+//   MemoryMappedFile file;
+//   file.Initialize(path);
+//   BinaryValueReader reader(make_span(file.data(), file.length()));
+//   Optional<BinaryValueReader::Node> homepage =
+//       reader.root()->FindPath({"browser", "homepage"});
+//
+// Format, version 1. Integers are little-endian, offsets are from the start of
+// the data and every record starts at a multiple of 4 bytes.
+//
+//   header      "WBVB", uint32 version, then the slot of the root.
+//   slot        uint8 type, 3 zero bytes, then a uint32 that is the value of a
+//               NONE (0), BOOLEAN (0 or 1) or INTEGER, and the offset of the
+//               record of any other type.
+//   DOUBLE      the 8 bytes of the double.
+//   STRING      uint32 length, then the bytes.
+//   BINARY      uint32 length, then the bytes.
+//   LIST        uint32 count, uint32 size of the record including the
+//               elements, the slot of every element, then the elements.
+//   DICTIONARY  uint32 count, uint32 size of the record including the values,
+//               for every entry in key order the uint32 offset of the key and
+//               the slot of the value, then the values and keys. Keys are
+//               stored like STRING records.
+//
+// A key is only written the first time it occurs; later entries refer to the
+// same record. Records are padded with zeros to a multiple of 4 bytes. Data of
+// at most 4 GiB can be written.
+
+#ifndef WINLIB_WINBASE_BINARY_VALUE_FORMAT_H_
+#define WINLIB_WINBASE_BINARY_VALUE_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <initializer_list>
+#include <string>
+
+#include "winbase\base_export.h"
+#include "winbase\containers\span.h"
+#include "winbase\optional.h"
+#include "winbase\strings\string_piece.h"
+#include "winbase\values.h"
+
+namespace winbase {
+
+class WINBASE_EXPORT BinaryValueWriter {
+ public:
+  // The version of the format written.
+  static const uint32_t kVersion;
+
+  // The deepest nesting of lists and dictionaries that can be written and
+  // read back.
+  static const int kMaxDepth;
+
+  // Replaces the contents of |output| with the encoding of |value|. Returns
+  // false if |value| is nested deeper than kMaxDepth or the encoding would be
+  // larger than 4 GiB.
+  static bool Write(const Value& value, std::string* output);
+
+ private:
+  BinaryValueWriter() = delete;
+};
+
+// Reads data written by BinaryValueWriter without copying it. The data is not
+// validated up front; every record is checked when it is reached, so reading
+// corrupt data returns nullopt instead of overrunning the buffer. The data
+// must outlive the reader and all nodes obtained from it.
+class WINBASE_EXPORT BinaryValueReader {
+ public:
+  class Node;
+
+  explicit BinaryValueReader(span<const uint8_t> data);
+  ~BinaryValueReader();
+
+  // Returns the root of the data, or nullopt if the header or the root record
+  // is invalid or of an unsupported version.
+  Optional<Node> root() const;
+
+ private:
+  const span<const uint8_t> data_;
+};
+
+// A record read by a BinaryValueReader. Nodes are cheap to copy.
+class WINBASE_EXPORT BinaryValueReader::Node {
+ public:
+  Value::Type type() const { return type_; }
+
+  bool is_none() const { return type() == Value::Type::NONE; }
+  bool is_bool() const { return type() == Value::Type::BOOLEAN; }
+  bool is_int() const { return type() == Value::Type::INTEGER; }
+  bool is_double() const { return type() == Value::Type::DOUBLE; }
+  bool is_string() const { return type() == Value::Type::STRING; }
+  bool is_blob() const { return type() == Value::Type::BINARY; }
+  bool is_dict() const { return type() == Value::Type::DICTIONARY; }
+  bool is_list() const { return type() == Value::Type::LIST; }
+
+  // These will all fatally assert if the type doesn't match. As with Value,
+  // GetDouble() also accepts integers.
+  bool GetBool() const;
+  int GetInt() const;
+  double GetDouble() const;
+  StringPiece GetString() const;
+  span<const uint8_t> GetBlob() const;
+
+  // Returns the number of elements of a list or entries of a dictionary.
+  // Fatally asserts for other types.
+  size_t size() const;
+
+  // Returns the element of a list at |index|, which must be less than size(),
+  // or nullopt if it is corrupt.
+  Optional<Node> GetListElement(size_t index) const;
+
+  // Returns the key and the value of the dictionary entry at |index|, which
+  // must be less than size(). Entries are sorted by key. Returns nullopt if
+  // they are corrupt.
+  Optional<StringPiece> GetDictKey(size_t index) const;
+  Optional<Node> GetDictValue(size_t index) const;
+
+  // Returns the value for |key| in this dictionary, found by binary search, or
+  // nullopt if there is none. Fatally asserts if this node is not a
+  // dictionary.
+  Optional<Node> FindKey(StringPiece key) const;
+
+  // Looks up a value in nested dictionaries, like Value::FindPath(). Returns
+  // nullopt if a component is missing or not a dictionary.
+  Optional<Node> FindPath(std::initializer_list<StringPiece> path) const;
+  Optional<Node> FindPath(span<const StringPiece> path) const;
+
+  // Decodes this node and everything below it into a Value. Returns nullopt if
+  // any part of it is corrupt, including when the records of the children of
+  // a list or dictionary are not in order or overlap. That keeps crafted data
+  // from referring to one record many times to decode to something far larger
+  // than itself.
+  Optional<Value> ToValue() const;
+  // Like ToValue(), but interns the dictionary keys in |keys|, so that a key
+  // stored once in the data is also stored once in the result.
+  Optional<Value> ToValue(ValueKeyTable* keys) const;
+
+ private:
+  friend class BinaryValueReader;
+
+  // Reads the slot at |slot| in |data|. The record it refers to, if any, must
+  // lie in data[begin, end). Returns nullopt if the slot or the record is
+  // invalid.
+  static Optional<Node> ReadSlot(span<const uint8_t> data,
+                                 size_t slot,
+                                 size_t begin,
+                                 size_t end);
+
+  Node(span<const uint8_t> data,
+       Value::Type type,
+       uint32_t value,
+       size_t offset,
+       size_t end);
+
+  // The offset of the first byte after the slots or entries of a list or
+  // dictionary, before which no child may start.
+  size_t children_begin() const;
+
+  // Whether the value of this node is stored in a record of its own.
+  bool has_record() const { return !is_none() && !is_bool() && !is_int(); }
+
+  // The offset of the key record of the dictionary entry at |index|.
+  size_t GetDictKeyOffset(size_t index) const;
+
+  // The keys decoded by ToValue(), by the offset of their record.
+  class KeyCache;
+
+  Optional<Value> ToValueAtDepth(int depth, KeyCache* keys) const;
+
+  span<const uint8_t> data_;
+  Value::Type type_;
+
+  // The value of a NONE, BOOLEAN or INTEGER, the length of a STRING or BINARY,
+  // and the count of a LIST or DICTIONARY.
+  uint32_t value_;
+
+  // The bytes of a STRING or BINARY, or the record of another type that has
+  // one, are data_[offset_, end_).
+  size_t offset_;
+  size_t end_;
+};
+
+}  // namespace winbase
+
+#endif  // WINLIB_WINBASE_BINARY_VALUE_FORMAT_H_
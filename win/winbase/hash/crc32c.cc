@@ -0,0 +1,109 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "winbase\hash\crc32c.h"
+
+#include <string.h>
+
+#include "winbase\cpu.h"
+#include "winlib\build_config.h"
+
+#if defined(ARCH_CPU_X86_FAMILY)
+#include <immintrin.h>
+#endif
+
+namespace winbase {
+
+namespace {
+
+// The CRC-32C polynomial, bit-reversed.
+const uint32_t kPolynomial = 0x82F63B78;
+
+// Tables for the software implementation, which handles 8 bytes per step:
+// table[k][b] is the checksum update for the byte |b| followed by |k| zero
+// bytes.
+struct Crc32cTables {
+  Crc32cTables() {
+    for (uint32_t b = 0; b < 256; ++b) {
+      uint32_t crc = b;
+      for (int i = 0; i < 8; ++i)
+        crc = (crc >> 1) ^ ((crc & 1) ? kPolynomial : 0);
+      table[0][b] = crc;
+    }
+    for (int k = 1; k < 8; ++k) {
+      for (uint32_t b = 0; b < 256; ++b) {
+        table[k][b] =
+            (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+      }
+    }
+  }
+
+  uint32_t table[8][256];
+};
+
+// The functions below take and return the inverted checksum.
+typedef uint32_t (*Crc32cFunction)(uint32_t crc,
+                                   const uint8_t* data,
+                                   size_t length);
+
+uint32_t Crc32cSoftware(uint32_t crc, const uint8_t* data, size_t length) {
+  static const Crc32cTables tables;
+  const uint32_t(&t)[8][256] = tables.table;
+  for (; length >= 8; data += 8, length -= 8) {
+    // The data is little-endian, like the CPUs Windows runs on.
+    uint32_t low, high;
+    memcpy(&low, data, sizeof(low));
+    memcpy(&high, data + 4, sizeof(high));
+    low ^= crc;
+    crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^
+          t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^ t[3][high & 0xFF] ^
+          t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^
+          t[0][high >> 24];
+  }
+  for (; length; ++data, --length)
+    crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+  return crc;
+}
+
+#if defined(ARCH_CPU_X86_FAMILY)
+
+uint32_t Crc32cSSE42(uint32_t crc, const uint8_t* data, size_t length) {
+#if defined(ARCH_CPU_X86_64)
+  uint64_t crc64 = crc;
+  for (; length >= 8; data += 8, length -= 8) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    crc64 = _mm_crc32_u64(crc64, value);
+  }
+  crc = static_cast<uint32_t>(crc64);
+#endif
+  for (; length >= 4; data += 4, length -= 4) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    crc = _mm_crc32_u32(crc, value);
+  }
+  for (; length; ++data, --length)
+    crc = _mm_crc32_u8(crc, *data);
+  return crc;
+}
+
+#endif  // defined(ARCH_CPU_X86_FAMILY)
+
+Crc32cFunction SelectCrc32cFunction() {
+#if defined(ARCH_CPU_X86_FAMILY)
+  if (CPU().has_sse42())
+    return &Crc32cSSE42;
+#endif
+  return &Crc32cSoftware;
+}
+
+}  // namespace
+
+uint32_t Crc32c(uint32_t crc, const void* data, size_t length) {
+  // The CPU is only queried once.
+  static const Crc32cFunction function = SelectCrc32cFunction();
+  return ~function(~crc, static_cast<const uint8_t*>(data), length);
+}
+
+}  // namespace winbase
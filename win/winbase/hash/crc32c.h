@@ -0,0 +1,27 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef WINLIB_WINBASE_HASH_CRC32C_H_
+#define WINLIB_WINBASE_HASH_CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "winbase\base_export.h"
+
+namespace winbase {
+
+// Computes the CRC-32C (Castagnoli) checksum of the |length| bytes at |data|,
+// continuing from |crc|, the checksum of the bytes before them. Start with 0;
+// checksumming data in pieces gives the same result as all at once:
+//
+//   uint32_t crc = Crc32c(0, first, first_length);
+//   crc = Crc32c(crc, second, second_length);
+//
+// Uses the SSE4.2 CRC32 instruction when the CPU has it.
+WINBASE_EXPORT uint32_t Crc32c(uint32_t crc, const void* data, size_t length);
+
+}  // namespace winbase
+
+#endif  // WINLIB_WINBASE_HASH_CRC32C_H_
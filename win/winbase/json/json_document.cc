@@ -0,0 +1,298 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "winbase\json\json_document.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "winbase\json\json_handler.h"
+#include "winbase\json\json_parser.h"
+#include "winbase\logging.h"
+
+namespace winbase {
+
+// Builds the nodes of a JSONDocument from the events of the streaming parser.
+// The nodes of the containers that are still open are kept on |pending_|; when
+// a container is closed its children are moved to the end of the document's
+// node array as one contiguous range.
+class JSONDocument::Builder : public JSONHandler {
+ public:
+  Builder(StringPiece input, JSONDocument* document)
+      : input_(input), document_(document) {}
+
+  // Links the nodes together once the whole input has been parsed.
+  void Finish() {
+    WINBASE_DCHECK_EQ(1u, pending_.size());
+    std::vector<Node>& nodes = document_->nodes_;
+    nodes.push_back(pending_.back());
+    for (Node& node : nodes) {
+      if (node.is_list() || node.is_dict())
+        node.children_.first = nodes.data() + node.children_.first_index;
+    }
+    document_->root_ = &nodes.back();
+  }
+
+  // JSONHandler:
+  bool OnNull() override {
+    AddNode(Value::Type::NONE);
+    return true;
+  }
+
+  bool OnBool(bool value) override {
+    AddNode(Value::Type::BOOLEAN).bool_value_ = value;
+    return true;
+  }
+
+  bool OnInt(int value) override {
+    AddNode(Value::Type::INTEGER).int_value_ = value;
+    return true;
+  }
+
+  bool OnDouble(double value) override {
+    AddNode(Value::Type::DOUBLE).double_value_ = value;
+    return true;
+  }
+
+  bool OnString(StringPiece value) override {
+    AddNode(Value::Type::STRING).string_value_ = Borrow(value);
+    return true;
+  }
+
+  bool OnStartDict() override {
+    AddNode(Value::Type::DICTIONARY);
+    open_containers_.push_back(pending_.size());
+    return true;
+  }
+
+  bool OnKey(StringPiece key) override {
+    key_ = Borrow(key);
+    return true;
+  }
+
+  bool OnEndDict() override {
+    Node* begin = pending_.data() + open_containers_.back();
+    Node* end = pending_.data() + pending_.size();
+    std::stable_sort(begin, end, [](const Node& lhs, const Node& rhs) {
+      return lhs.key_ < rhs.key_;
+    });
+    // Of several entries with the same key, keep the last one.
+    Node* out = begin;
+    for (Node* it = begin; it != end; ++it) {
+      if (it + 1 != end && it[1].key_ == it->key_)
+        continue;
+      *out++ = *it;
+    }
+    pending_.erase(pending_.begin() + (out - pending_.data()), pending_.end());
+    CloseContainer();
+    return true;
+  }
+
+  bool OnStartList() override {
+    AddNode(Value::Type::LIST);
+    open_containers_.push_back(pending_.size());
+    return true;
+  }
+
+  bool OnEndList() override {
+    CloseContainer();
+    return true;
+  }
+
+ private:
+  // Appends a node for the next value to the innermost open container.
+  Node& AddNode(Value::Type type) {
+    Node node;
+    node.type_ = type;
+    node.key_ = key_;
+    key_ = StringPiece();
+    pending_.push_back(node);
+    return pending_.back();
+  }
+
+  // Moves the children of the innermost open container to the document.
+  void CloseContainer() {
+    size_t first = open_containers_.back();
+    open_containers_.pop_back();
+
+    std::vector<Node>& nodes = document_->nodes_;
+    Node& container = pending_[first - 1];
+    container.children_.first_index = nodes.size();
+    container.children_.size = pending_.size() - first;
+    nodes.insert(nodes.end(), pending_.begin() + first, pending_.end());
+    pending_.erase(pending_.begin() + first, pending_.end());
+  }
+
+  // Returns |str| if it points into the input, or else a copy of it owned by
+  // the document.
+  StringPiece Borrow(StringPiece str) {
+    if (str.data() >= input_.data() &&
+        str.data() + str.size() <= input_.data() + input_.size()) {
+      return str;
+    }
+    document_->decoded_strings_.emplace_back(str.data(), str.size());
+    return document_->decoded_strings_.back();
+  }
+
+  const StringPiece input_;
+  JSONDocument* const document_;
+
+  // The nodes of the values in containers that are still open.
+  std::vector<Node> pending_;
+
+  // For every open container, the index in |pending_| of its first child.
+  std::vector<size_t> open_containers_;
+
+  // The key of the next dictionary entry.
+  StringPiece key_;
+};
+
+JSONDocument::JSONDocument() : root_(nullptr) {}
+
+JSONDocument::~JSONDocument() = default;
+
+// static
+std::unique_ptr<JSONDocument> JSONDocument::Parse(StringPiece json,
+                                                  int options,
+                                                  int max_depth) {
+  std::unique_ptr<JSONDocument> document(new JSONDocument);
+  Builder builder(json, document.get());
+  internal::JSONParser parser(options, max_depth);
+  if (!parser.ParseStreaming(json, &builder))
+    return nullptr;
+  builder.Finish();
+  return document;
+}
+
+// static
+std::unique_ptr<JSONDocument> JSONDocument::ParseAndReturnError(
+    StringPiece json,
+    int options,
+    int* error_code_out,
+    std::string* error_msg_out,
+    int* error_line_out,
+    int* error_column_out) {
+  std::unique_ptr<JSONDocument> document(new JSONDocument);
+  Builder builder(json, document.get());
+  internal::JSONParser parser(options);
+  if (!parser.ParseStreaming(json, &builder)) {
+    if (error_code_out)
+      *error_code_out = parser.error_code();
+    if (error_msg_out)
+      *error_msg_out = parser.GetErrorMessage();
+    if (error_line_out)
+      *error_line_out = parser.error_line();
+    if (error_column_out)
+      *error_column_out = parser.error_column();
+    return nullptr;
+  }
+  builder.Finish();
+  return document;
+}
+
+bool JSONDocument::Node::GetBool() const {
+  WINBASE_CHECK(is_bool());
+  return bool_value_;
+}
+
+int JSONDocument::Node::GetInt() const {
+  WINBASE_CHECK(is_int());
+  return int_value_;
+}
+
+double JSONDocument::Node::GetDouble() const {
+  if (is_double())
+    return double_value_;
+  if (is_int())
+    return int_value_;
+  WINBASE_CHECK(false);
+  return 0.0;
+}
+
+StringPiece JSONDocument::Node::GetString() const {
+  WINBASE_CHECK(is_string());
+  return string_value_;
+}
+
+span<const JSONDocument::Node> JSONDocument::Node::GetList() const {
+  WINBASE_CHECK(is_list());
+  return make_span(children_.first, children_.size);
+}
+
+span<const JSONDocument::Node> JSONDocument::Node::DictItems() const {
+  WINBASE_CHECK(is_dict());
+  return make_span(children_.first, children_.size);
+}
+
+const JSONDocument::Node* JSONDocument::Node::FindKey(StringPiece key) const {
+  WINBASE_CHECK(is_dict());
+  const Node* end = children_.first + children_.size;
+  const Node* found = std::lower_bound(
+      children_.first, end, key,
+      [](const Node& node, StringPiece key) { return node.key_ < key; });
+  if (found == end || found->key_ != key)
+    return nullptr;
+  return found;
+}
+
+const JSONDocument::Node* JSONDocument::Node::FindKeyOfType(
+    StringPiece key,
+    Value::Type type) const {
+  const Node* result = FindKey(key);
+  if (!result || result->type() != type)
+    return nullptr;
+  return result;
+}
+
+const JSONDocument::Node* JSONDocument::Node::FindPath(
+    std::initializer_list<StringPiece> path) const {
+  return FindPath(make_span(path.begin(), path.size()));
+}
+
+const JSONDocument::Node* JSONDocument::Node::FindPath(
+    span<const StringPiece> path) const {
+  const Node* cur = this;
+  for (const StringPiece component : path) {
+    if (!cur->is_dict() || (cur = cur->FindKey(component)) == nullptr)
+      return nullptr;
+  }
+  return cur;
+}
+
+Value JSONDocument::Node::ToValue() const {
+  switch (type_) {
+    case Value::Type::NONE:
+      return Value();
+    case Value::Type::BOOLEAN:
+      return Value(bool_value_);
+    case Value::Type::INTEGER:
+      return Value(int_value_);
+    case Value::Type::DOUBLE:
+      return Value(double_value_);
+    case Value::Type::STRING:
+      return Value(string_value_);
+    case Value::Type::DICTIONARY: {
+      // The entries are already sorted and unique.
+      std::vector<Value::DictStorage::value_type> entries;
+      entries.reserve(children_.size);
+      for (const Node& child : DictItems()) {
+        entries.emplace_back(ValueKey(child.key_), child.ToValue());
+      }
+      return Value(Value::DictStorage(std::move(entries)));
+    }
+    case Value::Type::LIST: {
+      Value::ListStorage elements;
+      elements.reserve(children_.size);
+      for (const Node& child : GetList())
+        elements.push_back(child.ToValue());
+      return Value(std::move(elements));
+    }
+    case Value::Type::BINARY:
+      break;
+  }
+  WINBASE_NOTREACHED();
+  return Value();
+}
+
+}  // namespace winbase
@@ -0,0 +1,170 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef WINLIB_WINBASE_JSON_JSON_DOCUMENT_H_
+#define WINLIB_WINBASE_JSON_JSON_DOCUMENT_H_
+
+#include <stddef.h>
+
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "winbase\base_export.h"
+#include "winbase\containers\span.h"
+#include "winbase\json\json_reader.h"
+#include "winbase\strings\string_piece.h"
+#include "winbase\values.h"
+
+namespace winbase {
+
+// A read-only, parsed JSON document that borrows its input. Strings and
+// dictionary keys without escape sequences are not copied; they point directly
+// into the buffer that was parsed. Only strings that had to be decoded are
+// stored in the document itself. All nodes of the document live in a single
+// array, so parsing makes a small, fixed number of allocations no matter how
+// many values the document contains.
+//
+// This suits large inputs that are only inspected, e.g. a file mapped with
+// MemoryMappedFile:
+//
+//   MemoryMappedFile file;
+//   file.Initialize(path);
+//   StringPiece json(reinterpret_cast<const char*>(file.data()),
+//                    file.length());
+//   std::unique_ptr<JSONDocument> doc = JSONDocument::Parse(json);
+//   const JSONDocument::Node* name = doc->root().FindKey("name");
+//
+// The document must not outlive the buffer it was parsed from. The accepted
+// input, the options and the error reporting are those of JSONReader. Use
+// ToValue() to get a mutable copy of all or part of the document.
+class WINBASE_EXPORT JSONDocument {
+ public:
+  class Node;
+
+  JSONDocument(const JSONDocument&) = delete;
+  JSONDocument& operator=(const JSONDocument&) = delete;
+
+  ~JSONDocument();
+
+  // Parses |json|, which must outlive the returned document. Returns nullptr
+  // if |json| is not a properly formed JSON string.
+  static std::unique_ptr<JSONDocument> Parse(
+      StringPiece json,
+      int options = JSON_PARSE_RFC,
+      int max_depth = JSONReader::kStackMaxDepth);
+
+  // Parses |json| like Parse(). The error outputs are optional and are
+  // populated exactly like in JSONReader::ReadAndReturnError().
+  static std::unique_ptr<JSONDocument> ParseAndReturnError(
+      StringPiece json,
+      int options,  // JSONParserOptions
+      int* error_code_out,
+      std::string* error_msg_out,
+      int* error_line_out = nullptr,
+      int* error_column_out = nullptr);
+
+  const Node& root() const { return *root_; }
+
+ private:
+  class Builder;
+
+  JSONDocument();
+
+  // All nodes of the document. The children of every list and dictionary are
+  // stored next to each other.
+  std::vector<Node> nodes_;
+
+  // Storage for the strings and keys that contained escape sequences. A deque
+  // never moves its elements, so the nodes can point into them.
+  std::deque<std::string> decoded_strings_;
+
+  const Node* root_;
+};
+
+// A value in a JSONDocument. Nodes are owned by their document and can only be
+// reached through it.
+class WINBASE_EXPORT JSONDocument::Node {
+ public:
+  Value::Type type() const { return type_; }
+
+  bool is_none() const { return type() == Value::Type::NONE; }
+  bool is_bool() const { return type() == Value::Type::BOOLEAN; }
+  bool is_int() const { return type() == Value::Type::INTEGER; }
+  bool is_double() const { return type() == Value::Type::DOUBLE; }
+  bool is_string() const { return type() == Value::Type::STRING; }
+  bool is_dict() const { return type() == Value::Type::DICTIONARY; }
+  bool is_list() const { return type() == Value::Type::LIST; }
+
+  // These will all fatally assert if the type doesn't match. As with Value,
+  // GetDouble() also accepts integers.
+  bool GetBool() const;
+  int GetInt() const;
+  double GetDouble() const;
+  StringPiece GetString() const;
+
+  // Returns the elements of a list, in input order.
+  span<const Node> GetList() const;
+
+  // Returns the entries of a dictionary, sorted by key. Use key() to get the
+  // key of an entry. If a key appeared more than once, only the last value
+  // given for it is kept, as in Value.
+  span<const Node> DictItems() const;
+
+  // Returns the key of a dictionary entry, and an empty StringPiece for nodes
+  // that are not dictionary entries.
+  StringPiece key() const { return key_; }
+
+  // Returns the value for |key| in this dictionary, or nullptr if there is
+  // none. Fatally asserts if this node is not a dictionary.
+  const Node* FindKey(StringPiece key) const;
+
+  // Like FindKey(), but also returns nullptr if the value is not of |type|.
+  const Node* FindKeyOfType(StringPiece key, Value::Type type) const;
+
+  // Looks up a value in nested dictionaries, like Value::FindPath(). Returns
+  // nullptr if a component is missing or not a dictionary.
+  const Node* FindPath(std::initializer_list<StringPiece> path) const;
+  const Node* FindPath(span<const StringPiece> path) const;
+
+  // Returns a deep copy of this node as a Value, equal to what JSONReader
+  // would have produced for it.
+  Value ToValue() const;
+
+ private:
+  friend class JSONDocument;
+
+  // The children of a list or dictionary.
+  struct Children {
+    // While the document is being built this is the index of the first child
+    // in |nodes_| rather than a pointer to it, as |nodes_| may still be
+    // reallocated.
+    union {
+      size_t first_index;
+      const Node* first;
+    };
+    size_t size;
+  };
+
+  Node() : type_(Value::Type::NONE), int_value_(0) {}
+
+  Value::Type type_;
+
+  // The key of this node when it is a dictionary entry.
+  StringPiece key_;
+
+  union {
+    bool bool_value_;
+    int int_value_;
+    double double_value_;
+    StringPiece string_value_;
+    Children children_;
+  };
+};
+
+}  // namespace winbase
+
+#endif  // WINLIB_WINBASE_JSON_JSON_DOCUMENT_H_
@@ -0,0 +1,51 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef WINLIB_WINBASE_JSON_JSON_HANDLER_H_
+#define WINLIB_WINBASE_JSON_JSON_HANDLER_H_
+
+#include "winbase\base_export.h"
+#include "winbase\strings\string_piece.h"
+
+namespace winbase {
+
+// Receives the contents of a JSON document as a sequence of events, in input
+// order, from JSONReader::ReadStreaming(). This avoids building a Value tree
+// when the caller only needs to look at the data once.
+//
+// A dictionary is reported as OnStartDict(), then OnKey() followed by the
+// events of the value for every entry, then OnEndDict(). Lists are reported
+// the same way without the keys. Duplicate keys are reported as they appear.
+//
+// Every callback returns true to continue parsing, or false to stop parsing
+// right away. The default implementations ignore the event and continue.
+//
+// The StringPiece arguments are only valid for the duration of the call. They
+// point into the input when the string contains no escape sequences, so no
+// copy is made in the common case.
+class WINBASE_EXPORT JSONHandler {
+ public:
+  virtual ~JSONHandler() = default;
+
+  virtual bool OnNull() { return true; }
+  virtual bool OnBool(bool value) { return true; }
+
+  // Numbers that fit into an int are reported with OnInt(), all others with
+  // OnDouble(), just like JSONReader::Read() does.
+  virtual bool OnInt(int value) { return true; }
+  virtual bool OnDouble(double value) { return true; }
+
+  virtual bool OnString(StringPiece value) { return true; }
+
+  virtual bool OnStartDict() { return true; }
+  virtual bool OnKey(StringPiece key) { return true; }
+  virtual bool OnEndDict() { return true; }
+
+  virtual bool OnStartList() { return true; }
+  virtual bool OnEndList() { return true; }
+};
+
+}  // namespace winbase
+
+#endif  // WINLIB_WINBASE_JSON_JSON_HANDLER_H_
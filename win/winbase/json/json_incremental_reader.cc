@@ -0,0 +1,807 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "winbase\json\json_incremental_reader.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "winbase\json\json_handler.h"
+#include "winbase\json\json_parser.h"
+#include "winbase\logging.h"
+#include "winbase\numerics\safe_conversions.h"
+#include "winbase\strings\string_number_conversions.h"
+#include "winbase\strings\string_util.h"
+#include "winbase\third_party\icu\icu_utf.h"
+#include "winbase\values.h"
+
+namespace winbase {
+
+namespace {
+
+// The first character of every token, as classified by JSONParser.
+enum Token {
+  T_OBJECT_BEGIN,
+  T_OBJECT_END,
+  T_ARRAY_BEGIN,
+  T_ARRAY_END,
+  T_STRING,
+  T_NUMBER,
+  T_BOOL_TRUE,
+  T_BOOL_FALSE,
+  T_NULL,
+  T_LIST_SEPARATOR,
+  T_OBJECT_PAIR_SEPARATOR,
+  T_END_OF_INPUT,
+  T_INVALID_TOKEN,
+};
+
+Token TokenForChar(char c) {
+  switch (c) {
+    case '{':
+      return T_OBJECT_BEGIN;
+    case '}':
+      return T_OBJECT_END;
+    case '[':
+      return T_ARRAY_BEGIN;
+    case ']':
+      return T_ARRAY_END;
+    case '"':
+      return T_STRING;
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+    case '-':
+      return T_NUMBER;
+    case 't':
+      return T_BOOL_TRUE;
+    case 'f':
+      return T_BOOL_FALSE;
+    case 'n':
+      return T_NULL;
+    case ',':
+      return T_LIST_SEPARATOR;
+    case ':':
+      return T_OBJECT_PAIR_SEPARATOR;
+    default:
+      return T_INVALID_TOKEN;
+  }
+}
+
+// Given an escape sequence starting with the '\' at |escape|, with |available|
+// bytes of input after it, sets |length| to the number of bytes that
+// JSONParser consumes for it before it looks for the next character of the
+// string. Returns false if that is not known without more input.
+bool GetEscapeSequenceLength(const char* escape,
+                             size_t available,
+                             size_t* length) {
+  if (available < 2)
+    return false;
+
+  switch (escape[1]) {
+    case 'x':
+      // \xXX
+      if (available < 4)
+        return false;
+      *length = 4;
+      return true;
+    case 'u': {
+      // \uXXXX, possibly followed by the \uXXXX of a low surrogate.
+      if (available < 6)
+        return false;
+      int code_unit16_high = 0;
+      if (!HexStringToInt(StringPiece(escape + 2, 4), &code_unit16_high) ||
+          !CBU16_IS_SURROGATE(code_unit16_high) ||
+          !CBU16_IS_SURROGATE_LEAD(code_unit16_high)) {
+        *length = 6;
+        return true;
+      }
+      if (available < 8)
+        return false;
+      if (StringPiece(escape + 6, 2) != "\\u") {
+        *length = 6;
+        return true;
+      }
+      if (available < 12)
+        return false;
+      *length = 12;
+      return true;
+    }
+    default:
+      *length = 2;
+      return true;
+  }
+}
+
+// Receives the string that a JSONParser finds in a string token cut out of
+// the input, and either passes it on or keeps a copy of it.
+class StringTokenHandler : public JSONHandler {
+ public:
+  // Passes the string to |handler| if |key| is null, else copies it to |key|.
+  StringTokenHandler(JSONHandler* handler, std::string* key)
+      : handler_(handler), key_(key) {}
+
+  bool OnString(StringPiece value) override {
+    if (key_) {
+      value.CopyToString(key_);
+      return true;
+    }
+    return handler_->OnString(value);
+  }
+
+ private:
+  JSONHandler* const handler_;
+  std::string* const key_;
+};
+
+// Receives the number that a JSONParser finds in a number token cut out of
+// the input.
+class NumberTokenHandler : public JSONHandler {
+ public:
+  NumberTokenHandler() = default;
+
+  bool OnInt(int value) override {
+    is_int_ = true;
+    int_value_ = value;
+    return true;
+  }
+
+  bool OnDouble(double value) override {
+    is_int_ = false;
+    double_value_ = value;
+    return true;
+  }
+
+  bool is_int() const { return is_int_; }
+  int int_value() const { return int_value_; }
+  double double_value() const { return double_value_; }
+
+ private:
+  bool is_int_ = false;
+  int int_value_ = 0;
+  double double_value_ = 0;
+};
+
+}  // namespace
+
+// Builds a Value from the events of a document, like JSONParser does when it
+// parses the whole document at once.
+class JSONIncrementalReader::ValueBuilder : public JSONHandler {
+ public:
+  ValueBuilder() = default;
+
+  std::unique_ptr<Value> TakeValue() { return std::move(root_); }
+
+  bool OnNull() override { return AddValue(Value()); }
+  bool OnBool(bool value) override { return AddValue(Value(value)); }
+  bool OnInt(int value) override { return AddValue(Value(value)); }
+  bool OnDouble(double value) override { return AddValue(Value(value)); }
+  bool OnString(StringPiece value) override { return AddValue(Value(value)); }
+
+  bool OnStartDict() override {
+    containers_.emplace_back(true);
+    return true;
+  }
+
+  bool OnKey(StringPiece key) override {
+    containers_.back().key = ValueKey(key);
+    return true;
+  }
+
+  bool OnEndDict() override {
+    Container dict = std::move(containers_.back());
+    containers_.pop_back();
+    return AddValue(Value(
+        Value::DictStorage(std::move(dict.dict_storage), KEEP_LAST_OF_DUPES)));
+  }
+
+  bool OnStartList() override {
+    containers_.emplace_back(false);
+    return true;
+  }
+
+  bool OnEndList() override {
+    Container list = std::move(containers_.back());
+    containers_.pop_back();
+    return AddValue(Value(std::move(list.list_storage)));
+  }
+
+ private:
+  // A dictionary or list whose end has not been seen yet. Dictionary entries
+  // are sorted once at the end, as in JSONParser.
+  struct Container {
+    explicit Container(bool is_dict) : is_dict(is_dict) {}
+
+    bool is_dict;
+    ValueKey key;
+    std::vector<Value::DictStorage::value_type> dict_storage;
+    Value::ListStorage list_storage;
+  };
+
+  bool AddValue(Value value) {
+    if (containers_.empty()) {
+      root_ = std::make_unique<Value>(std::move(value));
+      return true;
+    }
+
+    Container& container = containers_.back();
+    if (container.is_dict) {
+      container.dict_storage.emplace_back(std::move(container.key),
+                                          std::move(value));
+    } else {
+      container.list_storage.push_back(std::move(value));
+    }
+    return true;
+  }
+
+  std::vector<Container> containers_;
+  std::unique_ptr<Value> root_;
+};
+
+JSONIncrementalReader::JSONIncrementalReader(int options, int max_depth)
+    : JSONIncrementalReader(nullptr, options, max_depth) {}
+
+JSONIncrementalReader::JSONIncrementalReader(JSONHandler* handler,
+                                             int options,
+                                             int max_depth)
+    : value_builder_(handler ? nullptr : new ValueBuilder),
+      handler_(handler ? handler : value_builder_.get()),
+      options_(options),
+      max_depth_(max_depth),
+      pos_(0),
+      at_end_(false),
+      input_index_(0),
+      total_size_(0),
+      previous_char_('\0'),
+      state_(State::kRootValue),
+      is_success_(false),
+      checked_bom_(false),
+      token_ready_(false),
+      comment_state_(CommentState::kNone),
+      block_comment_previous_char_('\0'),
+      scan_offset_(0),
+      number_state_(NumberState::kSign),
+      number_digits_(0),
+      number_is_valid_(false),
+      number_is_int_(false),
+      number_int_(0),
+      number_double_(0),
+      number_trailing_lines_(0),
+      line_number_(1),
+      index_last_line_(0),
+      error_code_(JSONReader::JSON_NO_ERROR),
+      error_line_(0),
+      error_column_(0) {
+  WINBASE_CHECK_LE(max_depth, JSONReader::kStackMaxDepth);
+}
+
+JSONIncrementalReader::~JSONIncrementalReader() = default;
+
+bool JSONIncrementalReader::Feed(StringPiece chunk) {
+  if (state_ == State::kDone)
+    return false;
+
+  // Parse straight out of |chunk| unless part of a token is left over from
+  // the previous one.
+  if (pending_.empty()) {
+    input_ = chunk;
+  } else {
+    chunk.AppendToString(&pending_);
+    input_ = pending_;
+  }
+  pos_ = 0;
+  at_end_ = false;
+
+  // Positions are ints, as in JSONParser.
+  total_size_ += chunk.size();
+  if (!IsValueInRangeForNumericType<int32_t>(total_size_))
+    ReportError(JSONReader::JSON_TOO_LARGE, 0);
+  else
+    Process();
+
+  // Keep what has not been consumed for the next call.
+  if (input_.data() == pending_.data())
+    pending_.erase(0, pos_);
+  else
+    pending_.assign(input_.data() + pos_, input_.size() - pos_);
+  input_index_ += static_cast<int>(pos_);
+  input_ = StringPiece();
+  pos_ = 0;
+
+  return state_ != State::kDone;
+}
+
+bool JSONIncrementalReader::Finish() {
+  if (state_ != State::kDone) {
+    input_ = pending_;
+    pos_ = 0;
+    at_end_ = true;
+    Result result = Process();
+    WINBASE_DCHECK(result == Result::kDone);
+    input_ = StringPiece();
+    pending_.clear();
+  }
+  return is_success_;
+}
+
+std::unique_ptr<Value> JSONIncrementalReader::TakeValue() {
+  if (!value_builder_ || !is_success_)
+    return nullptr;
+  return value_builder_->TakeValue();
+}
+
+std::string JSONIncrementalReader::GetErrorMessage() const {
+  return internal::JSONParser::FormatErrorMessage(
+      error_line_, error_column_, JSONReader::ErrorCodeToString(error_code_));
+}
+
+JSONIncrementalReader::Result JSONIncrementalReader::Process() {
+  if (!checked_bom_) {
+    // Skip a UTF-8 Byte-Order-Mark, like JSONParser::Parse().
+    static const char kByteOrderMark[] = "\xEF\xBB\xBF";
+    size_t available = input_.size() - pos_;
+    if (available < 3 && !at_end_)
+      return Result::kNeedMoreInput;
+    if (StringPiece(input_.data() + pos_, std::min<size_t>(available, 3)) ==
+        kByteOrderMark) {
+      Advance(3);
+    }
+    checked_bom_ = true;
+  }
+
+  while (state_ != State::kDone) {
+    if (!token_ready_) {
+      if (!EatWhitespaceAndComments())
+        return Result::kNeedMoreInput;
+      token_ready_ = true;
+    }
+    if (!HandleToken())
+      return Result::kNeedMoreInput;
+  }
+  return Result::kDone;
+}
+
+bool JSONIncrementalReader::EatWhitespaceAndComments() {
+  while (pos_ < input_.size()) {
+    char c = input_[pos_];
+
+    if (comment_state_ == CommentState::kLineComment) {
+      // The line break ending the comment is handled as whitespace.
+      if (c == '\n' || c == '\r')
+        comment_state_ = CommentState::kNone;
+      else
+        Advance(1);
+      continue;
+    }
+
+    if (comment_state_ == CommentState::kBlockComment) {
+      Advance(1);
+      if (block_comment_previous_char_ == '*' && c == '/')
+        comment_state_ = CommentState::kNone;
+      else
+        block_comment_previous_char_ = c;
+      continue;
+    }
+
+    switch (c) {
+      case '\r':
+      case '\n':
+        index_last_line_ = index();
+        // Don't increment line_number_ twice for "\r\n".
+        if (!(c == '\n' && previous_char_ == '\r')) {
+          ++line_number_;
+          if (state_ == State::kNumberEnd)
+            ++number_trailing_lines_;
+        }
+        Advance(1);
+        break;
+      case ' ':
+      case '\t':
+        Advance(1);
+        break;
+      case '/': {
+        if (input_.size() - pos_ < 2)
+          return at_end_;
+        char next = input_[pos_ + 1];
+        Advance(2);
+        if (next == '/') {
+          comment_state_ = CommentState::kLineComment;
+        } else if (next == '*') {
+          comment_state_ = CommentState::kBlockComment;
+          block_comment_previous_char_ = '\0';
+        } else {
+          // Not a comment after all. JSONParser skips both characters and
+          // takes whatever follows as the next token.
+          return true;
+        }
+        break;
+      }
+      default:
+        return true;
+    }
+  }
+
+  // An unterminated comment ends at the end of the input.
+  return at_end_;
+}
+
+bool JSONIncrementalReader::HandleToken() {
+  // Whitespace skipping can also stop right at the end of the available input,
+  // after something that looked like a comment but was not.
+  if (pos_ == input_.size() && !at_end_)
+    return false;
+
+  Token token =
+      pos_ < input_.size() ? TokenForChar(input_[pos_]) : T_END_OF_INPUT;
+
+  switch (state_) {
+    case State::kRootValue:
+    case State::kValue:
+      return HandleValue();
+
+    case State::kListFirst:
+    case State::kListNext:
+      if (token != T_ARRAY_END)
+        return HandleValue();
+      if (state_ == State::kListNext &&
+          !(options_ & JSON_ALLOW_TRAILING_COMMAS)) {
+        ReportError(JSONReader::JSON_TRAILING_COMMA, 1);
+        return true;
+      }
+      CloseContainer();
+      return true;
+
+    case State::kDictFirst:
+    case State::kDictNext: {
+      if (token == T_OBJECT_END) {
+        if (state_ == State::kDictNext &&
+            !(options_ & JSON_ALLOW_TRAILING_COMMAS)) {
+          ReportError(JSONReader::JSON_TRAILING_COMMA, 1);
+          return true;
+        }
+        CloseContainer();
+        return true;
+      }
+      if (token != T_STRING) {
+        ReportError(JSONReader::JSON_UNQUOTED_DICTIONARY_KEY, 1);
+        return true;
+      }
+      size_t length;
+      if (!ScanString(&length))
+        return false;
+      if (ConsumeString(length, true))
+        state_ = State::kDictColon;
+      return true;
+    }
+
+    case State::kDictColon:
+      if (token != T_OBJECT_PAIR_SEPARATOR) {
+        ReportError(JSONReader::JSON_SYNTAX_ERROR, 1);
+        return true;
+      }
+      Advance(1);
+      token_ready_ = false;
+      if (HandlerResult(handler_->OnKey(key_)))
+        state_ = State::kValue;
+      return true;
+
+    case State::kAfterValue: {
+      bool in_dict = containers_.back();
+      if (token == T_LIST_SEPARATOR) {
+        Advance(1);
+        token_ready_ = false;
+        state_ = in_dict ? State::kDictNext : State::kListNext;
+      } else if (token == (in_dict ? T_OBJECT_END : T_ARRAY_END)) {
+        CloseContainer();
+      } else {
+        // Matches JSONParser::ConsumeElementSeparator().
+        ReportError(JSONReader::JSON_SYNTAX_ERROR, in_dict ? 0 : 1);
+      }
+      return true;
+    }
+
+    case State::kNumberEnd:
+      switch (token) {
+        case T_OBJECT_END:
+        case T_ARRAY_END:
+        case T_LIST_SEPARATOR:
+        case T_END_OF_INPUT:
+          break;
+        default:
+          ReportError(JSONReader::JSON_SYNTAX_ERROR, 1);
+          return true;
+      }
+      line_number_ += number_trailing_lines_;
+      if (!number_is_valid_) {
+        Stop(false);
+        return true;
+      }
+      if (HandlerResult(number_is_int_ ? handler_->OnInt(number_int_)
+                                       : handler_->OnDouble(number_double_))) {
+        // The token is handled again in the new state.
+        ValueDone();
+      }
+      return true;
+
+    case State::kAfterRoot:
+      if (token == T_END_OF_INPUT)
+        Stop(true);
+      else
+        ReportError(JSONReader::JSON_UNEXPECTED_DATA_AFTER_ROOT, 1);
+      return true;
+
+    case State::kDone:
+      break;
+  }
+
+  WINBASE_NOTREACHED();
+  return true;
+}
+
+bool JSONIncrementalReader::HandleValue() {
+  Token token =
+      pos_ < input_.size() ? TokenForChar(input_[pos_]) : T_END_OF_INPUT;
+
+  switch (token) {
+    case T_OBJECT_BEGIN:
+    case T_ARRAY_BEGIN: {
+      bool is_dict = token == T_OBJECT_BEGIN;
+      Advance(1);
+      token_ready_ = false;
+      if (static_cast<int>(containers_.size()) + 1 >= max_depth_) {
+        ReportError(JSONReader::JSON_TOO_MUCH_NESTING, 0);
+        return true;
+      }
+      if (!HandlerResult(is_dict ? handler_->OnStartDict()
+                                 : handler_->OnStartList())) {
+        return true;
+      }
+      containers_.push_back(is_dict);
+      state_ = is_dict ? State::kDictFirst : State::kListFirst;
+      return true;
+    }
+
+    case T_STRING: {
+      size_t length;
+      if (!ScanString(&length))
+        return false;
+      if (ConsumeString(length, false))
+        ValueDone();
+      return true;
+    }
+
+    case T_NUMBER: {
+      size_t length;
+      if (!ScanNumber(&length))
+        return false;
+      if (ConsumeNumber(length))
+        state_ = State::kNumberEnd;
+      return true;
+    }
+
+    case T_BOOL_TRUE:
+    case T_BOOL_FALSE:
+    case T_NULL: {
+      StringPiece literal = token == T_BOOL_TRUE
+                                ? "true"
+                                : token == T_BOOL_FALSE ? "false" : "null";
+      size_t available = input_.size() - pos_;
+      if (available < literal.size() && !at_end_)
+        return false;
+      if (StringPiece(input_.data() + pos_,
+                      std::min(available, literal.size())) != literal) {
+        ReportError(JSONReader::JSON_SYNTAX_ERROR, 1);
+        return true;
+      }
+      Advance(literal.size());
+      token_ready_ = false;
+      bool keep_going = token == T_NULL
+                            ? handler_->OnNull()
+                            : handler_->OnBool(token == T_BOOL_TRUE);
+      if (HandlerResult(keep_going))
+        ValueDone();
+      return true;
+    }
+
+    default:
+      ReportError(JSONReader::JSON_UNEXPECTED_TOKEN, 1);
+      return true;
+  }
+}
+
+void JSONIncrementalReader::CloseContainer() {
+  Advance(1);
+  token_ready_ = false;
+  bool is_dict = containers_.back();
+  containers_.pop_back();
+  if (HandlerResult(is_dict ? handler_->OnEndDict() : handler_->OnEndList()))
+    ValueDone();
+}
+
+void JSONIncrementalReader::ValueDone() {
+  state_ = containers_.empty() ? State::kAfterRoot : State::kAfterValue;
+}
+
+bool JSONIncrementalReader::ScanString(size_t* length) {
+  const char* token = input_.data() + pos_;
+  size_t available = input_.size() - pos_;
+
+  // Skip the opening quote, or resume where the last call stopped. Only
+  // quotes and escape sequences matter here; everything else, including
+  // invalid UTF-8, is left for JSONParser to deal with.
+  size_t offset = std::max<size_t>(scan_offset_, 1);
+  while (offset < available) {
+    char c = token[offset];
+    if (c == '"') {
+      scan_offset_ = 0;
+      *length = offset + 1;
+      return true;
+    }
+    if (c != '\\') {
+      ++offset;
+      continue;
+    }
+    size_t escape_length;
+    if (!GetEscapeSequenceLength(token + offset, available - offset,
+                                 &escape_length)) {
+      break;
+    }
+    offset += escape_length;
+  }
+
+  if (!at_end_) {
+    scan_offset_ = offset;
+    return false;
+  }
+
+  // Let JSONParser report the unterminated string.
+  scan_offset_ = 0;
+  *length = available;
+  return true;
+}
+
+bool JSONIncrementalReader::ScanNumber(size_t* length) {
+  const char* token = input_.data() + pos_;
+  size_t available = input_.size() - pos_;
+
+  // Follows the steps of JSONParser::ConsumeNumber() up to the point where it
+  // stops consuming, either at the end of the number or at an error.
+  size_t offset = scan_offset_;
+  bool done = false;
+  while (!done) {
+    if (offset == available) {
+      if (!at_end_) {
+        scan_offset_ = offset;
+        return false;
+      }
+      break;
+    }
+
+    char c = token[offset];
+    switch (number_state_) {
+      case NumberState::kSign:
+        if (c == '-')
+          ++offset;
+        number_state_ = NumberState::kIntDigits;
+        number_digits_ = 0;
+        break;
+      case NumberState::kExponentSign:
+        if (c == '-' || c == '+')
+          ++offset;
+        number_state_ = NumberState::kExponentDigits;
+        number_digits_ = 0;
+        break;
+      case NumberState::kIntDigits:
+      case NumberState::kFractionDigits:
+      case NumberState::kExponentDigits:
+        if (IsAsciiDigit(c)) {
+          ++offset;
+          ++number_digits_;
+        } else if (number_digits_ == 0 ||
+                   number_state_ == NumberState::kExponentDigits) {
+          done = true;
+        } else if (c == '.' && number_state_ == NumberState::kIntDigits) {
+          ++offset;
+          number_state_ = NumberState::kFractionDigits;
+          number_digits_ = 0;
+        } else if (c == 'e' || c == 'E') {
+          ++offset;
+          number_state_ = NumberState::kExponentSign;
+        } else {
+          done = true;
+        }
+        break;
+    }
+  }
+
+  scan_offset_ = 0;
+  number_state_ = NumberState::kSign;
+  *length = offset;
+  return true;
+}
+
+bool JSONIncrementalReader::ConsumeString(size_t length, bool is_key) {
+  // Decoding and validation are left to JSONParser, run over just the token.
+  internal::JSONParser parser(options_);
+  StringTokenHandler string_handler(handler_, is_key ? &key_ : nullptr);
+  if (!parser.ParseStreaming(StringPiece(input_.data() + pos_, length),
+                             &string_handler)) {
+    if (parser.error_code() == JSONReader::JSON_NO_ERROR)
+      Stop(false);
+    else
+      ReportTokenError(parser.error_code(), parser.error_column());
+    return false;
+  }
+
+  Advance(length);
+  token_ready_ = false;
+  return true;
+}
+
+bool JSONIncrementalReader::ConsumeNumber(size_t length) {
+  internal::JSONParser parser(options_);
+  NumberTokenHandler number_handler;
+  number_is_valid_ = parser.ParseStreaming(
+      StringPiece(input_.data() + pos_, length), &number_handler);
+  // A number that does not fit into a double fails without an error code,
+  // but only once JSONParser has checked the token after it.
+  if (!number_is_valid_ && parser.error_code() != JSONReader::JSON_NO_ERROR) {
+    ReportTokenError(parser.error_code(), parser.error_column());
+    return false;
+  }
+  number_is_int_ = number_handler.is_int();
+  number_int_ = number_handler.int_value();
+  number_double_ = number_handler.double_value();
+  number_trailing_lines_ = 0;
+
+  Advance(length);
+  token_ready_ = false;
+  return true;
+}
+
+int JSONIncrementalReader::index() const {
+  return input_index_ + static_cast<int>(pos_);
+}
+
+void JSONIncrementalReader::Advance(size_t count) {
+  WINBASE_DCHECK_LE(pos_ + count, input_.size());
+  pos_ += count;
+  previous_char_ = input_[pos_ - 1];
+}
+
+void JSONIncrementalReader::Stop(bool success) {
+  state_ = State::kDone;
+  is_success_ = success;
+}
+
+void JSONIncrementalReader::ReportError(JSONReader::JsonParseError code,
+                                        int column_adjust) {
+  error_code_ = code;
+  error_line_ = line_number_;
+  error_column_ = index() - index_last_line_ + column_adjust;
+  Stop(false);
+}
+
+void JSONIncrementalReader::ReportTokenError(JSONReader::JsonParseError code,
+                                             int column) {
+  error_code_ = code;
+  error_line_ = line_number_;
+  error_column_ = index() - index_last_line_ + column;
+  Stop(false);
+}
+
+bool JSONIncrementalReader::HandlerResult(bool keep_going) {
+  if (!keep_going)
+    Stop(false);
+  return keep_going;
+}
+
+}  // namespace winbase
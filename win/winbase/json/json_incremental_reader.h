@@ -0,0 +1,248 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef WINLIB_WINBASE_JSON_JSON_INCREMENTAL_READER_H_
+#define WINLIB_WINBASE_JSON_JSON_INCREMENTAL_READER_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "winbase\base_export.h"
+#include "winbase\json\json_reader.h"
+#include "winbase\strings\string_piece.h"
+
+namespace winbase {
+
+class JSONHandler;
+class Value;
+
+// Parses a JSON document that arrives in pieces, e.g. read from a pipe,
+// without first concatenating the pieces into one string. Call Feed() for
+// every piece in order, then Finish():
+//
+//   JSONIncrementalReader reader(JSON_PARSE_RFC);
+//   while (ReadChunk(&chunk)) {
+//     if (!reader.Feed(chunk))
+//       break;
+//   }
+//   if (reader.Finish())
+//     std::unique_ptr<Value> value = reader.TakeValue();
+//
+// A piece may end anywhere, including inside a string, a number, an escape
+// sequence or a comment. The reader accepts exactly the documents that
+// JSONReader::Read() accepts and reports the same error codes, lines and
+// columns.
+//
+// Only the part of the input that forms an incomplete token is kept between
+// calls to Feed(). When the document is reported to a JSONHandler, the memory
+// used is thus bounded by the size of the largest single string or number in
+// the document rather than by the size of the document.
+class WINBASE_EXPORT JSONIncrementalReader {
+ public:
+  // Builds a Value from the document, to be retrieved with TakeValue().
+  explicit JSONIncrementalReader(
+      int options = JSON_PARSE_RFC,
+      int max_depth = JSONReader::kStackMaxDepth);
+
+  // Reports the document to |handler| as it is parsed (see json_handler.h).
+  // |handler| must outlive the reader.
+  JSONIncrementalReader(JSONHandler* handler,
+                        int options = JSON_PARSE_RFC,
+                        int max_depth = JSONReader::kStackMaxDepth);
+
+  JSONIncrementalReader(const JSONIncrementalReader&) = delete;
+  JSONIncrementalReader& operator=(const JSONIncrementalReader&) = delete;
+
+  ~JSONIncrementalReader();
+
+  // Parses |chunk|, the next piece of the document. Returns false once the
+  // input is known not to be valid JSON or the handler stopped parsing; all
+  // further calls then return false as well.
+  bool Feed(StringPiece chunk);
+
+  // Signals the end of the document. Returns true if the input fed so far is
+  // a complete, valid JSON document.
+  bool Finish();
+
+  // Returns the Value built by a reader constructed without a handler, once
+  // Finish() has returned true. Returns nullptr otherwise.
+  std::unique_ptr<Value> TakeValue();
+
+  // Error information, as in JSONReader. If parsing failed with an error code
+  // of JSON_NO_ERROR, the handler stopped parsing or a number was out of
+  // range.
+  JSONReader::JsonParseError error_code() const { return error_code_; }
+  std::string GetErrorMessage() const;
+  int error_line() const { return error_line_; }
+  int error_column() const { return error_column_; }
+
+ private:
+  class ValueBuilder;
+
+  // What the parser expects next, given the containers it is in.
+  enum class State {
+    kRootValue,     // The root value.
+    kValue,         // A dictionary value, after the ':'.
+    kListFirst,     // A list element or ']', after the '['.
+    kListNext,      // A list element, after a ','.
+    kDictFirst,     // A key or '}', after the '{'.
+    kDictNext,      // A key, after a ','.
+    kDictColon,     // The ':' after a key.
+    kAfterValue,    // A ',' or the end of the enclosing container.
+    kNumberEnd,     // The token that has to follow a number.
+    kAfterRoot,     // The end of the input.
+    kDone,          // Nothing; parsing finished, failed or was stopped.
+  };
+
+  // Progress of the whitespace and comment skipper between tokens.
+  enum class CommentState {
+    kNone,
+    kLineComment,
+    kBlockComment,
+  };
+
+  // Progress of the scanner that finds the end of a number token.
+  enum class NumberState {
+    kSign,
+    kIntDigits,
+    kFractionDigits,
+    kExponentSign,
+    kExponentDigits,
+  };
+
+  enum class Result {
+    kNeedMoreInput,
+    kDone,
+  };
+
+  // Runs the parser over |input_| from |pos_| as far as the available input
+  // allows.
+  Result Process();
+
+  // Skips whitespace and comments. Returns false if more input is needed to
+  // know where the next token starts.
+  bool EatWhitespaceAndComments();
+
+  // Handles the token at |pos_| in the current state. Returns false if the
+  // whole token is not available yet.
+  bool HandleToken();
+
+  // Starts parsing a value whose first character is at |pos_|.
+  bool HandleValue();
+
+  // Consumes the character that closes the innermost container.
+  void CloseContainer();
+
+  // Sets the state for what has to follow a complete value.
+  void ValueDone();
+
+  // Finds the end of the string token starting at |pos_|. Returns false if
+  // more input is needed, otherwise sets |length| to the length of the token,
+  // including the quotes if present.
+  bool ScanString(size_t* length);
+
+  // Same as ScanString() for the number token starting at |pos_|.
+  bool ScanNumber(size_t* length);
+
+  // Decodes the complete string token of |length| bytes at |pos_| and reports
+  // it as a key or a value. Returns false on error.
+  bool ConsumeString(size_t length, bool is_key);
+
+  // Converts the complete number token of |length| bytes at |pos_|, leaving
+  // the result in |number_| for when the token after it has been validated.
+  // Returns false on error.
+  bool ConsumeNumber(size_t length);
+
+  // Returns the current position as an index into the whole document.
+  int index() const;
+
+  // Advances the parser by |count| bytes.
+  void Advance(size_t count);
+
+  // Stops parsing; |success| is the result of Finish().
+  void Stop(bool success);
+
+  // Records an error at the current position, exactly like
+  // JSONParser::ReportError().
+  void ReportError(JSONReader::JsonParseError code, int column_adjust);
+
+  // Records an error that a JSONParser run over just the token at |pos_| has
+  // reported at |column| of its first line.
+  void ReportTokenError(JSONReader::JsonParseError code, int column);
+
+  // Records that the handler asked to stop parsing.
+  bool HandlerResult(bool keep_going);
+
+  std::unique_ptr<ValueBuilder> value_builder_;
+  JSONHandler* const handler_;
+  const int options_;
+  const int max_depth_;
+
+  // The unconsumed input: the start of an incomplete token or comment marker
+  // kept from previous chunks.
+  std::string pending_;
+
+  // The input being parsed by Process(), the position in it, and whether more
+  // input may follow.
+  StringPiece input_;
+  size_t pos_;
+  bool at_end_;
+
+  // The index into the whole document of the first byte of |input_|.
+  int input_index_;
+
+  // Total number of bytes fed so far.
+  size_t total_size_;
+
+  // The byte that precedes the current position, needed to count "\r\n" as
+  // a single line break.
+  char previous_char_;
+
+  State state_;
+  bool is_success_;
+  bool checked_bom_;
+
+  // True if the whitespace before the token at |pos_| has been skipped.
+  bool token_ready_;
+
+  // Whether each enclosing container is a dictionary (true) or a list.
+  std::vector<bool> containers_;
+
+  CommentState comment_state_;
+  char block_comment_previous_char_;
+
+  // Resumption points of the token scanners, relative to the token start.
+  size_t scan_offset_;
+  NumberState number_state_;
+  size_t number_digits_;
+
+  // A decoded key waiting for its ':'.
+  std::string key_;
+
+  // A converted number waiting for the token after it. |number_is_valid_| is
+  // false if it was out of range.
+  bool number_is_valid_;
+  bool number_is_int_;
+  int number_int_;
+  double number_double_;
+
+  // The line breaks seen while checking the token after a number. JSONParser
+  // rewinds over them and counts them again, so the reader does too.
+  int number_trailing_lines_;
+
+  // Line and column bookkeeping, as in JSONParser.
+  int line_number_;
+  int index_last_line_;
+
+  JSONReader::JsonParseError error_code_;
+  int error_line_;
+  int error_column_;
+};
+
+}  // namespace winbase
+
+#endif  // WINLIB_WINBASE_JSON_JSON_INCREMENTAL_READER_H_
@@ -8,6 +8,9 @@
 #include <utility>
 #include <vector>
 
+#include "winbase\bits.h"
+#include "winbase\cpu.h"
+#include "winbase\json\json_handler.h"
 #include "winbase\logging.h"
 #include "winbase\macros.h"
 #include "winbase\numerics\safe_conversions.h"
@@ -19,6 +22,11 @@
 #include "winbase\strings\utf_string_conversions.h"
 #include "winbase\third_party\icu\icu_utf.h"
 #include "winbase\values.h"
+#include "winlib\build_config.h"
+
+#if defined(ARCH_CPU_X86_FAMILY)
+#include <immintrin.h>
+#endif
 
 namespace winbase {
 namespace internal {
@@ -50,14 +58,142 @@ class StackMarker {
 
 constexpr uint32_t kUnicodeReplacementPoint = 0xFFFD;
 
+// Structural scanners. Each returns the length of the longest prefix of
+// [begin, end) made up only of bytes of a given class, so that the parser can
+// advance over the whole run at once instead of byte by byte. The SIMD
+// variants look at 16 or 32 bytes per step and finish the tail with the scalar
+// variant, so all of them return exactly the same result.
+using ScanFunction = size_t (*)(const char* begin, const char* end);
+
+// Blanks are ' ' and '\t'. Line breaks are left to the caller, which needs to
+// see each of them to keep the line bookkeeping used in error reports.
+inline bool IsBlank(char c) {
+  return c == ' ' || c == '\t';
+}
+
+// Bytes that can be appended to a string verbatim: any ASCII byte except the
+// closing quote and the escape character. Non-ASCII bytes have to go through
+// ReadUnicodeCharacter() to be validated.
+inline bool IsPlainStringChar(char c) {
+  return static_cast<unsigned char>(c) < kExtendedASCIIStart && c != '"' &&
+         c != '\\';
+}
+
+size_t ScanBlanksScalar(const char* begin, const char* end) {
+  const char* p = begin;
+  while (p != end && IsBlank(*p))
+    ++p;
+  return p - begin;
+}
+
+size_t ScanPlainStringCharsScalar(const char* begin, const char* end) {
+  const char* p = begin;
+  while (p != end && IsPlainStringChar(*p))
+    ++p;
+  return p - begin;
+}
+
+#if defined(ARCH_CPU_X86_FAMILY)
+
+size_t ScanBlanksSSE2(const char* begin, const char* end) {
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const char* p = begin;
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+                                 _mm_cmpeq_epi8(chunk, tab));
+    uint32_t stop = ~static_cast<uint32_t>(_mm_movemask_epi8(blank)) & 0xFFFF;
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop);
+  }
+  return (p - begin) + ScanBlanksScalar(p, end);
+}
+
+size_t ScanPlainStringCharsSSE2(const char* begin, const char* end) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const char* p = begin;
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                   _mm_cmpeq_epi8(chunk, backslash));
+    // The sign bit of every byte is set for non-ASCII input.
+    uint32_t stop = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_or_si128(special, chunk)));
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop);
+  }
+  return (p - begin) + ScanPlainStringCharsScalar(p, end);
+}
+
+size_t ScanBlanksAVX2(const char* begin, const char* end) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const char* p = begin;
+  for (; end - p >= 32; p += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space),
+                                    _mm256_cmpeq_epi8(chunk, tab));
+    uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(blank));
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop);
+  }
+  return (p - begin) + ScanBlanksSSE2(p, end);
+}
+
+size_t ScanPlainStringCharsAVX2(const char* begin, const char* end) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const char* p = begin;
+  for (; end - p >= 32; p += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                                      _mm256_cmpeq_epi8(chunk, backslash));
+    uint32_t stop = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_or_si256(special, chunk)));
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop);
+  }
+  return (p - begin) + ScanPlainStringCharsSSE2(p, end);
+}
+
+#endif  // defined(ARCH_CPU_X86_FAMILY)
+
+struct StructuralScanners {
+  ScanFunction scan_blanks;
+  ScanFunction scan_plain_string_chars;
+};
+
+StructuralScanners SelectStructuralScanners() {
+#if defined(ARCH_CPU_X86_FAMILY)
+  CPU cpu;
+  if (cpu.has_avx2())
+    return {&ScanBlanksAVX2, &ScanPlainStringCharsAVX2};
+  if (cpu.has_sse2())
+    return {&ScanBlanksSSE2, &ScanPlainStringCharsSSE2};
+#endif
+  return {&ScanBlanksScalar, &ScanPlainStringCharsScalar};
+}
+
+// The CPU is only queried once; the result is shared by all parsers.
+const StructuralScanners& GetStructuralScanners() {
+  static const StructuralScanners scanners = SelectStructuralScanners();
+  return scanners;
+}
+
 }  // namespace
 
 // This is U+FFFD.
 const char kUnicodeReplacementString[] = "\xEF\xBF\xBD";
 
-JSONParser::JSONParser(int options, int max_depth)
+JSONParser::JSONParser(int options, int max_depth, ValueKeyTable* key_table)
     : options_(options),
       max_depth_(max_depth),
+      key_table_(key_table),
+      scan_blanks_(GetStructuralScanners().scan_blanks),
+      scan_plain_string_chars_(
+          GetStructuralScanners().scan_plain_string_chars),
       index_(0),
       stack_depth_(0),
       line_number_(0),
@@ -71,26 +207,8 @@ JSONParser::JSONParser(int options, int max_depth)
 JSONParser::~JSONParser() = default;
 
 Optional<Value> JSONParser::Parse(StringPiece input) {
-  input_ = input;
-  index_ = 0;
-  line_number_ = 1;
-  index_last_line_ = 0;
-
-  error_code_ = JSONReader::JSON_NO_ERROR;
-  error_line_ = 0;
-  error_column_ = 0;
-
-  // ICU and ReadUnicodeCharacter() use int32_t for lengths, so ensure
-  // that the index_ will not overflow when parsing.
-  if (!winbase::IsValueInRangeForNumericType<int32_t>(input.length())) {
-    ReportError(JSONReader::JSON_TOO_LARGE, 0);
+  if (!StartInput(input))
     return nullopt;
-  }
-
-  // When the input JSON string starts with a UTF-8 Byte-Order-Mark,
-  // advance the start position to avoid the ParseNextToken function mis-
-  // treating a Unicode BOM as an invalid character and returning NULL.
-  ConsumeIfMatch("\xEF\xBB\xBF");
 
   // Parse the first and any nested tokens.
   Optional<Value> root(ParseNextToken());
@@ -106,6 +224,22 @@ Optional<Value> JSONParser::Parse(StringPiece input) {
   return root;
 }
 
+bool JSONParser::ParseStreaming(StringPiece input, JSONHandler* handler) {
+  WINBASE_DCHECK(handler);
+  if (!StartInput(input))
+    return false;
+
+  if (!EmitNextToken(handler))
+    return false;
+
+  if (GetNextToken() != T_END_OF_INPUT) {
+    ReportError(JSONReader::JSON_UNEXPECTED_DATA_AFTER_ROOT, 1);
+    return false;
+  }
+
+  return true;
+}
+
 JSONReader::JsonParseError JSONParser::error_code() const {
   return error_code_;
 }
@@ -151,6 +285,15 @@ void JSONParser::StringBuilder::Append(uint32_t point) {
   }
 }
 
+void JSONParser::StringBuilder::AppendRun(StringPiece run) {
+  if (!string_) {
+    WINBASE_DCHECK_EQ(run.data(), pos_ + length_);
+    length_ += run.length();
+  } else {
+    run.AppendToString(&*string_);
+  }
+}
+
 void JSONParser::StringBuilder::Convert() {
   if (string_)
     return;
@@ -163,8 +306,38 @@ std::string JSONParser::StringBuilder::DestructiveAsString() {
   return std::string(pos_, length_);
 }
 
+StringPiece JSONParser::StringBuilder::AsStringPiece() const {
+  if (string_)
+    return *string_;
+  return StringPiece(pos_, length_);
+}
+
 // JSONParser private //////////////////////////////////////////////////////////
 
+bool JSONParser::StartInput(StringPiece input) {
+  input_ = input;
+  index_ = 0;
+  line_number_ = 1;
+  index_last_line_ = 0;
+
+  error_code_ = JSONReader::JSON_NO_ERROR;
+  error_line_ = 0;
+  error_column_ = 0;
+
+  // ICU and ReadUnicodeCharacter() use int32_t for lengths, so ensure
+  // that the index_ will not overflow when parsing.
+  if (!winbase::IsValueInRangeForNumericType<int32_t>(input.length())) {
+    ReportError(JSONReader::JSON_TOO_LARGE, 0);
+    return false;
+  }
+
+  // When the input JSON string starts with a UTF-8 Byte-Order-Mark,
+  // advance the start position to avoid the ParseNextToken function mis-
+  // treating a Unicode BOM as an invalid character and returning NULL.
+  ConsumeIfMatch("\xEF\xBB\xBF");
+  return true;
+}
+
 Optional<StringPiece> JSONParser::PeekChars(int count) {
   if (static_cast<size_t>(index_) + count > input_.length())
     return nullopt;
@@ -199,6 +372,10 @@ const char* JSONParser::pos() {
   return input_.data() + index_;
 }
 
+const char* JSONParser::end() const {
+  return input_.data() + input_.length();
+}
+
 JSONParser::Token JSONParser::GetNextToken() {
   EatWhitespaceAndComments();
 
@@ -254,10 +431,12 @@ void JSONParser::EatWhitespaceAndComments() {
         if (!(c == '\n' && index_ > 0 && input_[index_ - 1] == '\r')) {
           ++line_number_;
         }
-        FALLTHROUGH;
+        ConsumeChar();
+        break;
       case ' ':
       case '\t':
-        ConsumeChar();
+        // Indentation typically comes in long runs; skip all of it at once.
+        index_ += static_cast<int>(scan_blanks_(pos(), end()));
         break;
       case '/':
         if (!EatComment())
@@ -367,21 +546,13 @@ Optional<Value> JSONParser::ConsumeDictionary() {
       return nullopt;
     }
 
-    dict_storage.emplace_back(key.DestructiveAsString(),
-                              std::make_unique<Value>(std::move(*value)));
+    dict_storage.emplace_back(key_table_
+                                  ? key_table_->Intern(key.AsStringPiece())
+                                  : ValueKey(key.DestructiveAsString()),
+                              std::move(*value));
 
-    token = GetNextToken();
-    if (token == T_LIST_SEPARATOR) {
-      ConsumeChar();
-      token = GetNextToken();
-      if (token == T_OBJECT_END && !(options_ & JSON_ALLOW_TRAILING_COMMAS)) {
-        ReportError(JSONReader::JSON_TRAILING_COMMA, 1);
-        return nullopt;
-      }
-    } else if (token != T_OBJECT_END) {
-      ReportError(JSONReader::JSON_SYNTAX_ERROR, 0);
+    if (!ConsumeElementSeparator(T_OBJECT_END, &token))
       return nullopt;
-    }
   }
 
   ConsumeChar();  // Closing '}'.
@@ -413,18 +584,8 @@ Optional<Value> JSONParser::ConsumeList() {
 
     list_storage.push_back(std::move(*item));
 
-    token = GetNextToken();
-    if (token == T_LIST_SEPARATOR) {
-      ConsumeChar();
-      token = GetNextToken();
-      if (token == T_ARRAY_END && !(options_ & JSON_ALLOW_TRAILING_COMMAS)) {
-        ReportError(JSONReader::JSON_TRAILING_COMMA, 1);
-        return nullopt;
-      }
-    } else if (token != T_ARRAY_END) {
-      ReportError(JSONReader::JSON_SYNTAX_ERROR, 1);
+    if (!ConsumeElementSeparator(T_ARRAY_END, &token))
       return nullopt;
-    }
   }
 
   ConsumeChar();  // Closing ']'.
@@ -432,6 +593,25 @@ Optional<Value> JSONParser::ConsumeList() {
   return Value(std::move(list_storage));
 }
 
+bool JSONParser::ConsumeElementSeparator(Token close_token, Token* token) {
+  *token = GetNextToken();
+  if (*token == T_LIST_SEPARATOR) {
+    ConsumeChar();
+    *token = GetNextToken();
+    if (*token == close_token && !(options_ & JSON_ALLOW_TRAILING_COMMAS)) {
+      ReportError(JSONReader::JSON_TRAILING_COMMA, 1);
+      return false;
+    }
+  } else if (*token != close_token) {
+    // Dictionaries have always reported this error one column further left
+    // than lists; keep the positions stable for existing callers.
+    ReportError(JSONReader::JSON_SYNTAX_ERROR,
+                close_token == T_OBJECT_END ? 0 : 1);
+    return false;
+  }
+  return true;
+}
+
 Optional<Value> JSONParser::ConsumeString() {
   StringBuilder string;
   if (!ConsumeStringRaw(&string))
@@ -452,6 +632,15 @@ bool JSONParser::ConsumeStringRaw(StringBuilder* out) {
   StringBuilder string(pos());
 
   while (PeekChar()) {
+    // Take the run of bytes that need neither decoding nor validation in one
+    // step. The loop below then only sees quotes, escapes and non-ASCII input.
+    size_t run_length = scan_plain_string_chars_(pos(), end());
+    if (run_length) {
+      string.AppendRun(StringPiece(pos(), run_length));
+      index_ += static_cast<int>(run_length);
+      continue;
+    }
+
     uint32_t next_char = 0;
     if (!ReadUnicodeCharacter(input_.data(),
                               static_cast<int32_t>(input_.length()),
@@ -726,6 +915,125 @@ Optional<Value> JSONParser::ConsumeLiteral() {
   }
 }
 
+bool JSONParser::EmitNextToken(JSONHandler* handler) {
+  return EmitToken(GetNextToken(), handler);
+}
+
+bool JSONParser::EmitToken(Token token, JSONHandler* handler) {
+  switch (token) {
+    case T_OBJECT_BEGIN:
+      return EmitDictionary(handler);
+    case T_ARRAY_BEGIN:
+      return EmitList(handler);
+    case T_STRING: {
+      StringBuilder string;
+      if (!ConsumeStringRaw(&string))
+        return false;
+      return handler->OnString(string.AsStringPiece());
+    }
+    case T_NUMBER: {
+      // Scalars are cheap to hold in a Value, so share the conversion rules
+      // with the Value-producing path.
+      Optional<Value> number = ConsumeNumber();
+      if (!number)
+        return false;
+      if (number->is_int())
+        return handler->OnInt(number->GetInt());
+      return handler->OnDouble(number->GetDouble());
+    }
+    case T_BOOL_TRUE:
+    case T_BOOL_FALSE:
+    case T_NULL: {
+      Optional<Value> literal = ConsumeLiteral();
+      if (!literal)
+        return false;
+      if (literal->is_bool())
+        return handler->OnBool(literal->GetBool());
+      return handler->OnNull();
+    }
+    default:
+      ReportError(JSONReader::JSON_UNEXPECTED_TOKEN, 1);
+      return false;
+  }
+}
+
+bool JSONParser::EmitDictionary(JSONHandler* handler) {
+  if (ConsumeChar() != '{') {
+    ReportError(JSONReader::JSON_UNEXPECTED_TOKEN, 1);
+    return false;
+  }
+
+  StackMarker depth_check(max_depth_, &stack_depth_);
+  if (depth_check.IsTooDeep()) {
+    ReportError(JSONReader::JSON_TOO_MUCH_NESTING, 0);
+    return false;
+  }
+
+  if (!handler->OnStartDict())
+    return false;
+
+  Token token = GetNextToken();
+  while (token != T_OBJECT_END) {
+    if (token != T_STRING) {
+      ReportError(JSONReader::JSON_UNQUOTED_DICTIONARY_KEY, 1);
+      return false;
+    }
+
+    StringBuilder key;
+    if (!ConsumeStringRaw(&key))
+      return false;
+
+    token = GetNextToken();
+    if (token != T_OBJECT_PAIR_SEPARATOR) {
+      ReportError(JSONReader::JSON_SYNTAX_ERROR, 1);
+      return false;
+    }
+
+    if (!handler->OnKey(key.AsStringPiece()))
+      return false;
+
+    ConsumeChar();
+    if (!EmitNextToken(handler))
+      return false;
+
+    if (!ConsumeElementSeparator(T_OBJECT_END, &token))
+      return false;
+  }
+
+  ConsumeChar();  // Closing '}'.
+
+  return handler->OnEndDict();
+}
+
+bool JSONParser::EmitList(JSONHandler* handler) {
+  if (ConsumeChar() != '[') {
+    ReportError(JSONReader::JSON_UNEXPECTED_TOKEN, 1);
+    return false;
+  }
+
+  StackMarker depth_check(max_depth_, &stack_depth_);
+  if (depth_check.IsTooDeep()) {
+    ReportError(JSONReader::JSON_TOO_MUCH_NESTING, 0);
+    return false;
+  }
+
+  if (!handler->OnStartList())
+    return false;
+
+  Token token = GetNextToken();
+  while (token != T_ARRAY_END) {
+    if (!EmitToken(token, handler))
+      return false;
+
+    if (!ConsumeElementSeparator(T_ARRAY_END, &token))
+      return false;
+  }
+
+  ConsumeChar();  // Closing ']'.
+
+  return handler->OnEndList();
+}
+
 bool JSONParser::ConsumeIfMatch(StringPiece match) {
   if (match == PeekChars(static_cast<int>(match.size()))) {
     ConsumeChars(static_cast<int>(match.size()));
@@ -17,9 +17,11 @@
 #include "winbase\macros.h"
 #include "winbase\optional.h"
 #include "winbase\strings\string_piece.h"
+#include "winbase\value_key.h"
 
 namespace winbase {
 
+class JSONHandler;
 class Value;
 
 namespace internal {
@@ -30,7 +32,9 @@ class JSONParserTest;
 // to be used directly; it encapsulates logic that need not be exposed publicly.
 //
 // This parser guarantees O(n) time through the input string. Iteration happens
-// on the byte level, with the functions ConsumeChars() and ConsumeChar(). The
+// on the byte level, with the functions ConsumeChars() and ConsumeChar(). Runs
+// of blanks and of plain string characters are skipped in bulk by scanners
+// that use SSE2 or AVX2 when the CPU supports them (see |scan_blanks_|). The
 // conversion from byte to JSON token happens without advancing the parser in
 // GetNextToken/ParseToken, that is tokenization operates on the current parser
 // position without advancing.
@@ -42,7 +46,11 @@ class JSONParserTest;
 // of the next token.
 class WINBASE_EXPORT JSONParser {
  public:
-  JSONParser(int options, int max_depth = JSONReader::kStackMaxDepth);
+  // Dictionary keys are interned in |key_table| if it is not null, so that
+  // equal keys share their storage.
+  JSONParser(int options,
+             int max_depth = JSONReader::kStackMaxDepth,
+             ValueKeyTable* key_table = nullptr);
   JSONParser(const JSONParser&) = delete;
   JSONParser& operator=(const JSONParser&) = delete;
   ~JSONParser();
@@ -53,6 +61,14 @@ class WINBASE_EXPORT JSONParser {
   // and convert to a FooValue at the same time.
   Optional<Value> Parse(StringPiece input);
 
+  // Parses the input like Parse(), but reports its contents to |handler| as
+  // they are encountered instead of building a Value. Returns true if the
+  // whole input was parsed. Returns false on a parse error, with the error
+  // information set, or as soon as a |handler| callback returns false, in
+  // which case error_code() is JSON_NO_ERROR. Events already delivered for a
+  // document that later turns out to be invalid are not retracted.
+  bool ParseStreaming(StringPiece input, JSONHandler* handler);
+
   // Returns the error code.
   JSONReader::JsonParseError error_code() const;
 
@@ -67,6 +83,11 @@ class WINBASE_EXPORT JSONParser {
   // returns 0.
   int error_column() const;
 
+  // Given the line and column number of an error, formats one of the error
+  // message contants from json_reader.h for human display.
+  static std::string FormatErrorMessage(int line, int column,
+                                        const std::string& description);
+
  private:
   enum Token {
     T_OBJECT_BEGIN,           // {
@@ -106,6 +127,11 @@ class WINBASE_EXPORT JSONParser {
     // converted, or by appending the UTF8 bytes for the code point.
     void Append(uint32_t point);
 
+    // Appends |run|, a sequence of ASCII bytes that need no decoding. Until
+    // the builder is converted, |run| must directly follow the characters
+    // appended so far in the input.
+    void AppendRun(StringPiece run);
+
     // Converts the builder from its default StringPiece to a full std::string,
     // performing a copy. Once a builder is converted, it cannot be made a
     // StringPiece again.
@@ -116,6 +142,10 @@ class WINBASE_EXPORT JSONParser {
     // in cases where the builder will not be needed any more.
     std::string DestructiveAsString();
 
+    // Returns a view of the string built so far. It is only valid until the
+    // builder is modified or destroyed, and until the input is released.
+    StringPiece AsStringPiece() const;
+
    private:
     // The beginning of the input string.
     const char* pos_;
@@ -145,6 +175,14 @@ class WINBASE_EXPORT JSONParser {
   // Returns a pointer to the current character position.
   const char* pos();
 
+  // Returns a pointer one past the last character of the input.
+  const char* end() const;
+
+  // Resets the parser state to the beginning of |input|, skipping a leading
+  // byte-order mark. Returns false with error information set if |input| is
+  // too large to be parsed.
+  bool StartInput(StringPiece input);
+
   // Skips over whitespace and comments to find the next token in the stream.
   // This does not advance the parser for non-whitespace or comment chars.
   Token GetNextToken();
@@ -171,6 +209,13 @@ class WINBASE_EXPORT JSONParser {
   // Value.
   Optional<Value> ConsumeList();
 
+  // Called after an element of a container that ends with |close_token|.
+  // Consumes a following ',' and sets |token| to the token after it, which
+  // may only be |close_token| if trailing commas are allowed. Otherwise sets
+  // |token| to |close_token|. Returns false with error information set if the
+  // element is followed by anything else.
+  bool ConsumeElementSeparator(Token close_token, Token* token);
+
   // Calls through ConsumeStringRaw and wraps it in a value.
   Optional<Value> ConsumeString();
 
@@ -196,6 +241,15 @@ class WINBASE_EXPORT JSONParser {
   // parser is wound to the first character of any of those.
   Optional<Value> ConsumeLiteral();
 
+  // Counterparts of ParseNextToken() and the Consume functions above for
+  // ParseStreaming(). Rather than returning a Value, they report it to
+  // |handler|. They return false on error, with error information set, and
+  // when |handler| asks to stop.
+  bool EmitNextToken(JSONHandler* handler);
+  bool EmitToken(Token token, JSONHandler* handler);
+  bool EmitDictionary(JSONHandler* handler);
+  bool EmitList(JSONHandler* handler);
+
   // Helper function that returns true if the byte squence |match| can be
   // consumed at the current parser position. Returns false if there are fewer
   // than |match|-length bytes or if the sequence does not match, and the
@@ -207,17 +261,22 @@ class WINBASE_EXPORT JSONParser {
   // adjustment by |column_adjust|.
   void ReportError(JSONReader::JsonParseError code, int column_adjust);
 
-  // Given the line and column number of an error, formats one of the error
-  // message contants from json_reader.h for human display.
-  static std::string FormatErrorMessage(int line, int column,
-                                        const std::string& description);
-
   // winbase::JSONParserOptions that control parsing.
   const int options_;
 
   // Maximum depth to parse.
   const int max_depth_;
 
+  // The table that dictionary keys are interned in, or null to give every
+  // key its own string.
+  ValueKeyTable* const key_table_;
+
+  // Return the number of leading blanks (' ' and '\t'), respectively of
+  // leading ASCII string characters other than '"' and '\\', in a byte range.
+  // Selected once for the CPU the parser runs on.
+  size_t (*const scan_blanks_)(const char* begin, const char* end);
+  size_t (*const scan_plain_string_chars_)(const char* begin, const char* end);
+
   // The input stream being parsed. Note: Not guaranteed to NUL-terminated.
   StringPiece input_;
 
@@ -4,16 +4,265 @@
 
 #include "winbase\json\json_reader.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
 #include <utility>
 #include <vector>
 
+#include "winbase\atomic\atomic_ref_count.h"
+#include "winbase\atomic\atomic_sequence_num.h"
+#include "winbase\functional\bind.h"
 #include "winbase\json\json_parser.h"
 #include "winbase\logging.h"
+#include "winbase\memory\ref_counted.h"
+#include "winbase\numerics\safe_conversions.h"
 #include "winbase\optional.h"
+#include "winbase\synchronization\waitable_event.h"
+#include "winbase\task_scheduler\post_task.h"
+#include "winbase\task_scheduler\task_scheduler.h"
 #include "winbase\values.h"
 
 namespace winbase {
 
+namespace {
+
+// ReadInParallel() hands out the elements of a list in chunks of about this
+// many bytes. Inputs smaller than two chunks are parsed sequentially.
+constexpr size_t kParallelChunkSize = 1 << 20;
+
+const char kByteOrderMark[] = "\xEF\xBB\xBF";
+
+bool IsBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// The bytes that SplitTopLevelList() acts on. Most bytes of a document are
+// not among them, so they are skipped with a table lookup each.
+class ListSplitChars {
+ public:
+  constexpr ListSplitChars() : is_split_char_() {
+    for (char c : "\"[]{},/")
+      is_split_char_[static_cast<unsigned char>(c)] = true;
+    is_split_char_[0] = false;
+  }
+
+  bool Contains(char c) const {
+    return is_split_char_[static_cast<unsigned char>(c)];
+  }
+
+ private:
+  bool is_split_char_[256];
+};
+
+constexpr ListSplitChars kListSplitChars;
+
+// Splits |json|, whose root should be a list, into the ranges of the list's
+// elements by tracking strings and brackets. The elements themselves are not
+// validated. Returns false if |json| is not a list or uses comments, which
+// are left to the sequential parser.
+bool SplitTopLevelList(StringPiece json, std::vector<StringPiece>* elements) {
+  const char* p = json.data();
+  const char* const end = p + json.size();
+  if (json.starts_with(kByteOrderMark))
+    p += strlen(kByteOrderMark);
+  while (p != end && IsBlank(*p))
+    ++p;
+  if (p == end || *p != '[')
+    return false;
+
+  const char* element = ++p;
+  int depth = 0;
+  for (; p != end; ++p) {
+    while (!kListSplitChars.Contains(*p)) {
+      if (++p == end)
+        return false;
+    }
+    switch (*p) {
+      case '"':
+        // Find the closing quote: the next one that is not escaped by an odd
+        // number of backslashes.
+        for (;;) {
+          const char* quote =
+              static_cast<const char*>(memchr(p + 1, '"', end - p - 1));
+          if (!quote)
+            return false;
+          const char* backslashes = quote;
+          while (backslashes[-1] == '\\')
+            --backslashes;
+          p = quote;
+          if ((quote - backslashes) % 2 == 0)
+            break;
+        }
+        break;
+      case '[':
+      case '{':
+        ++depth;
+        break;
+      case ']':
+      case '}':
+        if (depth == 0) {
+          if (*p != ']')
+            return false;
+          elements->push_back(StringPiece(element, p - element));
+          while (++p != end) {
+            if (!IsBlank(*p))
+              return false;
+          }
+          return true;
+        }
+        --depth;
+        break;
+      case ',':
+        if (depth == 0) {
+          elements->push_back(StringPiece(element, p - element));
+          element = p + 1;
+        }
+        break;
+      case '/':
+        return false;
+    }
+  }
+  return false;
+}
+
+// The state of a ReadInParallel() call that is shared with its tasks. The
+// elements of the list are divided into chunks of consecutive elements; the
+// calling thread and the tasks each claim the next unclaimed chunk until none
+// are left, so that the call completes even if no task gets to run.
+class ParallelListParse : public RefCountedThreadSafe<ParallelListParse> {
+ public:
+  ParallelListParse(std::vector<StringPiece> elements,
+                    int options,
+                    int max_depth)
+      : elements_(std::move(elements)),
+        options_(options),
+        max_depth_(max_depth),
+        values_(elements_.size()),
+        failed_(false) {
+    size_t chunk_size = 0;
+    for (size_t i = 0; i < elements_.size(); ++i) {
+      if (chunk_size == 0)
+        chunk_starts_.push_back(i);
+      chunk_size += elements_[i].size() + 1;
+      if (chunk_size >= kParallelChunkSize)
+        chunk_size = 0;
+    }
+    chunk_starts_.push_back(elements_.size());
+    unfinished_chunks_.Increment(num_chunks());
+  }
+
+  ParallelListParse(const ParallelListParse&) = delete;
+  ParallelListParse& operator=(const ParallelListParse&) = delete;
+
+  int num_chunks() const { return static_cast<int>(chunk_starts_.size()) - 1; }
+
+  // Parses the next unclaimed chunk. Returns false if there was none left.
+  bool ParseNextChunk() {
+    int chunk = next_chunk_.GetNext();
+    if (chunk >= num_chunks())
+      return false;
+    // Once an element has failed the result is discarded, so the remaining
+    // chunks are skipped.
+    if (!failed_.load(std::memory_order_relaxed) && !ParseChunk(chunk))
+      failed_.store(true, std::memory_order_relaxed);
+    if (!unfinished_chunks_.Decrement())
+      done_.Signal();
+    return true;
+  }
+
+  // Waits for all chunks to be parsed. Returns the list, or nullopt if an
+  // element failed to parse.
+  Optional<Value> TakeResult() {
+    done_.Wait();
+    if (failed_.load(std::memory_order_relaxed))
+      return nullopt;
+    return Value(std::move(values_));
+  }
+
+ private:
+  friend class RefCountedThreadSafe<ParallelListParse>;
+
+  ~ParallelListParse() = default;
+
+  bool ParseChunk(int chunk) {
+    // Each element is parsed as a document of its own, one level below the
+    // root list.
+    internal::JSONParser parser(options_, max_depth_ - 1);
+    for (size_t i = chunk_starts_[chunk]; i < chunk_starts_[chunk + 1]; ++i) {
+      if (failed_.load(std::memory_order_relaxed))
+        return false;
+      // The parser skips a byte-order mark at the start of its input, but it
+      // is only allowed at the start of the whole document.
+      if (elements_[i].starts_with(kByteOrderMark))
+        return false;
+      Optional<Value> value = parser.Parse(elements_[i]);
+      if (!value)
+        return false;
+      values_[i] = std::move(*value);
+    }
+    return true;
+  }
+
+  const std::vector<StringPiece> elements_;
+  const int options_;
+  const int max_depth_;
+
+  // The index in |elements_| of the first element of every chunk, followed by
+  // the number of elements.
+  std::vector<size_t> chunk_starts_;
+
+  // The parsed elements. Every chunk writes to its own range.
+  Value::ListStorage values_;
+
+  AtomicSequenceNumber next_chunk_;
+  AtomicRefCount unfinished_chunks_;
+  std::atomic_bool failed_;
+
+  // Signaled when |unfinished_chunks_| drops to zero.
+  WaitableEvent done_;
+};
+
+// Parses |json| in parallel if its root is a large list. Returns nullopt if
+// that is not the case or if any element fails to parse, leaving it to the
+// sequential parser to produce the result or the error.
+Optional<Value> ParseListInParallel(StringPiece json,
+                                    int options,
+                                    int max_depth) {
+  if (json.size() < 2 * kParallelChunkSize || max_depth <= 1 ||
+      !IsValueInRangeForNumericType<int32_t>(json.size()) ||
+      !TaskScheduler::GetInstance()) {
+    return nullopt;
+  }
+
+  std::vector<StringPiece> elements;
+  if (!SplitTopLevelList(json, &elements))
+    return nullopt;
+  // The last element is blank after a trailing comma and in an empty list.
+  StringPiece last = elements.back();
+  if (std::all_of(last.begin(), last.end(), IsBlank)) {
+    if (elements.size() == 1 || !(options & JSON_ALLOW_TRAILING_COMMAS))
+      return nullopt;
+    elements.pop_back();
+  }
+
+  scoped_refptr<ParallelListParse> parse =
+      MakeRefCounted<ParallelListParse>(std::move(elements), options,
+                                        max_depth);
+  for (int i = 1; i < parse->num_chunks(); ++i) {
+    PostTaskWithTraits(
+        WINBASE_FROM_HERE,
+        {TaskPriority::USER_BLOCKING, TaskShutdownBehavior::SKIP_ON_SHUTDOWN},
+        BindOnce(IgnoreResult(&ParallelListParse::ParseNextChunk), parse));
+  }
+  while (parse->ParseNextChunk()) {
+  }
+  return parse->TakeResult();
+}
+
+}  // namespace
+
 // Chosen to support 99.9% of documents found in the wild late 2016.
 // http://crbug.com/673263
 const int JSONReader::kStackMaxDepth = 200;
@@ -55,6 +304,15 @@ std::unique_ptr<Value> JSONReader::Read(StringPiece json,
   return root ? std::make_unique<Value>(std::move(*root)) : nullptr;
 }
 
+// static
+std::unique_ptr<Value> JSONReader::ReadWithKeyTable(StringPiece json,
+                                                    ValueKeyTable* key_table,
+                                                    int options,
+                                                    int max_depth) {
+  internal::JSONParser parser(options, max_depth, key_table);
+  Optional<Value> root = parser.Parse(json);
+  return root ? std::make_unique<Value>(std::move(*root)) : nullptr;
+}
 
 // static
 std::unique_ptr<Value> JSONReader::ReadAndReturnError(
@@ -80,6 +338,40 @@ std::unique_ptr<Value> JSONReader::ReadAndReturnError(
   return root ? std::make_unique<Value>(std::move(*root)) : nullptr;
 }
 
+// static
+std::unique_ptr<Value> JSONReader::ReadInParallel(StringPiece json,
+                                                  int options,
+                                                  int max_depth) {
+  Optional<Value> root = ParseListInParallel(json, options, max_depth);
+  if (root)
+    return std::make_unique<Value>(std::move(*root));
+  return Read(json, options, max_depth);
+}
+
+// static
+std::unique_ptr<Value> JSONReader::ReadInParallelAndReturnError(
+    StringPiece json,
+    int options,
+    int* error_code_out,
+    std::string* error_msg_out,
+    int* error_line_out,
+    int* error_column_out) {
+  Optional<Value> root = ParseListInParallel(json, options, kStackMaxDepth);
+  if (root)
+    return std::make_unique<Value>(std::move(*root));
+  return ReadAndReturnError(json, options, error_code_out, error_msg_out,
+                            error_line_out, error_column_out);
+}
+
+// static
+bool JSONReader::ReadStreaming(StringPiece json,
+                               JSONHandler* handler,
+                               int options,
+                               int max_depth) {
+  internal::JSONParser parser(options, max_depth);
+  return parser.ParseStreaming(json, handler);
+}
+
 // static
 std::string JSONReader::ErrorCodeToString(JsonParseError error_code) {
   switch (error_code) {
@@ -115,6 +407,10 @@ std::unique_ptr<Value> JSONReader::ReadToValue(StringPiece json) {
   return value ? std::make_unique<Value>(std::move(*value)) : nullptr;
 }
 
+bool JSONReader::ReadToHandler(StringPiece json, JSONHandler* handler) {
+  return parser_->ParseStreaming(json, handler);
+}
+
 JSONReader::JsonParseError JSONReader::error_code() const {
   return parser_->error_code();
 }
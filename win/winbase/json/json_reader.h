@@ -36,7 +36,9 @@
 
 namespace winbase {
 
+class JSONHandler;
 class Value;
+class ValueKeyTable;
 
 namespace internal {
 class JSONParser;
@@ -111,6 +113,48 @@ class WINBASE_EXPORT JSONReader {
       int* error_line_out = nullptr,
       int* error_column_out = nullptr);
 
+  // Reads and parses |json| like Read(), but interns the dictionary keys in
+  // |key_table|, so that equal keys share their storage, also across the
+  // documents read with the same table. See ValueKeyTable in value_key.h.
+  static std::unique_ptr<Value> ReadWithKeyTable(
+      StringPiece json,
+      ValueKeyTable* key_table,
+      int options = JSON_PARSE_RFC,
+      int max_depth = kStackMaxDepth);
+
+  // Reads and parses |json| like Read(). If the root of |json| is a large
+  // list, its elements are parsed in parallel by tasks posted to the
+  // TaskScheduler, with the calling thread taking part; the result is the same
+  // as that of Read(). If any element fails to parse, |json| is parsed again
+  // sequentially, so the error reported is always that of the first invalid
+  // element, exactly as ReadAndReturnError() reports it. This blocks until all
+  // elements are parsed, so it may only be called where waiting is allowed
+  // (see ScopedAllowBaseSyncPrimitives). Without a TaskScheduler, it is the
+  // same as Read().
+  static std::unique_ptr<Value> ReadInParallel(StringPiece json,
+                                               int options = JSON_PARSE_RFC,
+                                               int max_depth = kStackMaxDepth);
+
+  // Reads and parses |json| like ReadInParallel(). The error outputs are
+  // optional and are populated like in ReadAndReturnError().
+  static std::unique_ptr<Value> ReadInParallelAndReturnError(
+      StringPiece json,
+      int options,  // JSONParserOptions
+      int* error_code_out,
+      std::string* error_msg_out,
+      int* error_line_out = nullptr,
+      int* error_column_out = nullptr);
+
+  // Reads and parses |json| like Read(), but reports its contents to |handler|
+  // as it goes instead of building a Value; see json_handler.h. Returns true
+  // if all of |json| was parsed, and false if it is not properly formed JSON
+  // or if |handler| stopped parsing early. Use the non-static
+  // ReadToHandler() to find out why parsing stopped.
+  static bool ReadStreaming(StringPiece json,
+                            JSONHandler* handler,
+                            int options = JSON_PARSE_RFC,
+                            int max_depth = kStackMaxDepth);
+
   // Converts a JSON parse error code into a human readable message.
   // Returns an empty string if error_code is JSON_NO_ERROR.
   static std::string ErrorCodeToString(JsonParseError error_code);
@@ -118,6 +162,10 @@ class WINBASE_EXPORT JSONReader {
   // Non-static version of Read() above.
   std::unique_ptr<Value> ReadToValue(StringPiece json);
 
+  // Non-static version of ReadStreaming() above. If it returns false and
+  // error_code() is JSON_NO_ERROR, |handler| stopped parsing.
+  bool ReadToHandler(StringPiece json, JSONHandler* handler);
+
   // Returns the error code if the last call to ReadToValue() failed.
   // Returns JSON_NO_ERROR otherwise.
   JsonParseError error_code() const;
@@ -6,23 +6,154 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
+#include <utility>
 
+#include "winbase\files\file.h"
 #include "winbase\json/string_escape.h"
 #include "winbase\logging.h"
 #include "winbase\strings\string_number_conversions.h"
 #include "winbase\strings\utf_string_conversions.h"
+#include "winbase\third_party\double-conversion\double-conversion.h"
 #include "winbase\values.h"
 
 namespace winbase {
 
+namespace {
+
+// Writes the decimal digits of |value| so that they end at |end|, and returns
+// a pointer to the first one.
+char* FormatDigits(uint64_t value, char* end) {
+  do {
+    *--end = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value);
+  return end;
+}
+
+// Appends |value| like Int64ToString() would, without a temporary string.
+void AppendInteger(int64_t value, std::string* out) {
+  char buffer[24];
+  char* end = buffer + sizeof(buffer);
+  uint64_t magnitude = static_cast<uint64_t>(value);
+  char* begin = FormatDigits(value < 0 ? 0 - magnitude : magnitude, end);
+  if (value < 0)
+    *--begin = '-';
+  out->append(begin, end - begin);
+}
+
+// Appends the shortest representation of |value| that reads back as the same
+// double, formatted exactly like NumberToString() does, with ".0" added when
+// it would otherwise read back as an integer. The digits are generated by
+// double-conversion straight into a stack buffer.
+void AppendDouble(double value, std::string* out) {
+  // Value does not hold NaN or infinities.
+  WINBASE_DCHECK(std::isfinite(value));
+
+  // Large enough for "-0.00000" followed by 17 digits, and for the longest
+  // exponential form, "-1.2345678901234567e-308".
+  char buffer[32];
+  char* p = buffer;
+  if (std::signbit(value)) {
+    *p++ = '-';
+    value = -value;
+  }
+
+  if (value < 1e12 && std::floor(value) == value) {
+    // Integers below 10^12 are exact, and are written as such.
+    char digits[16];
+    char* end = digits + sizeof(digits);
+    p = std::copy(FormatDigits(static_cast<uint64_t>(value), end), end, p);
+    *p++ = '.';
+    *p++ = '0';
+    out->append(buffer, p - buffer);
+    return;
+  }
+
+  using double_conversion::DoubleToStringConverter;
+  char digits[DoubleToStringConverter::kBase10MaximalLength + 1];
+  bool sign;
+  int length;
+  int point;
+  DoubleToStringConverter::DoubleToAscii(
+      value, DoubleToStringConverter::SHORTEST, 0, digits, sizeof(digits),
+      &sign, &length, &point);
+
+  // NumberToString() uses decimal notation for exponents in [-6, 12).
+  int exponent = point - 1;
+  if (exponent >= -6 && exponent < 12) {
+    if (point <= 0) {
+      // "0.000ddd"
+      *p++ = '0';
+      *p++ = '.';
+      p = std::fill_n(p, -point, '0');
+      p = std::copy(digits, digits + length, p);
+    } else if (point >= length) {
+      // "ddd000.0"
+      p = std::copy(digits, digits + length, p);
+      p = std::fill_n(p, point - length, '0');
+      *p++ = '.';
+      *p++ = '0';
+    } else {
+      // "ddd.ddd"
+      p = std::copy(digits, digits + point, p);
+      *p++ = '.';
+      p = std::copy(digits + point, digits + length, p);
+    }
+  } else {
+    // "d.ddde+dd"
+    *p++ = digits[0];
+    if (length > 1) {
+      *p++ = '.';
+      p = std::copy(digits + 1, digits + length, p);
+    }
+    *p++ = 'e';
+    *p++ = exponent < 0 ? '-' : '+';
+    char exponent_digits[8];
+    char* end = exponent_digits + sizeof(exponent_digits);
+    p = std::copy(FormatDigits(std::abs(exponent), end), end, p);
+  }
+  out->append(buffer, p - buffer);
+}
+
+}  // namespace
+
 ///#if defined(OS_WIN)
 const char kPrettyPrintLineEnding[] = "\r\n";
 ///#else
 ///const char kPrettyPrintLineEnding[] = "\n";
 ///#endif
 
+JSONFileSink::JSONFileSink(File* file) : file_(file) {
+  WINBASE_DCHECK(file);
+}
+
+JSONFileSink::~JSONFileSink() = default;
+
+bool JSONFileSink::Write(StringPiece data) {
+  while (!data.empty()) {
+    int size = static_cast<int>(
+        std::min<size_t>(data.size(), std::numeric_limits<int>::max()));
+    int written = file_->WriteAtCurrentPos(data.data(), size);
+    if (written <= 0)
+      return false;
+    data.remove_prefix(written);
+  }
+  return true;
+}
+
+JSONCallbackSink::JSONCallbackSink(
+    RepeatingCallback<bool(StringPiece)> callback)
+    : callback_(std::move(callback)) {}
+
+JSONCallbackSink::~JSONCallbackSink() = default;
+
+bool JSONCallbackSink::Write(StringPiece data) {
+  return callback_.Run(data);
+}
+
 // static
 bool JSONWriter::Write(const Value& node, std::string* json) {
   return WriteWithOptions(node, 0, json);
@@ -36,28 +167,31 @@ bool JSONWriter::WriteWithOptions(const Value& node,
   // Is there a better way to estimate the size of the output?
   json->reserve(1024);
 
-  JSONWriter writer(options, json);
-  bool result = writer.BuildJSONString(node, 0U);
-
-  if (options & OPTIONS_PRETTY_PRINT)
-    json->append(kPrettyPrintLineEnding);
-
+  JSONStreamWriter stream_writer(options, json);
+  JSONWriter writer(options, &stream_writer);
+  bool result = writer.BuildJSONString(node);
+  stream_writer.Finish();
   return result;
 }
 
-JSONWriter::JSONWriter(int options, std::string* json)
+// static
+bool JSONWriter::WriteToSink(const Value& node, int options, JSONSink* sink) {
+  JSONStreamWriter stream_writer(options, sink);
+  JSONWriter writer(options, &stream_writer);
+  bool result = writer.BuildJSONString(node);
+  return stream_writer.Finish() && result;
+}
+
+JSONWriter::JSONWriter(int options, JSONStreamWriter* writer)
     : omit_binary_values_((options & OPTIONS_OMIT_BINARY_VALUES) != 0),
-      omit_double_type_preservation_(
-          (options & OPTIONS_OMIT_DOUBLE_TYPE_PRESERVATION) != 0),
-      pretty_print_((options & OPTIONS_PRETTY_PRINT) != 0),
-      json_string_(json) {
-  WINBASE_DCHECK(json);
+      writer_(writer) {
+  WINBASE_DCHECK(writer);
 }
 
-bool JSONWriter::BuildJSONString(const Value& node, size_t depth) {
+bool JSONWriter::BuildJSONString(const Value& node) {
   switch (node.type()) {
     case Value::Type::NONE: {
-      json_string_->append("null");
+      writer_->Null();
       return true;
     }
 
@@ -65,7 +199,7 @@ bool JSONWriter::BuildJSONString(const Value& node, size_t depth) {
       bool value;
       bool result = node.GetAsBoolean(&value);
       WINBASE_DCHECK(result);
-      json_string_->append(value ? "true" : "false");
+      writer_->Bool(value);
       return result;
     }
 
@@ -73,7 +207,7 @@ bool JSONWriter::BuildJSONString(const Value& node, size_t depth) {
       int value;
       bool result = node.GetAsInteger(&value);
       WINBASE_DCHECK(result);
-      json_string_->append(IntToString(value));
+      writer_->Int(value);
       return result;
     }
 
@@ -81,80 +215,37 @@ bool JSONWriter::BuildJSONString(const Value& node, size_t depth) {
       double value;
       bool result = node.GetAsDouble(&value);
       WINBASE_DCHECK(result);
-      if (omit_double_type_preservation_ &&
-          value <= std::numeric_limits<int64_t>::max() &&
-          value >= std::numeric_limits<int64_t>::min() &&
-          std::floor(value) == value) {
-        json_string_->append(Int64ToString(static_cast<int64_t>(value)));
-        return result;
-      }
-      std::string real = NumberToString(value);
-      // Ensure that the number has a .0 if there's no decimal or 'e'.  This
-      // makes sure that when we read the JSON back, it's interpreted as a
-      // real rather than an int.
-      if (real.find('.') == std::string::npos &&
-          real.find('e') == std::string::npos &&
-          real.find('E') == std::string::npos) {
-        real.append(".0");
-      }
-      // The JSON spec requires that non-integer values in the range (-1,1)
-      // have a zero before the decimal point - ".52" is not valid, "0.52" is.
-      if (real[0] == '.') {
-        real.insert(static_cast<size_t>(0), static_cast<size_t>(1), '0');
-      } else if (real.length() > 1 && real[0] == '-' && real[1] == '.') {
-        // "-.1" bad "-0.1" good
-        real.insert(static_cast<size_t>(1), static_cast<size_t>(1), '0');
-      }
-      json_string_->append(real);
+      writer_->Double(value);
       return result;
     }
 
     case Value::Type::STRING: {
-      std::string value;
-      bool result = node.GetAsString(&value);
-      WINBASE_DCHECK(result);
-      EscapeJSONString(value, true, json_string_);
-      return result;
+      writer_->String(node.GetString());
+      return true;
     }
 
     case Value::Type::LIST: {
-      json_string_->push_back('[');
-      if (pretty_print_)
-        json_string_->push_back(' ');
+      writer_->BeginList();
 
       const ListValue* list = nullptr;
-      bool first_value_has_been_output = false;
       bool result = node.GetAsList(&list);
       WINBASE_DCHECK(result);
       for (const auto& value : *list) {
         if (omit_binary_values_ && value.type() == Value::Type::BINARY)
           continue;
 
-        if (first_value_has_been_output) {
-          json_string_->push_back(',');
-          if (pretty_print_)
-            json_string_->push_back(' ');
-        }
-
-        if (!BuildJSONString(value, depth))
+        if (!BuildJSONString(value))
           result = false;
-
-        first_value_has_been_output = true;
       }
 
-      if (pretty_print_)
-        json_string_->push_back(' ');
-      json_string_->push_back(']');
+      writer_->EndList();
       return result;
     }
 
     case Value::Type::DICTIONARY: {
-      json_string_->push_back('{');
-      if (pretty_print_)
-        json_string_->append(kPrettyPrintLineEnding);
+      writer_->BeginDict();
 
       const DictionaryValue* dict = nullptr;
-      bool first_value_has_been_output = false;
       bool result = node.GetAsDictionary(&dict);
       WINBASE_DCHECK(result);
       for (DictionaryValue::Iterator itr(*dict); !itr.IsAtEnd();
@@ -163,32 +254,12 @@ bool JSONWriter::BuildJSONString(const Value& node, size_t depth) {
           continue;
         }
 
-        if (first_value_has_been_output) {
-          json_string_->push_back(',');
-          if (pretty_print_)
-            json_string_->append(kPrettyPrintLineEnding);
-        }
-
-        if (pretty_print_)
-          IndentLine(depth + 1U);
-
-        EscapeJSONString(itr.key(), true, json_string_);
-        json_string_->push_back(':');
-        if (pretty_print_)
-          json_string_->push_back(' ');
-
-        if (!BuildJSONString(itr.value(), depth + 1U))
+        writer_->Key(itr.key());
+        if (!BuildJSONString(itr.value()))
           result = false;
-
-        first_value_has_been_output = true;
-      }
-
-      if (pretty_print_) {
-        json_string_->append(kPrettyPrintLineEnding);
-        IndentLine(depth);
       }
 
-      json_string_->push_back('}');
+      writer_->EndDict();
       return result;
     }
 
@@ -196,14 +267,178 @@ bool JSONWriter::BuildJSONString(const Value& node, size_t depth) {
       // Successful only if we're allowed to omit it.
       WINBASE_DLOG_IF(ERROR, !omit_binary_values_) 
           << "Cannot serialize binary value.";
+      // Nothing is written for the value, but it still counts as one for the
+      // separators around it.
+      writer_->BeginValue();
       return omit_binary_values_;
   }
   WINBASE_NOTREACHED();
   return false;
 }
 
-void JSONWriter::IndentLine(size_t depth) {
-  json_string_->append(depth * 3U, ' ');
+// static
+const size_t JSONStreamWriter::kDefaultBufferSize = 64 * 1024;
+
+JSONStreamWriter::JSONStreamWriter(int options, std::string* json)
+    : omit_double_type_preservation_(
+          (options & JSONWriter::OPTIONS_OMIT_DOUBLE_TYPE_PRESERVATION) != 0),
+      pretty_print_((options & JSONWriter::OPTIONS_PRETTY_PRINT) != 0),
+      sink_(nullptr),
+      buffer_size_(0),
+      sink_failed_(false),
+      output_(json),
+      dict_depth_(0) {
+  WINBASE_DCHECK(json);
+}
+
+JSONStreamWriter::JSONStreamWriter(int options,
+                                   JSONSink* sink,
+                                   size_t buffer_size)
+    : omit_double_type_preservation_(
+          (options & JSONWriter::OPTIONS_OMIT_DOUBLE_TYPE_PRESERVATION) != 0),
+      pretty_print_((options & JSONWriter::OPTIONS_PRETTY_PRINT) != 0),
+      sink_(sink),
+      buffer_size_(buffer_size),
+      sink_failed_(false),
+      output_(&buffer_),
+      dict_depth_(0) {
+  WINBASE_DCHECK(sink);
+  buffer_.reserve(buffer_size);
+}
+
+JSONStreamWriter::~JSONStreamWriter() = default;
+
+void JSONStreamWriter::Null() {
+  BeginValue();
+  output_->append("null");
+  EndValue();
+}
+
+void JSONStreamWriter::Bool(bool value) {
+  BeginValue();
+  output_->append(value ? "true" : "false");
+  EndValue();
+}
+
+void JSONStreamWriter::Int(int value) {
+  BeginValue();
+  AppendInteger(value, output_);
+  EndValue();
+}
+
+void JSONStreamWriter::Double(double value) {
+  BeginValue();
+  if (omit_double_type_preservation_ &&
+      value <= std::numeric_limits<int64_t>::max() &&
+      value >= std::numeric_limits<int64_t>::min() &&
+      std::floor(value) == value) {
+    AppendInteger(static_cast<int64_t>(value), output_);
+  } else {
+    AppendDouble(value, output_);
+  }
+  EndValue();
+}
+
+void JSONStreamWriter::String(StringPiece value) {
+  BeginValue();
+  EscapeJSONString(value, true, output_);
+  EndValue();
+}
+
+void JSONStreamWriter::BeginDict() {
+  BeginValue();
+  output_->push_back('{');
+  if (pretty_print_)
+    output_->append(kPrettyPrintLineEnding);
+  containers_.push_back({true, false});
+  ++dict_depth_;
+}
+
+void JSONStreamWriter::Key(StringPiece key) {
+  WINBASE_DCHECK(!containers_.empty() && containers_.back().is_dict);
+  if (containers_.back().has_values) {
+    output_->push_back(',');
+    if (pretty_print_)
+      output_->append(kPrettyPrintLineEnding);
+  }
+  containers_.back().has_values = true;
+
+  if (pretty_print_)
+    IndentLine(dict_depth_);
+
+  EscapeJSONString(key, true, output_);
+  output_->push_back(':');
+  if (pretty_print_)
+    output_->push_back(' ');
+}
+
+void JSONStreamWriter::EndDict() {
+  WINBASE_DCHECK(!containers_.empty() && containers_.back().is_dict);
+  containers_.pop_back();
+  --dict_depth_;
+
+  if (pretty_print_) {
+    output_->append(kPrettyPrintLineEnding);
+    IndentLine(dict_depth_);
+  }
+
+  output_->push_back('}');
+  EndValue();
+}
+
+void JSONStreamWriter::BeginList() {
+  BeginValue();
+  output_->push_back('[');
+  if (pretty_print_)
+    output_->push_back(' ');
+  containers_.push_back({false, false});
+}
+
+void JSONStreamWriter::EndList() {
+  WINBASE_DCHECK(!containers_.empty() && !containers_.back().is_dict);
+  containers_.pop_back();
+
+  if (pretty_print_)
+    output_->push_back(' ');
+  output_->push_back(']');
+  EndValue();
+}
+
+bool JSONStreamWriter::Finish() {
+  WINBASE_DCHECK(containers_.empty());
+  if (pretty_print_)
+    output_->append(kPrettyPrintLineEnding);
+  if (sink_)
+    Flush();
+  return !sink_failed_;
+}
+
+void JSONStreamWriter::BeginValue() {
+  // Dictionary values follow their key, which wrote the separator.
+  if (containers_.empty() || containers_.back().is_dict)
+    return;
+
+  if (containers_.back().has_values) {
+    output_->push_back(',');
+    if (pretty_print_)
+      output_->push_back(' ');
+  }
+  containers_.back().has_values = true;
+}
+
+void JSONStreamWriter::EndValue() {
+  if (sink_ && buffer_.size() >= buffer_size_)
+    Flush();
+}
+
+void JSONStreamWriter::Flush() {
+  if (!sink_failed_ && !buffer_.empty())
+    sink_failed_ = !sink_->Write(buffer_);
+  buffer_.clear();
+}
+
+void JSONStreamWriter::IndentLine(size_t depth) {
+  output_->append(depth * 3U, ' ');
 }
 
 }  // namespace winbase
\ No newline at end of file
@@ -8,14 +8,61 @@
 #include <stddef.h>
 
 #include <string>
+#include <vector>
 
 #include "winbase\base_export.h"
+#include "winbase\functional\callback.h"
 #include "winbase\macros.h"
+#include "winbase\strings\string_piece.h"
 
 namespace winbase {
 
+class File;
+class JSONStreamWriter;
 class Value;
 
+// Receives the output of a JSONWriter or JSONStreamWriter in pieces, as it is
+// generated.
+class WINBASE_EXPORT JSONSink {
+ public:
+  virtual ~JSONSink() = default;
+
+  // Consumes the next piece of output. Returns false on failure; all further
+  // output is then discarded.
+  virtual bool Write(StringPiece data) = 0;
+};
+
+// A JSONSink that writes to the current position of a File.
+class WINBASE_EXPORT JSONFileSink : public JSONSink {
+ public:
+  // |file| must outlive the sink.
+  explicit JSONFileSink(File* file);
+  JSONFileSink(const JSONFileSink&) = delete;
+  JSONFileSink& operator=(const JSONFileSink&) = delete;
+  ~JSONFileSink() override;
+
+  // JSONSink:
+  bool Write(StringPiece data) override;
+
+ private:
+  File* const file_;
+};
+
+// A JSONSink that passes every piece of output to a callback.
+class WINBASE_EXPORT JSONCallbackSink : public JSONSink {
+ public:
+  explicit JSONCallbackSink(RepeatingCallback<bool(StringPiece)> callback);
+  JSONCallbackSink(const JSONCallbackSink&) = delete;
+  JSONCallbackSink& operator=(const JSONCallbackSink&) = delete;
+  ~JSONCallbackSink() override;
+
+  // JSONSink:
+  bool Write(StringPiece data) override;
+
+ private:
+  RepeatingCallback<bool(StringPiece)> callback_;
+};
+
 class WINBASE_EXPORT JSONWriter {
  public:
   enum Options {
@@ -53,22 +100,119 @@ class WINBASE_EXPORT JSONWriter {
                                int options,
                                std::string* json);
 
+  // Same as WriteWithOptions(), but passes the JSON to |sink| in pieces as it
+  // is generated instead of building it in a string. Returns false if |sink|
+  // failed.
+  static bool WriteToSink(const Value& node, int options, JSONSink* sink);
+
+ private:
+  JSONWriter(int options, JSONStreamWriter* writer);
+
+  // Called recursively to write the JSON for |node| to |writer_|.
+  bool BuildJSONString(const Value& node);
+
+  bool omit_binary_values_;
+
+  // Where we write JSON data as we generate it.
+  JSONStreamWriter* writer_;
+};
+
+// Writes JSON from a sequence of calls that describe the document, so that
+// callers can serialize their own data structures without building a Value
+// first:
+//
+//   std::string json;
+//   JSONStreamWriter writer(JSONWriter::OPTIONS_PRETTY_PRINT, &json);
+//   writer.BeginDict();
+//   writer.Key("name");
+//   writer.String(name);
+//   writer.Key("sizes");
+//   writer.BeginList();
+//   for (int size : sizes)
+//     writer.Int(size);
+//   writer.EndList();
+//   writer.EndDict();
+//   writer.Finish();
+//
+// The output is formatted exactly like JSONWriter formats the equivalent
+// Value, for the same JSONWriter::Options. Keys are written in the order
+// they are given; unlike a Value dictionary, they are neither sorted nor
+// checked for duplicates. The calls must describe exactly one complete value,
+// which is checked in debug builds.
+class WINBASE_EXPORT JSONStreamWriter {
+ public:
+  // How much output is gathered before it is passed to a sink.
+  static const size_t kDefaultBufferSize;
+
+  // Appends the JSON to |json|.
+  JSONStreamWriter(int options, std::string* json);
+
+  // Passes the JSON to |sink| in pieces of about |buffer_size| bytes. A piece
+  // is larger only when a single string does not fit.
+  JSONStreamWriter(int options,
+                   JSONSink* sink,
+                   size_t buffer_size = kDefaultBufferSize);
+
+  JSONStreamWriter(const JSONStreamWriter&) = delete;
+  JSONStreamWriter& operator=(const JSONStreamWriter&) = delete;
+
+  ~JSONStreamWriter();
+
+  void Null();
+  void Bool(bool value);
+  void Int(int value);
+  void Double(double value);  // Must be finite.
+  void String(StringPiece value);
+
+  void BeginDict();
+  void Key(StringPiece key);
+  void EndDict();
+
+  void BeginList();
+  void EndList();
+
+  // Ends the document and passes any remaining output to the sink. Returns
+  // false if the sink failed.
+  bool Finish();
+
  private:
-  JSONWriter(int options, std::string* json);
+  friend class JSONWriter;
+
+  // An open list or dictionary.
+  struct Container {
+    bool is_dict;
+    bool has_values;
+  };
+
+  // Writes what has to precede a value in the current container.
+  void BeginValue();
+
+  // Passes the buffered output to the sink once there is enough of it.
+  void EndValue();
 
-  // Called recursively to build the JSON string. When completed,
-  // |json_string_| will contain the JSON.
-  bool BuildJSONString(const Value& node, size_t depth);
+  // Passes the buffered output to the sink.
+  void Flush();
 
-  // Adds space to json_string_ for the indent level.
+  // Adds space to the output for the indent level.
   void IndentLine(size_t depth);
 
-  bool omit_binary_values_;
-  bool omit_double_type_preservation_;
-  bool pretty_print_;
+  const bool omit_double_type_preservation_;
+  const bool pretty_print_;
+
+  JSONSink* const sink_;
+  const size_t buffer_size_;
+  bool sink_failed_;
+
+  // The output buffer when writing to a sink.
+  std::string buffer_;
 
   // Where we write JSON data as we generate it.
-  std::string* json_string_;
+  std::string* output_;
+
+  std::vector<Container> containers_;
+
+  // The number of open dictionaries, which determines the indent level.
+  size_t dict_depth_;
 };
 
 }  // namespace winbase
@@ -0,0 +1,503 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "winbase\json\lazy_json_document.h"
+
+#include <string.h>
+
+#include <utility>
+
+#include "winbase\json\json_parser.h"
+#include "winbase\logging.h"
+#include "winbase\numerics\safe_conversions.h"
+#include "winbase\optional.h"
+#include "winbase\values.h"
+
+namespace winbase {
+
+namespace {
+
+// Returns true for the characters that end a number or literal token.
+bool IsTokenDelimiter(char c) {
+  switch (c) {
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+    case ',':
+    case ':':
+    case '[':
+    case ']':
+    case '{':
+    case '}':
+    case '"':
+    case '/':
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Counts the line breaks that JSONParser counts in the valid JSON |input|
+// before it reaches |end|, and sets |last_line_break| to the index of the
+// last of them, or 0 if there is none. JSONParser only counts line breaks in
+// whitespace, not in strings or comments. It counts those that follow a
+// number twice, because it reads past the number to check what comes next
+// and then reads the same whitespace again.
+int CountLineBreaks(StringPiece input, size_t end, size_t* last_line_break) {
+  int line_breaks = 0;
+  *last_line_break = 0;
+  bool after_number = false;
+  size_t i = 0;
+  while (i < end) {
+    char c = input[i];
+    switch (c) {
+      case '\r':
+      case '\n':
+        if (!(c == '\n' && i > 0 && input[i - 1] == '\r'))
+          line_breaks += after_number ? 2 : 1;
+        *last_line_break = i;
+        ++i;
+        break;
+      case ' ':
+      case '\t':
+        ++i;
+        break;
+      case '/':
+        // A comment; the document is valid, so there is no other '/' here.
+        if (i + 1 < end && input[i + 1] == '/') {
+          i += 2;
+          while (i < end && input[i] != '\n' && input[i] != '\r')
+            ++i;
+        } else {
+          i += 2;
+          char previous_char = '\0';
+          while (i < end) {
+            char next = input[i++];
+            if (previous_char == '*' && next == '/')
+              break;
+            previous_char = next;
+          }
+        }
+        break;
+      case '"':
+        after_number = false;
+        for (++i; i < end && input[i] != '"'; ++i) {
+          if (input[i] == '\\')
+            ++i;
+        }
+        ++i;
+        break;
+      case '-':
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+      case '8':
+      case '9':
+        after_number = true;
+        while (i < end && !IsTokenDelimiter(input[i]))
+          ++i;
+        break;
+      default:
+        after_number = false;
+        ++i;
+        break;
+    }
+  }
+  return line_breaks;
+}
+
+}  // namespace
+
+// Makes the structural pass over the input. It follows the token rules of
+// JSONParser, including its handling of comments, but only looks at the
+// characters that determine where values begin and end.
+class LazyJSONDocument::Indexer {
+ public:
+  Indexer(StringPiece input,
+          int options,
+          int max_depth,
+          std::vector<Node>* nodes)
+      : input_(input),
+        allow_trailing_commas_((options & JSON_ALLOW_TRAILING_COMMAS) != 0),
+        max_depth_(max_depth),
+        nodes_(nodes),
+        pos_(0),
+        expect_(Expect::kRootValue) {}
+
+  // Returns true if the structure of the input is valid.
+  bool Run() {
+    if (!IsValueInRangeForNumericType<int32_t>(input_.size()))
+      return false;
+    if (input_.starts_with("\xEF\xBB\xBF"))
+      pos_ = 3;
+
+    while (true) {
+      EatWhitespaceAndComments();
+      if (pos_ == input_.size())
+        return expect_ == Expect::kAfterRoot;
+
+      char c = input_[pos_];
+      switch (expect_) {
+        case Expect::kRootValue:
+        case Expect::kValue:
+          if (!StartValue(c))
+            return false;
+          break;
+        case Expect::kFirstListValue:
+        case Expect::kNextListValue:
+          if (c == ']' && (expect_ == Expect::kFirstListValue ||
+                           allow_trailing_commas_)) {
+            CloseContainer();
+          } else if (!StartValue(c)) {
+            return false;
+          }
+          break;
+        case Expect::kFirstKey:
+        case Expect::kNextKey:
+          if (c == '}' &&
+              (expect_ == Expect::kFirstKey || allow_trailing_commas_)) {
+            CloseContainer();
+          } else if (!StartKey(c)) {
+            return false;
+          }
+          break;
+        case Expect::kColon:
+          if (c != ':')
+            return false;
+          ++pos_;
+          expect_ = Expect::kValue;
+          break;
+        case Expect::kAfterValue: {
+          bool in_dict = input_[(*nodes_)[open_.back()].begin] == '{';
+          if (c == ',') {
+            ++pos_;
+            expect_ = in_dict ? Expect::kNextKey : Expect::kNextListValue;
+          } else if (c == (in_dict ? '}' : ']')) {
+            CloseContainer();
+          } else {
+            return false;
+          }
+          break;
+        }
+        case Expect::kAfterRoot:
+          return false;
+      }
+    }
+  }
+
+ private:
+  // What the indexer expects next.
+  enum class Expect {
+    kRootValue,
+    kValue,           // A dictionary value, after the ':'.
+    kFirstListValue,  // A list element or ']', after the '['.
+    kNextListValue,   // A list element, after a ','.
+    kFirstKey,        // A key or '}', after the '{'.
+    kNextKey,         // A key, after a ','.
+    kColon,           // The ':' after a key.
+    kAfterValue,      // A ',' or the end of the enclosing container.
+    kAfterRoot,       // The end of the input.
+  };
+
+  // Skips whitespace and comments exactly like
+  // JSONParser::EatWhitespaceAndComments(). That includes stopping after a
+  // '/' and the character following it if they do not start a comment.
+  void EatWhitespaceAndComments() {
+    while (pos_ < input_.size()) {
+      char c = input_[pos_];
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        ++pos_;
+        continue;
+      }
+      if (c != '/' || input_.size() - pos_ < 2)
+        return;
+
+      char kind = input_[pos_ + 1];
+      pos_ += 2;
+      if (kind == '/') {
+        while (pos_ < input_.size() && input_[pos_] != '\n' &&
+               input_[pos_] != '\r') {
+          ++pos_;
+        }
+      } else if (kind == '*') {
+        char previous_char = '\0';
+        while (pos_ < input_.size()) {
+          char next = input_[pos_++];
+          if (previous_char == '*' && next == '/')
+            break;
+          previous_char = next;
+        }
+      } else {
+        return;
+      }
+    }
+  }
+
+  // Records the value that starts with |c| at |pos_|.
+  bool StartValue(char c) {
+    Node node = key_;
+    node.begin = static_cast<uint32_t>(pos_);
+
+    size_t index = nodes_->size();
+    switch (c) {
+      case '{':
+      case '[':
+        // JSONParser fails at the container that makes the depth reach
+        // |max_depth_|.
+        if (open_.size() + 1 >= static_cast<size_t>(max_depth_))
+          return false;
+        nodes_->push_back(node);
+        open_.push_back(index);
+        ++pos_;
+        expect_ = c == '{' ? Expect::kFirstKey : Expect::kFirstListValue;
+        return true;
+      case '"':
+        if (!SkipString(nullptr))
+          return false;
+        break;
+      case '-':
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+      case '8':
+      case '9':
+      case 't':
+      case 'f':
+      case 'n':
+        // The token is checked when it is decoded. It ends where the next
+        // token or a comment starts.
+        while (pos_ < input_.size() && !IsTokenDelimiter(input_[pos_]))
+          ++pos_;
+        break;
+      default:
+        return false;
+    }
+
+    node.end = static_cast<uint32_t>(pos_);
+    node.next = static_cast<uint32_t>(index + 1);
+    nodes_->push_back(node);
+    ValueDone();
+    return true;
+  }
+
+  // Records the key that starts with |c| at |pos_|.
+  bool StartKey(char c) {
+    if (c != '"')
+      return false;
+    size_t key_begin = pos_ + 1;
+    bool needs_decoding = false;
+    if (!SkipString(&needs_decoding))
+      return false;
+    key_.key_begin = static_cast<uint32_t>(key_begin);
+    key_.key_length = static_cast<uint32_t>(pos_ - 1 - key_begin);
+    key_.key_needs_decoding = needs_decoding;
+    expect_ = Expect::kColon;
+    return true;
+  }
+
+  // Skips the string that starts at |pos_|. If |needs_decoding| is not null,
+  // sets it to whether the string contains escape sequences or bytes that are
+  // not printable ASCII.
+  bool SkipString(bool* needs_decoding) {
+    const char* begin = input_.data() + pos_ + 1;
+    const char* end = input_.data() + input_.size();
+    const char* p = begin;
+    while (true) {
+      const char* quote =
+          static_cast<const char*>(memchr(p, '"', end - p));
+      if (!quote)
+        return false;
+      // The quote ends the string unless it is escaped by an odd number of
+      // backslashes.
+      const char* backslashes = quote;
+      while (backslashes != begin && backslashes[-1] == '\\')
+        --backslashes;
+      p = quote + 1;
+      if ((quote - backslashes) % 2 == 0)
+        break;
+    }
+
+    if (needs_decoding) {
+      for (const char* it = begin; it != p - 1; ++it) {
+        unsigned char c = static_cast<unsigned char>(*it);
+        if (c < 0x20 || c >= 0x80 || c == '\\') {
+          *needs_decoding = true;
+          break;
+        }
+      }
+    }
+    pos_ = p - input_.data();
+    return true;
+  }
+
+  // Ends the innermost open container, whose closing character is at |pos_|.
+  void CloseContainer() {
+    Node& node = (*nodes_)[open_.back()];
+    open_.pop_back();
+    ++pos_;
+    node.end = static_cast<uint32_t>(pos_);
+    node.next = static_cast<uint32_t>(nodes_->size());
+    ValueDone();
+  }
+
+  void ValueDone() {
+    key_ = Node();
+    expect_ = open_.empty() ? Expect::kAfterRoot : Expect::kAfterValue;
+  }
+
+  const StringPiece input_;
+  const bool allow_trailing_commas_;
+  const int max_depth_;
+  std::vector<Node>* const nodes_;
+
+  size_t pos_;
+  Expect expect_;
+
+  // The nodes of the open containers.
+  std::vector<size_t> open_;
+
+  // The key of the next dictionary value.
+  Node key_ = Node();
+};
+
+LazyJSONDocument::LazyJSONDocument(StringPiece json,
+                                   int options,
+                                   int max_depth)
+    : input_(json),
+      options_(options),
+      max_depth_(max_depth),
+      error_code_(JSONReader::JSON_NO_ERROR),
+      error_line_(0),
+      error_column_(0) {}
+
+LazyJSONDocument::~LazyJSONDocument() = default;
+
+// static
+std::unique_ptr<LazyJSONDocument> LazyJSONDocument::Parse(StringPiece json,
+                                                          int options,
+                                                          int max_depth) {
+  std::unique_ptr<LazyJSONDocument> document(
+      new LazyJSONDocument(json, options, max_depth));
+  Indexer indexer(json, options, max_depth, &document->nodes_);
+  if (!indexer.Run())
+    return nullptr;
+  return document;
+}
+
+// static
+std::unique_ptr<LazyJSONDocument> LazyJSONDocument::ParseAndReturnError(
+    StringPiece json,
+    int options,
+    int* error_code_out,
+    std::string* error_msg_out,
+    int* error_line_out,
+    int* error_column_out) {
+  std::unique_ptr<LazyJSONDocument> document(
+      new LazyJSONDocument(json, options, JSONReader::kStackMaxDepth));
+  Indexer indexer(json, options, JSONReader::kStackMaxDepth,
+                  &document->nodes_);
+  if (indexer.Run())
+    return document;
+
+  // Let the parser find the error, so that it is reported the same way.
+  internal::JSONParser parser(options);
+  bool parsed = parser.Parse(json).has_value();
+  WINBASE_DCHECK(!parsed) << "Indexer rejected valid JSON.";
+  if (error_code_out)
+    *error_code_out = parser.error_code();
+  if (error_msg_out)
+    *error_msg_out = parser.GetErrorMessage();
+  if (error_line_out)
+    *error_line_out = parser.error_line();
+  if (error_column_out)
+    *error_column_out = parser.error_column();
+  return nullptr;
+}
+
+std::unique_ptr<Value> LazyJSONDocument::FindPath(
+    std::initializer_list<StringPiece> path) {
+  return FindPath(make_span(path.begin(), path.size()));
+}
+
+std::unique_ptr<Value> LazyJSONDocument::FindPath(
+    span<const StringPiece> path) {
+  error_code_ = JSONReader::JSON_NO_ERROR;
+  error_line_ = 0;
+  error_column_ = 0;
+
+  size_t current = 0;
+  for (const StringPiece component : path) {
+    const Node& dict = nodes_[current];
+    if (input_[dict.begin] != '{')
+      return nullptr;
+
+    // Entries are not sorted; keep the last match, as Value does.
+    size_t found = 0;
+    for (size_t child = current + 1; child < dict.next;
+         child = nodes_[child].next) {
+      if (KeyEquals(nodes_[child], component))
+        found = child;
+      else if (error_code_ != JSONReader::JSON_NO_ERROR)
+        return nullptr;
+    }
+    if (!found)
+      return nullptr;
+    current = found;
+  }
+
+  // The root is decoded from the whole input, so that errors are reported
+  // exactly as JSONReader::Read() would report them.
+  if (current == 0)
+    return Decode(0, static_cast<uint32_t>(input_.size()));
+  return Decode(nodes_[current].begin, nodes_[current].end);
+}
+
+std::string LazyJSONDocument::GetErrorMessage() const {
+  return internal::JSONParser::FormatErrorMessage(
+      error_line_, error_column_, JSONReader::ErrorCodeToString(error_code_));
+}
+
+bool LazyJSONDocument::KeyEquals(const Node& node, StringPiece key) {
+  if (!node.key_needs_decoding)
+    return input_.substr(node.key_begin, node.key_length) == key;
+
+  // Decode the key including its quotes, as a string value.
+  std::unique_ptr<Value> decoded =
+      Decode(node.key_begin - 1, node.key_begin + node.key_length + 1);
+  return decoded && decoded->GetString() == key;
+}
+
+std::unique_ptr<Value> LazyJSONDocument::Decode(uint32_t begin, uint32_t end) {
+  internal::JSONParser parser(options_, max_depth_);
+  Optional<Value> value = parser.Parse(input_.substr(begin, end - begin));
+  if (value)
+    return std::make_unique<Value>(std::move(*value));
+
+  error_code_ = parser.error_code();
+  if (!parser.error_line())
+    return nullptr;
+
+  // Translate the position within the value to the one JSONReader reports
+  // for the whole document.
+  size_t last_line_break;
+  error_line_ = CountLineBreaks(input_, begin, &last_line_break) +
+                parser.error_line();
+  error_column_ = parser.error_column();
+  if (parser.error_line() == 1)
+    error_column_ += static_cast<int>(begin - last_line_break);
+  return nullptr;
+}
+
+}  // namespace winbase
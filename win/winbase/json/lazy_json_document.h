@@ -0,0 +1,125 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef WINLIB_WINBASE_JSON_LAZY_JSON_DOCUMENT_H_
+#define WINLIB_WINBASE_JSON_LAZY_JSON_DOCUMENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "winbase\base_export.h"
+#include "winbase\containers\span.h"
+#include "winbase\json\json_reader.h"
+#include "winbase\strings\string_piece.h"
+
+namespace winbase {
+
+class Value;
+
+// A JSON document that is only decoded where it is read. Parse() makes a
+// single fast pass over the input that records where every value starts and
+// ends; FindPath() then locates a value by its key path using that index and
+// decodes just that value with JSONReader's parser. For large documents of
+// which only a few fields are read, this is much cheaper than building the
+// whole Value tree with JSONReader::Read().
+//
+//   std::unique_ptr<LazyJSONDocument> doc = LazyJSONDocument::Parse(json);
+//   std::unique_ptr<Value> id = doc->FindPath({"user", "id"});
+//
+// Parse() checks the structure of the document: brackets, strings, commas,
+// colons, comments, nesting depth and what follows the root. Errors in it are
+// reported exactly as JSONReader reports them. The contents of a value, such
+// as its numbers, literals, escape sequences and UTF-8, are checked when the
+// value is decoded, by the same rules. The document must not outlive |json|.
+class WINBASE_EXPORT LazyJSONDocument {
+ public:
+  LazyJSONDocument(const LazyJSONDocument&) = delete;
+  LazyJSONDocument& operator=(const LazyJSONDocument&) = delete;
+
+  ~LazyJSONDocument();
+
+  // Indexes |json|, which must outlive the returned document. Returns nullptr
+  // if the structure of |json| is not valid JSON.
+  static std::unique_ptr<LazyJSONDocument> Parse(
+      StringPiece json,
+      int options = JSON_PARSE_RFC,
+      int max_depth = JSONReader::kStackMaxDepth);
+
+  // Indexes |json| like Parse(). The error outputs are optional and are
+  // populated like in JSONReader::ReadAndReturnError().
+  static std::unique_ptr<LazyJSONDocument> ParseAndReturnError(
+      StringPiece json,
+      int options,  // JSONParserOptions
+      int* error_code_out,
+      std::string* error_msg_out,
+      int* error_line_out = nullptr,
+      int* error_column_out = nullptr);
+
+  // Decodes the value found by following |path| through nested dictionaries,
+  // starting at the root; an empty path decodes the whole document. As with
+  // Value, the last of several entries with the same key is used. Returns
+  // nullptr if a component is missing or not a dictionary, or if a value on
+  // the way fails to decode, in which case error_code() says why.
+  std::unique_ptr<Value> FindPath(std::initializer_list<StringPiece> path);
+  std::unique_ptr<Value> FindPath(span<const StringPiece> path);
+
+  // Error information for the last FindPath() call. JSON_NO_ERROR if it
+  // succeeded or only failed to find the path.
+  JSONReader::JsonParseError error_code() const { return error_code_; }
+  std::string GetErrorMessage() const;
+  int error_line() const { return error_line_; }
+  int error_column() const { return error_column_; }
+
+ private:
+  class Indexer;
+
+  // The position of one value in the input. Nodes are stored in document
+  // order, so the children of a list or dictionary follow it directly.
+  struct Node {
+    // The value is input_[begin, end).
+    uint32_t begin;
+    uint32_t end;
+
+    // The index of the node that follows the value and all of its children.
+    uint32_t next;
+
+    // For dictionary entries, the key between the quotes is
+    // input_[key_begin, key_begin + key_length).
+    uint32_t key_begin;
+    uint32_t key_length;
+
+    // True if the key has to be decoded before it can be compared, because it
+    // contains escape sequences or bytes that are not printable ASCII.
+    bool key_needs_decoding;
+  };
+
+  LazyJSONDocument(StringPiece json, int options, int max_depth);
+
+  // Returns true if the key of |node| is |key|. Sets the error information and
+  // returns false if the key does not decode.
+  bool KeyEquals(const Node& node, StringPiece key);
+
+  // Decodes input_[begin, end), which holds a single value. Reports errors at
+  // their position in the whole document.
+  std::unique_ptr<Value> Decode(uint32_t begin, uint32_t end);
+
+  const StringPiece input_;
+  const int options_;
+  const int max_depth_;
+
+  std::vector<Node> nodes_;
+
+  JSONReader::JsonParseError error_code_;
+  int error_line_;
+  int error_column_;
+};
+
+}  // namespace winbase
+
+#endif  // WINLIB_WINBASE_JSON_LAZY_JSON_DOCUMENT_H_
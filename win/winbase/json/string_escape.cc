@@ -10,12 +10,19 @@
 #include <limits>
 #include <string>
 
+#include "winbase\bits.h"
+#include "winbase\cpu.h"
 #include "winbase\strings\string_util.h"
 #include "winbase\strings\stringprintf.h"
 #include "winbase\strings\utf_string_conversion_utils.h"
 #include "winbase\strings\utf_string_conversions.h"
 #include "winbase\third_party\icu\icu_utf.h"
 #include "winbase\logging.h"
+#include "winlib\build_config.h"
+
+#if defined(ARCH_CPU_X86_FAMILY)
+#include <immintrin.h>
+#endif
 
 namespace winbase {
 
@@ -78,6 +85,160 @@ bool EscapeSpecialCodePoint(uint32_t code_point, std::string* dest) {
   return true;
 }
 
+// Code units that are copied to the output unchanged: printable ASCII except
+// the ones EscapeSpecialCodePoint() escapes. DEL is not escaped either.
+template <typename Char>
+inline bool IsSafeCodeUnit(Char c) {
+  return c >= 0x20 && c < 0x80 && c != '"' && c != '\\' && c != '<';
+}
+
+// Safe code unit scanners. Each returns the length of the longest prefix of
+// [begin, end) made up of safe code units only, so that runs of them can be
+// copied at once. The SIMD variants look at 16 or 32 bytes per step and finish
+// the tail with the scalar variant, so all of them return the same result.
+template <typename Char>
+size_t ScanSafeCodeUnitsScalar(const Char* begin, const Char* end) {
+  const Char* p = begin;
+  while (p != end && IsSafeCodeUnit(*p))
+    ++p;
+  return p - begin;
+}
+
+#if defined(ARCH_CPU_X86_FAMILY)
+
+size_t ScanSafeCharsSSE2(const char* begin, const char* end) {
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i less_than = _mm_set1_epi8('<');
+  const char* p = begin;
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    // As signed bytes, both control characters and non-ASCII bytes are less
+    // than ' '.
+    __m128i unsafe = _mm_or_si128(
+        _mm_or_si128(_mm_cmplt_epi8(chunk, space),
+                     _mm_cmpeq_epi8(chunk, quote)),
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, backslash),
+                     _mm_cmpeq_epi8(chunk, less_than)));
+    uint32_t stop = static_cast<uint32_t>(_mm_movemask_epi8(unsafe));
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop);
+  }
+  return (p - begin) + ScanSafeCodeUnitsScalar(p, end);
+}
+
+size_t ScanSafeChar16sSSE2(const char16* begin, const char16* end) {
+  const __m128i space = _mm_set1_epi16(' ');
+  const __m128i del = _mm_set1_epi16(0x7F);
+  const __m128i quote = _mm_set1_epi16('"');
+  const __m128i backslash = _mm_set1_epi16('\\');
+  const __m128i less_than = _mm_set1_epi16('<');
+  const char16* p = begin;
+  for (; end - p >= 8; p += 8) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    // As signed 16-bit values, units from 0x8000 up are less than ' '.
+    __m128i unsafe = _mm_or_si128(
+        _mm_or_si128(_mm_cmplt_epi16(chunk, space),
+                     _mm_cmpgt_epi16(chunk, del)),
+        _mm_or_si128(_mm_cmpeq_epi16(chunk, quote),
+                     _mm_or_si128(_mm_cmpeq_epi16(chunk, backslash),
+                                  _mm_cmpeq_epi16(chunk, less_than))));
+    // Every code unit sets two bits of the mask.
+    uint32_t stop = static_cast<uint32_t>(_mm_movemask_epi8(unsafe));
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop) / 2;
+  }
+  return (p - begin) + ScanSafeCodeUnitsScalar(p, end);
+}
+
+size_t ScanSafeCharsAVX2(const char* begin, const char* end) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i less_than = _mm256_set1_epi8('<');
+  const char* p = begin;
+  for (; end - p >= 32; p += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i unsafe = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpgt_epi8(space, chunk),
+                        _mm256_cmpeq_epi8(chunk, quote)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, backslash),
+                        _mm256_cmpeq_epi8(chunk, less_than)));
+    uint32_t stop = static_cast<uint32_t>(_mm256_movemask_epi8(unsafe));
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop);
+  }
+  return (p - begin) + ScanSafeCharsSSE2(p, end);
+}
+
+size_t ScanSafeChar16sAVX2(const char16* begin, const char16* end) {
+  const __m256i space = _mm256_set1_epi16(' ');
+  const __m256i del = _mm256_set1_epi16(0x7F);
+  const __m256i quote = _mm256_set1_epi16('"');
+  const __m256i backslash = _mm256_set1_epi16('\\');
+  const __m256i less_than = _mm256_set1_epi16('<');
+  const char16* p = begin;
+  for (; end - p >= 16; p += 16) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i unsafe = _mm256_or_si256(
+        _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpgt_epi16(space, chunk),
+                            _mm256_cmpgt_epi16(chunk, del)),
+            _mm256_cmpeq_epi16(chunk, quote)),
+        _mm256_or_si256(_mm256_cmpeq_epi16(chunk, backslash),
+                        _mm256_cmpeq_epi16(chunk, less_than)));
+    uint32_t stop = static_cast<uint32_t>(_mm256_movemask_epi8(unsafe));
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop) / 2;
+  }
+  return (p - begin) + ScanSafeChar16sSSE2(p, end);
+}
+
+#endif  // defined(ARCH_CPU_X86_FAMILY)
+
+struct SafeCodeUnitScanners {
+  size_t (*scan_chars)(const char* begin, const char* end);
+  size_t (*scan_char16s)(const char16* begin, const char16* end);
+
+  size_t Scan(const char* begin, const char* end) const {
+    return scan_chars(begin, end);
+  }
+  size_t Scan(const char16* begin, const char16* end) const {
+    return scan_char16s(begin, end);
+  }
+};
+
+SafeCodeUnitScanners SelectSafeCodeUnitScanners() {
+#if defined(ARCH_CPU_X86_FAMILY)
+  CPU cpu;
+  if (cpu.has_avx2())
+    return {&ScanSafeCharsAVX2, &ScanSafeChar16sAVX2};
+  if (cpu.has_sse2())
+    return {&ScanSafeCharsSSE2, &ScanSafeChar16sSSE2};
+#endif
+  return {&ScanSafeCodeUnitsScalar<char>, &ScanSafeCodeUnitsScalar<char16>};
+}
+
+// The CPU is only queried once.
+const SafeCodeUnitScanners& GetSafeCodeUnitScanners() {
+  static const SafeCodeUnitScanners scanners = SelectSafeCodeUnitScanners();
+  return scanners;
+}
+
+// Appends a run of safe code units, which are all ASCII, to |dest|.
+void AppendSafeRun(const char* run, size_t length, std::string* dest) {
+  dest->append(run, length);
+}
+
+void AppendSafeRun(const char16* run, size_t length, std::string* dest) {
+  const size_t offset = dest->size();
+  dest->resize(offset + length);
+  char* out = &(*dest)[offset];
+  for (size_t i = 0; i < length; ++i)
+    out[i] = static_cast<char>(run[i]);
+}
+
 template <typename S>
 bool EscapeJSONStringImpl(const S& str, bool put_in_quotes, std::string* dest) {
   bool did_replacement = false;
@@ -89,8 +250,20 @@ bool EscapeJSONStringImpl(const S& str, bool put_in_quotes, std::string* dest) {
   WINBASE_CHECK_LE(str.length(),
                    static_cast<size_t>(std::numeric_limits<int32_t>::max()));
   const int32_t length = static_cast<int32_t>(str.length());
+  const SafeCodeUnitScanners& scanners = GetSafeCodeUnitScanners();
 
   for (int32_t i = 0; i < length; ++i) {
+    // Copy a run of characters that need no escaping all at once.
+    const auto* run = str.data() + i;
+    int32_t run_length =
+        static_cast<int32_t>(scanners.Scan(run, str.data() + length));
+    if (run_length) {
+      AppendSafeRun(run, run_length, dest);
+      i += run_length;
+      if (i == length)
+        break;
+    }
+
     uint32_t code_point;
     if (!ReadUnicodeCharacter(str.data(), length, &i, &code_point) ||
         code_point == static_cast<decltype(code_point)>(CBU_SENTINEL) ||
@@ -21,10 +21,94 @@ const int Pickle::kPayloadUnit = 64;
 
 static const size_t kCapacityReadOnly = static_cast<size_t>(-1);
 
+// static
+const size_t SegmentedPickle::kDefaultSegmentSize = 64 * 1024;
+
+// static
+const size_t SegmentedPickle::kMinExternalBytes = 512;
+
+// The padding of external data in the gather list of a SegmentedPickle.
+static const char kZeroPadding[sizeof(uint32_t)] = {};
+
+namespace {
+
+// The most bytes that a variable-length 64-bit integer takes.
+const size_t kMaxVarIntBytes = 10;
+
+// Maps signed integers to unsigned ones so that those of small magnitude stay
+// small: 0, -1, 1, -2 become 0, 1, 2, 3.
+inline uint64_t ToVarInt(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+inline uint64_t ToVarInt(uint64_t value) {
+  return value;
+}
+
+template <typename T>
+inline T FromVarInt(uint64_t value);
+
+template <>
+inline int64_t FromVarInt<int64_t>(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+template <>
+inline uint64_t FromVarInt<uint64_t>(uint64_t value) {
+  return value;
+}
+
+inline size_t VarIntSize(uint64_t value) {
+  size_t size = 1;
+  for (; value >= 0x80; value >>= 7)
+    ++size;
+  return size;
+}
+
+// Writes |value| at |out| and returns the end of what was written.
+inline char* EncodeVarInt(uint64_t value, char* out) {
+  for (; value >= 0x80; value >>= 7)
+    *out++ = static_cast<char>(value | 0x80);
+  *out++ = static_cast<char>(value);
+  return out;
+}
+
+// Reads an integer from [data, end) into |*value| and returns the number of
+// bytes it takes, or 0 if it is not complete or does not fit in 64 bits.
+inline size_t DecodeVarInt(const char* data, const char* end,
+                           uint64_t* value) {
+  uint64_t result = 0;
+  size_t max_size = std::min(kMaxVarIntBytes, static_cast<size_t>(end - data));
+  for (size_t i = 0; i < max_size; ++i) {
+    uint8_t byte = static_cast<uint8_t>(data[i]);
+    if (i == kMaxVarIntBytes - 1 && byte > 1)
+      return 0;
+    result |= static_cast<uint64_t>(byte & 0x7f) << (7 * i);
+    if (!(byte & 0x80)) {
+      *value = result;
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
 PickleIterator::PickleIterator(const Pickle& pickle)
     : payload_(pickle.payload()),
       read_index_(0),
-      end_index_(pickle.payload_size()) {
+      end_index_(pickle.payload_size()),
+      segmented_(nullptr),
+      next_segment_(0) {
+}
+
+PickleIterator::PickleIterator(const SegmentedPickle& pickle)
+    : payload_(pickle.segments_[0].data),
+      read_index_(0),
+      end_index_(pickle.segments_[0].size),
+      segmented_(&pickle),
+      next_segment_(1) {
 }
 
 template <typename Type>
@@ -50,8 +134,9 @@ inline void PickleIterator::Advance(size_t size) {
 
 template<typename Type>
 inline const char* PickleIterator::GetReadPointerAndAdvance() {
-  if (sizeof(Type) > end_index_ - read_index_) {
+  if (sizeof(Type) > end_index_ - read_index_ && !NextSegment(sizeof(Type))) {
     read_index_ = end_index_;
+    segmented_ = nullptr;
     return nullptr;
   }
   const char* current_read_ptr = payload_ + read_index_;
@@ -61,8 +146,10 @@ inline const char* PickleIterator::GetReadPointerAndAdvance() {
 
 const char* PickleIterator::GetReadPointerAndAdvance(int num_bytes) {
   if (num_bytes < 0 ||
-      end_index_ - read_index_ < static_cast<size_t>(num_bytes)) {
+      (end_index_ - read_index_ < static_cast<size_t>(num_bytes) &&
+       !NextSegment(num_bytes))) {
     read_index_ = end_index_;
+    segmented_ = nullptr;
     return nullptr;
   }
   const char* current_read_ptr = payload_ + read_index_;
@@ -80,6 +167,63 @@ inline const char* PickleIterator::GetReadPointerAndAdvance(
   return GetReadPointerAndAdvance(num_bytes);
 }
 
+bool PickleIterator::ReadArray(size_t element_size,
+                               const char** data,
+                               int* count) {
+  if (!ReadLength(count))
+    return false;
+  *data = GetReadPointerAndAdvance(*count, element_size);
+  return !!*data;
+}
+
+template <typename T>
+bool PickleIterator::ReadVarIntArray(std::vector<T>* result) {
+  int count;
+  int length;
+  const char* data;
+  // Every value takes at least one byte.
+  if (!ReadLength(&count) || !ReadLength(&length) || count > length ||
+      !(data = GetReadPointerAndAdvance(length))) {
+    return false;
+  }
+  const char* end = data + length;
+  result->resize(count);
+  int decoded = 0;
+  for (; decoded < count; ++decoded) {
+    uint64_t encoded;
+    size_t size = DecodeVarInt(data, end, &encoded);
+    if (!size)
+      break;
+    (*result)[decoded] = FromVarInt<T>(encoded);
+    data += size;
+  }
+  // The bytes must hold exactly |count| values, no fewer and no more.
+  if (decoded != count || data != end) {
+    read_index_ = end_index_;
+    segmented_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool PickleIterator::NextSegment(size_t num_bytes) {
+  // A value never spans two segments, so there is nothing left to read in
+  // this one.
+  if (!segmented_ || read_index_ != end_index_)
+    return false;
+  while (next_segment_ < segmented_->segments_.size()) {
+    const SegmentedPickle::Segment& segment =
+        segmented_->segments_[next_segment_++];
+    if (!segment.size)
+      continue;
+    payload_ = segment.data;
+    read_index_ = 0;
+    end_index_ = segment.size;
+    return num_bytes <= end_index_;
+  }
+  return false;
+}
+
 bool PickleIterator::ReadBool(bool* result) {
   return ReadBuiltinType(result);
 }
@@ -206,6 +350,47 @@ bool PickleIterator::ReadBytes(const char** data, int length) {
   return true;
 }
 
+bool PickleIterator::TryReadBytes(const char** data, int length) {
+  if (length < 0 ||
+      (end_index_ - read_index_ < static_cast<size_t>(length) &&
+       !NextSegment(length))) {
+    return false;
+  }
+  *data = payload_ + read_index_;
+  Advance(length);
+  return true;
+}
+
+bool PickleIterator::ReadVarUInt64(uint64_t* result) {
+  size_t size = 0;
+  if (read_index_ < end_index_ || NextSegment(1)) {
+    size = DecodeVarInt(payload_ + read_index_, payload_ + end_index_, result);
+  }
+  if (!size) {
+    read_index_ = end_index_;
+    segmented_ = nullptr;
+    return false;
+  }
+  Advance(size);
+  return true;
+}
+
+bool PickleIterator::ReadVarInt64(int64_t* result) {
+  uint64_t encoded;
+  if (!ReadVarUInt64(&encoded))
+    return false;
+  *result = FromVarInt<int64_t>(encoded);
+  return true;
+}
+
+bool PickleIterator::ReadVarUInt64Array(std::vector<uint64_t>* result) {
+  return ReadVarIntArray(result);
+}
+
+bool PickleIterator::ReadVarInt64Array(std::vector<int64_t>* result) {
+  return ReadVarIntArray(result);
+}
+
 Pickle::Attachment::Attachment() = default;
 
 Pickle::Attachment::~Attachment() = default;
@@ -307,6 +492,36 @@ void Pickle::WriteBytes(const void* data, int length) {
   WriteBytesCommon(data, length);
 }
 
+void Pickle::WriteVarUInt64(uint64_t value) {
+  char buffer[kMaxVarIntBytes];
+  WriteBytes(buffer, static_cast<int>(EncodeVarInt(value, buffer) - buffer));
+}
+
+void Pickle::WriteVarInt64(int64_t value) {
+  WriteVarUInt64(ToVarInt(value));
+}
+
+void Pickle::WriteVarUInt64Array(span<const uint64_t> values) {
+  WriteVarIntArray(values);
+}
+
+void Pickle::WriteVarInt64Array(span<const int64_t> values) {
+  WriteVarIntArray(values);
+}
+
+// The values are measured first, so that they can be encoded in place.
+template <typename T>
+void Pickle::WriteVarIntArray(span<const T> values) {
+  size_t length = 0;
+  for (T value : values)
+    length += VarIntSize(ToVarInt(value));
+  WriteInt(static_cast<int>(values.size()));
+  WriteInt(static_cast<int>(length));
+  char* write = static_cast<char*>(ClaimUninitializedBytesInternal(length));
+  for (T value : values)
+    write = EncodeVarInt(ToVarInt(value), write);
+}
+
 void Pickle::Reserve(size_t length) {
   size_t data_len = bits::Align(length, sizeof(uint32_t));
   WINBASE_DCHECK_GE(data_len, length);
@@ -433,4 +648,171 @@ inline void Pickle::WriteBytesCommon(const void* data, size_t length) {
   memcpy(write, data, length);
 }
 
+SegmentedPickle::SegmentedPickle(size_t segment_size)
+    : header_(nullptr),
+      write_ptr_(nullptr),
+      write_end_(nullptr),
+      payload_size_(0),
+      segment_size_(segment_size) {
+  WINBASE_DCHECK_GE(segment_size, sizeof(Pickle::Header));
+  buffers_.emplace_back(new char[segment_size]);
+  header_ = reinterpret_cast<Pickle::Header*>(buffers_.back().get());
+  header_->payload_size = 0;
+  write_ptr_ = buffers_.back().get() + sizeof(Pickle::Header);
+  write_end_ = buffers_.back().get() + segment_size;
+  segments_.push_back({write_ptr_, 0, 0});
+}
+
+SegmentedPickle::SegmentedPickle(char* buffer,
+                                 size_t buffer_size,
+                                 size_t segment_size)
+    : header_(reinterpret_cast<Pickle::Header*>(buffer)),
+      write_ptr_(buffer + sizeof(Pickle::Header)),
+      write_end_(buffer + buffer_size),
+      payload_size_(0),
+      segment_size_(segment_size) {
+  WINBASE_CHECK_GE(buffer_size, sizeof(Pickle::Header));
+  WINBASE_DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(buffer) %
+                            sizeof(uint32_t));
+  header_->payload_size = 0;
+  segments_.push_back({write_ptr_, 0, 0});
+}
+
+SegmentedPickle::~SegmentedPickle() = default;
+
+void SegmentedPickle::WriteString(const StringPiece& value) {
+  WriteInt(static_cast<int>(value.size()));
+  WriteBytes(value.data(), static_cast<int>(value.size()));
+}
+
+void SegmentedPickle::WriteString16(const StringPiece16& value) {
+  WriteInt(static_cast<int>(value.size()));
+  WriteBytes(value.data(), static_cast<int>(value.size()) * sizeof(char16));
+}
+
+void SegmentedPickle::WriteData(const char* data, int length) {
+  WINBASE_DCHECK_GE(length, 0);
+  WriteInt(length);
+  WriteBytes(data, length);
+}
+
+void SegmentedPickle::WriteBytes(const void* data, int length) {
+  MSAN_CHECK_MEM_IS_INITIALIZED(data, length);
+  memcpy(ClaimBytes(length), data, length);
+}
+
+void SegmentedPickle::WriteVarUInt64(uint64_t value) {
+  char buffer[kMaxVarIntBytes];
+  WriteBytes(buffer, static_cast<int>(EncodeVarInt(value, buffer) - buffer));
+}
+
+void SegmentedPickle::WriteVarInt64(int64_t value) {
+  WriteVarUInt64(ToVarInt(value));
+}
+
+void SegmentedPickle::WriteVarUInt64Array(span<const uint64_t> values) {
+  WriteVarIntArray(values);
+}
+
+void SegmentedPickle::WriteVarInt64Array(span<const int64_t> values) {
+  WriteVarIntArray(values);
+}
+
+template <typename T>
+void SegmentedPickle::WriteVarIntArray(span<const T> values) {
+  size_t length = 0;
+  for (T value : values)
+    length += VarIntSize(ToVarInt(value));
+  WriteInt(static_cast<int>(values.size()));
+  WriteInt(static_cast<int>(length));
+  char* write = static_cast<char*>(ClaimBytes(length));
+  for (T value : values)
+    write = EncodeVarInt(ToVarInt(value), write);
+}
+
+void SegmentedPickle::WriteExternalData(const char* data, int length) {
+  WINBASE_DCHECK_GE(length, 0);
+  WriteInt(length);
+  WriteExternalBytes(data, length);
+}
+
+void SegmentedPickle::WriteExternalBytes(const void* data, int length) {
+  WINBASE_DCHECK_GE(length, 0);
+  if (static_cast<size_t>(length) < kMinExternalBytes) {
+    WriteBytes(data, length);
+    return;
+  }
+  size_t data_len = bits::Align(length, sizeof(uint32_t));
+  WINBASE_DCHECK_LE(payload_size_,
+                    std::numeric_limits<uint32_t>::max() - data_len);
+  segments_.push_back(
+      {static_cast<const char*>(data), static_cast<size_t>(length),
+       data_len - length});
+  // Later writes continue in the free space of the current buffer.
+  segments_.push_back({write_ptr_, 0, 0});
+  payload_size_ += data_len;
+  header_->payload_size = static_cast<uint32_t>(payload_size_);
+}
+
+std::vector<span<const char>> SegmentedPickle::GetGatherList() const {
+  std::vector<span<const char>> pieces;
+  pieces.reserve(segments_.size() + 1);
+  auto append = [&pieces](const char* data, size_t size) {
+    if (!size)
+      return;
+    // Join pieces that are contiguous, like the header and the start of the
+    // payload.
+    if (!pieces.empty() &&
+        pieces.back().data() + pieces.back().size() == data) {
+      pieces.back() =
+          make_span(pieces.back().data(), pieces.back().size() + size);
+    } else {
+      pieces.push_back(make_span(data, size));
+    }
+  };
+  append(reinterpret_cast<const char*>(header_), sizeof(Pickle::Header));
+  for (const Segment& segment : segments_) {
+    append(segment.data, segment.size);
+    append(kZeroPadding, segment.padding);
+  }
+  return pieces;
+}
+
+void SegmentedPickle::StartSegment(size_t num_bytes) {
+  size_t capacity = std::max(segment_size_, num_bytes);
+  buffers_.emplace_back(new char[capacity]);
+  write_ptr_ = buffers_.back().get();
+  write_end_ = write_ptr_ + capacity;
+  if (segments_.back().size)
+    segments_.push_back({write_ptr_, 0, 0});
+  else
+    segments_.back().data = write_ptr_;
+}
+
+template <size_t length>
+void SegmentedPickle::WriteBytesStatic(const void* data) {
+  memcpy(ClaimBytes(length), data, length);
+}
+
+template void SegmentedPickle::WriteBytesStatic<2>(const void* data);
+template void SegmentedPickle::WriteBytesStatic<4>(const void* data);
+template void SegmentedPickle::WriteBytesStatic<8>(const void* data);
+
+inline void* SegmentedPickle::ClaimBytes(size_t length) {
+  size_t data_len = bits::Align(length, sizeof(uint32_t));
+  WINBASE_DCHECK_GE(data_len, length);
+  WINBASE_DCHECK_LE(payload_size_,
+                    std::numeric_limits<uint32_t>::max() - data_len);
+  if (static_cast<size_t>(write_end_ - write_ptr_) < data_len)
+    StartSegment(data_len);
+
+  char* write = write_ptr_;
+  memset(write + length, 0, data_len - length);  // Always initialize padding
+  write_ptr_ += data_len;
+  segments_.back().size += data_len;
+  payload_size_ += data_len;
+  header_->payload_size = static_cast<uint32_t>(payload_size_);
+  return write;
+}
+
 }  // namespace winbase
\ No newline at end of file
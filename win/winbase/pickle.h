@@ -7,26 +7,43 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
+#include <limits>
+#include <memory>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include "winbase\base_export.h"
 #include "winbase\compiler_specific.h"
+#include "winbase\containers\span.h"
 #include "winbase\logging.h"
 #include "winbase\memory\ref_counted.h"
 #include "winbase\strings\string16.h"
 #include "winbase\strings\string_piece.h"
+#include "winbase\template_util.h"
 
 namespace winbase {
 
 class Pickle;
+class SegmentedPickle;
 
-// PickleIterator reads data from a Pickle. The Pickle object must remain valid
-// while the PickleIterator object is in use.
+// PickleIterator reads data from a Pickle or a SegmentedPickle. The pickle
+// object must remain valid while the PickleIterator object is in use.
 class WINBASE_EXPORT PickleIterator {
  public:
-  PickleIterator() : payload_(NULL), read_index_(0), end_index_(0) {}
+  PickleIterator()
+      : payload_(NULL),
+        read_index_(0),
+        end_index_(0),
+        segmented_(NULL),
+        next_segment_(0) {}
   explicit PickleIterator(const Pickle& pickle);
+  // Reads the segments of |pickle| in order. Pointers returned by ReadBytes()
+  // and the like point into the segment that holds the data, which for data
+  // written with SegmentedPickle::WriteExternalBytes() is the caller's memory.
+  explicit PickleIterator(const SegmentedPickle& pickle);
 
   // Methods for reading the payload of the Pickle. To read from the start of
   // the Pickle, create a PickleIterator from a Pickle. If successful, these
@@ -62,6 +79,31 @@ class WINBASE_EXPORT PickleIterator {
   // mutated). Do not keep the pointer around!
   bool ReadBytes(const char** data, int length) WARN_UNUSED_RESULT;
 
+  // Like ReadBytes(), but if the bytes are missing, or split between two
+  // segments of a SegmentedPickle, returns false without ending the iterator,
+  // so the data can still be read in smaller parts.
+  bool TryReadBytes(const char** data, int length) WARN_UNUSED_RESULT;
+
+  // Reads an array written with Pickle::WriteSpan(), checking the bounds once
+  // for the whole array. This version points |*result| into the message's
+  // buffer, like ReadBytes(), which requires that T be aligned like uint32_t
+  // at most; read arrays of 64-bit types into a std::vector instead.
+  template <typename T>
+  bool ReadSpan(span<const T>* result) WARN_UNUSED_RESULT;
+
+  // Copies an array written with Pickle::WriteSpan() into |*result|.
+  template <typename T>
+  bool ReadSpan(std::vector<T>* result) WARN_UNUSED_RESULT;
+
+  // Read integers written with Pickle::WriteVarUInt64() and WriteVarInt64().
+  bool ReadVarUInt64(uint64_t* result) WARN_UNUSED_RESULT;
+  bool ReadVarInt64(int64_t* result) WARN_UNUSED_RESULT;
+
+  // Read arrays written with Pickle::WriteVarUInt64Array() and
+  // WriteVarInt64Array().
+  bool ReadVarUInt64Array(std::vector<uint64_t>* result) WARN_UNUSED_RESULT;
+  bool ReadVarInt64Array(std::vector<int64_t>* result) WARN_UNUSED_RESULT;
+
   // A safer version of ReadInt() that checks for the result not being negative.
   // Use it for reading the object sizes.
   bool ReadLength(int* result) WARN_UNUSED_RESULT {
@@ -96,11 +138,56 @@ class WINBASE_EXPORT PickleIterator {
   const char* GetReadPointerAndAdvance(int num_elements,
                                        size_t size_element);
 
+  // Reads the element count of an array written with WriteSpan() into
+  // |*count|, and points |*data| to its elements.
+  bool ReadArray(size_t element_size, const char** data, int* count);
+
+  // Reads an array of variable-length integers of type T.
+  template <typename T>
+  bool ReadVarIntArray(std::vector<T>* result);
+
+  // Moves to the next segment that is not empty when reading a
+  // SegmentedPickle and the current segment is used up. Returns true if
+  // |num_bytes| fit in that segment.
+  bool NextSegment(size_t num_bytes);
+
   const char* payload_;  // Start of our pickle's payload.
   size_t read_index_;  // Offset of the next readable byte in payload.
   size_t end_index_;  // Payload size.
+  // When reading a SegmentedPickle, the pickle and the index of the segment
+  // after the one in |payload_|. Null otherwise, or after a read failed.
+  const SegmentedPickle* segmented_;
+  size_t next_segment_;
 };
 
+template <typename T>
+bool PickleIterator::ReadSpan(span<const T>* result) {
+  static_assert(is_trivially_copyable<T>::value,
+                "T must be trivially copyable");
+  static_assert(alignof(T) <= alignof(uint32_t),
+                "T is aligned more strictly than the payload");
+  const char* data;
+  int count;
+  if (!ReadArray(sizeof(T), &data, &count))
+    return false;
+  *result = span<const T>(reinterpret_cast<const T*>(data), count);
+  return true;
+}
+
+template <typename T>
+bool PickleIterator::ReadSpan(std::vector<T>* result) {
+  static_assert(is_trivially_copyable<T>::value,
+                "T must be trivially copyable");
+  const char* data;
+  int count;
+  if (!ReadArray(sizeof(T), &data, &count))
+    return false;
+  result->resize(count);
+  if (count)
+    memcpy(result->data(), data, count * sizeof(T));
+  return true;
+}
+
 // This class provides facilities for basic binary value packing and unpacking.
 //
 // The Pickle class supports appending primitive values (ints, strings, etc.)
@@ -202,6 +289,33 @@ class WINBASE_EXPORT Pickle {
   // known size. See also WriteData.
   void WriteBytes(const void* data, int length);
 
+  // Writes the number of elements of |values| followed by their bytes, which
+  // for arrays of numbers is much faster than writing them one by one. Read
+  // the array with PickleIterator::ReadSpan().
+  template <typename T, size_t N>
+  void WriteSpan(span<T, N> values) {
+    static_assert(is_trivially_copyable<T>::value,
+                  "T must be trivially copyable");
+    WINBASE_DCHECK_LE(values.size(),
+                      std::numeric_limits<int>::max() / sizeof(T));
+    WriteInt(static_cast<int>(values.size()));
+    if (!values.empty())
+      WriteBytes(values.data(), static_cast<int>(values.size_bytes()));
+  }
+
+  // Write an integer in as few bytes as its value needs, 7 bits per byte, so
+  // that values below 2^28 take 4 bytes with the padding of the field and
+  // those below 2^56 take 8. WriteVarInt64() maps small negative values to
+  // small encoded ones, so they are short as well.
+  void WriteVarUInt64(uint64_t value);
+  void WriteVarInt64(int64_t value);
+
+  // Write arrays of integers in the encoding of WriteVarUInt64() and
+  // WriteVarInt64(), without padding between the values, so that values
+  // below 128 take one byte each.
+  void WriteVarUInt64Array(span<const uint64_t> values);
+  void WriteVarInt64Array(span<const int64_t> values);
+
   // WriteAttachment appends |attachment| to the pickle. It returns
   // false iff the set is full or if the Pickle implementation does not support
   // attachments.
@@ -324,6 +438,132 @@ class WINBASE_EXPORT Pickle {
 
   inline void* ClaimUninitializedBytesInternal(size_t num_bytes);
   inline void WriteBytesCommon(const void* data, size_t length);
+
+  template <typename T>
+  void WriteVarIntArray(span<const T> values);
+};
+
+// A SegmentedPickle is written like a Pickle with the default header, but it
+// never reallocates what it has written: the data goes into a buffer supplied
+// by the caller, or into segments of a fixed size that are allocated as
+// needed. Large blobs can also be referenced instead of copied. This is meant
+// for large messages, which a Pickle would copy every time its buffer grows.
+//
+// Instead of one block of data, a SegmentedPickle hands out a gather list to
+// be sent with a vectored write. The receiver gets the same bytes that a
+// Pickle with the same writes would have, so it reads them with a Pickle.
+// A PickleIterator can also read a SegmentedPickle directly. A value never
+// spans two segments, so reads return pointers into the segments as usual.
+class WINBASE_EXPORT SegmentedPickle {
+ public:
+  // The size of the segments allocated by default.
+  static const size_t kDefaultSegmentSize;
+
+  // Blobs shorter than this are copied by WriteExternalBytes(), as copying
+  // them is cheaper than handling another piece of the gather list.
+  static const size_t kMinExternalBytes;
+
+  // Initializes a SegmentedPickle that allocates segments of |segment_size|
+  // bytes. A write that does not fit in a segment gets a segment of its own.
+  explicit SegmentedPickle(size_t segment_size = kDefaultSegmentSize);
+
+  // Initializes a SegmentedPickle that writes into |buffer| until it is full,
+  // and allocates segments of |segment_size| bytes after that. |buffer| must
+  // be 32bit-aligned, hold at least the header and stay valid while the
+  // pickle is in use.
+  SegmentedPickle(char* buffer,
+                  size_t buffer_size,
+                  size_t segment_size = kDefaultSegmentSize);
+
+  SegmentedPickle(const SegmentedPickle&) = delete;
+  SegmentedPickle& operator=(const SegmentedPickle&) = delete;
+  ~SegmentedPickle();
+
+  // Returns the number of bytes written in the pickle, including the header.
+  size_t size() const { return sizeof(Pickle::Header) + payload_size_; }
+
+  size_t payload_size() const { return payload_size_; }
+
+  // These append values in the same format as the methods of Pickle with the
+  // same name.
+  void WriteBool(bool value) { WriteInt(value ? 1 : 0); }
+  void WriteInt(int value) { WritePOD(value); }
+  void WriteLong(long value) { WritePOD(static_cast<int64_t>(value)); }
+  void WriteUInt16(uint16_t value) { WritePOD(value); }
+  void WriteUInt32(uint32_t value) { WritePOD(value); }
+  void WriteInt64(int64_t value) { WritePOD(value); }
+  void WriteUInt64(uint64_t value) { WritePOD(value); }
+  void WriteFloat(float value) { WritePOD(value); }
+  void WriteDouble(double value) { WritePOD(value); }
+  void WriteString(const StringPiece& value);
+  void WriteString16(const StringPiece16& value);
+  void WriteData(const char* data, int length);
+  void WriteBytes(const void* data, int length);
+  template <typename T, size_t N>
+  void WriteSpan(span<T, N> values) {
+    static_assert(is_trivially_copyable<T>::value,
+                  "T must be trivially copyable");
+    WINBASE_DCHECK_LE(values.size(),
+                      std::numeric_limits<int>::max() / sizeof(T));
+    WriteInt(static_cast<int>(values.size()));
+    if (!values.empty())
+      WriteBytes(values.data(), static_cast<int>(values.size_bytes()));
+  }
+  void WriteVarUInt64(uint64_t value);
+  void WriteVarInt64(int64_t value);
+  void WriteVarUInt64Array(span<const uint64_t> values);
+  void WriteVarInt64Array(span<const int64_t> values);
+
+  // Like WriteData() and WriteBytes(), but the pickle refers to |data|
+  // instead of copying it, unless it is shorter than kMinExternalBytes. The
+  // data must stay valid and unchanged while the pickle is in use.
+  void WriteExternalData(const char* data, int length);
+  void WriteExternalBytes(const void* data, int length);
+
+  // Returns the pieces of memory that make up the data of this pickle, in
+  // order, for a call like WSASend() or writev(). The pieces are valid until
+  // the next write.
+  std::vector<span<const char>> GetGatherList() const;
+
+ private:
+  friend class PickleIterator;
+
+  // A part of the payload. A value written to the pickle is always entirely
+  // in one segment.
+  struct Segment {
+    const char* data;
+    size_t size;
+    // The number of zero bytes that follow the data in the payload, for data
+    // that is not owned by the pickle and not a multiple of 32 bits long.
+    size_t padding;
+  };
+
+  // Starts writing to a new segment that holds at least |num_bytes| bytes.
+  void StartSegment(size_t num_bytes);
+
+  // Just like WriteBytes, but with a compile-time size, for performance.
+  template <size_t length>
+  void WINBASE_EXPORT WriteBytesStatic(const void* data);
+
+  template <typename T>
+  void WritePOD(const T& data) {
+    WriteBytesStatic<sizeof(data)>(&data);
+  }
+
+  inline void* ClaimBytes(size_t length);
+
+  template <typename T>
+  void WriteVarIntArray(span<const T> values);
+
+  Pickle::Header* header_;
+  // The last segment is the one being written to.
+  std::vector<Segment> segments_;
+  // The free space of the buffer being written to.
+  char* write_ptr_;
+  char* write_end_;
+  size_t payload_size_;
+  const size_t segment_size_;
+  std::vector<std::unique_ptr<char[]>> buffers_;
 };
 
 }  // namespace winbase
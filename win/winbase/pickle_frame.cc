@@ -0,0 +1,437 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "winbase\pickle_frame.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include "winbase\bits.h"
+#include "winbase\hash\crc32c.h"
+#include "winbase\logging.h"
+
+namespace winbase {
+
+namespace {
+
+// The compressor writes the LZ4 block format: a sequence of tokens, each with
+// a run of literal bytes followed by a match, a copy of earlier output. The
+// high 4 bits of the token are the number of literals and the low 4 bits the
+// length of the match minus kMinMatch; 15 means that bytes follow that add to
+// the length, until one that is not 255. The literals and then the offset of
+// the match, as 2 little-endian bytes, follow. The last token has literals
+// only.
+const size_t kMinMatch = 4;
+
+// The last kLastLiterals bytes are always literals, and the last match starts
+// at least kMatchStartLimit bytes before the end.
+const size_t kLastLiterals = 5;
+const size_t kMatchStartLimit = 12;
+
+const size_t kMaxOffset = 65535;
+
+// The compressor finds matches by hashing 4 bytes into a table of the
+// positions where they were last seen.
+const int kHashBits = 12;
+
+// Data is copied and checksummed in blocks of this size, which stay in the
+// cache in between.
+const size_t kChecksumBlockSize = 16 * 1024;
+
+// The buffer for the data of a frame holds up to kDataGrowthFactor times the
+// data that arrived so far, and at least kInitialDataCapacity bytes. Growing
+// by a large factor keeps the copies few.
+const size_t kInitialDataCapacity = 64 * 1024;
+const size_t kDataGrowthFactor = 8;
+
+// Compressed data decompresses to fewer than this many bytes per byte: at
+// most, every byte adds 255 to the length of a match.
+const uint64_t kMaxExpansion = 255;
+
+uint32_t Load32(const char* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint64_t Load64(const char* p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint32_t Hash(uint32_t value) {
+  return (value * 2654435761u) >> (32 - kHashBits);
+}
+
+size_t MaxCompressedSize(size_t size) {
+  return size + size / 255 + 16;
+}
+
+// The most bytes that WriteSequence() writes for |literal_length| literals
+// and a match of up to |match_length| bytes.
+size_t MaxSequenceSize(size_t literal_length, size_t match_length) {
+  return 1 + literal_length / 255 + 1 + literal_length + 2 +
+         match_length / 255 + 1;
+}
+
+// Copies |size| bytes from |from| to |to| and returns their checksum,
+// continuing from |crc|.
+uint32_t CopyWithChecksum(uint32_t crc,
+                          const char* from,
+                          size_t size,
+                          char* to) {
+  while (size) {
+    const size_t count = std::min(size, kChecksumBlockSize);
+    memcpy(to, from, count);
+    crc = Crc32c(crc, to, count);
+    from += count;
+    to += count;
+    size -= count;
+  }
+  return crc;
+}
+
+// Returns the number of bytes that |a| and |b| have in common, up to
+// |a_end|. |b| is before |a|.
+size_t MatchLength(const char* a, const char* b, const char* a_end) {
+  const char* start = a;
+  for (; a_end - a >= 8; a += 8, b += 8) {
+    uint64_t diff = Load64(a) ^ Load64(b);
+    // The bytes are little-endian, so the lowest set bit is in the first
+    // byte that differs.
+    if (diff)
+      return (a - start) + bits::CountTrailingZeroBits(diff) / 8;
+  }
+  while (a != a_end && *a == *b) {
+    ++a;
+    ++b;
+  }
+  return a - start;
+}
+
+// Writes the bytes that extend a length for which a 15 was stored.
+char* WriteLength(size_t length, char* out) {
+  for (; length >= 255; length -= 255)
+    *out++ = static_cast<char>(255);
+  *out++ = static_cast<char>(length);
+  return out;
+}
+
+// Writes a token with |literal_length| bytes at |literals| and a match of
+// |match_length| bytes, or none if it is 0. Returns the end of the output.
+char* WriteSequence(const char* literals,
+                    size_t literal_length,
+                    size_t offset,
+                    size_t match_length,
+                    char* out) {
+  char* token = out++;
+  uint8_t lengths;
+  if (literal_length >= 15) {
+    lengths = 15 << 4;
+    out = WriteLength(literal_length - 15, out);
+  } else {
+    lengths = static_cast<uint8_t>(literal_length << 4);
+  }
+  memcpy(out, literals, literal_length);
+  out += literal_length;
+
+  if (match_length) {
+    *out++ = static_cast<char>(offset & 0xFF);
+    *out++ = static_cast<char>(offset >> 8);
+    match_length -= kMinMatch;
+    if (match_length >= 15) {
+      lengths |= 15;
+      out = WriteLength(match_length - 15, out);
+    } else {
+      lengths |= static_cast<uint8_t>(match_length);
+    }
+  }
+  *token = static_cast<char>(lengths);
+  return out;
+}
+
+// Compresses |size| bytes at |input| into |output|, which has room for
+// MaxCompressedSize(size) bytes. Returns the size of the result, or 0 as soon
+// as it is clear that the result would not be smaller than the input.
+size_t CompressBlock(const char* input, size_t size, char* output) {
+  char* out = output;
+  const char* const out_limit = output + size;
+  const char* anchor = input;
+  if (size > kMatchStartLimit) {
+    uint32_t table[1 << kHashBits] = {};
+    const char* match_start_end = input + size - kMatchStartLimit;
+    const char* match_end = input + size - kLastLiterals;
+    const char* p = input;
+    while (p < match_start_end) {
+      const uint32_t bytes = Load32(p);
+      uint32_t* entry = &table[Hash(bytes)];
+      const char* match = input + *entry;
+      *entry = static_cast<uint32_t>(p - input);
+      if (match >= p || static_cast<size_t>(p - match) > kMaxOffset ||
+          Load32(match) != bytes) {
+        // Skip ahead faster the longer nothing matched, which keeps
+        // incompressible data fast.
+        p += 1 + ((p - anchor) >> 6);
+        continue;
+      }
+      while (p > anchor && match > input && p[-1] == match[-1]) {
+        --p;
+        --match;
+      }
+      const size_t length =
+          kMinMatch + MatchLength(p + kMinMatch, match + kMinMatch, match_end);
+      if (MaxSequenceSize(p - anchor, length) >=
+          static_cast<size_t>(out_limit - out)) {
+        return 0;
+      }
+      out = WriteSequence(anchor, p - anchor, p - match, length, out);
+      p += length;
+      anchor = p;
+      table[Hash(Load32(p - 2))] = static_cast<uint32_t>(p - 2 - input);
+    }
+  }
+  if (MaxSequenceSize(input + size - anchor, 0) >=
+      static_cast<size_t>(out_limit - out)) {
+    return 0;
+  }
+  out = WriteSequence(anchor, input + size - anchor, 0, 0, out);
+  return out - output;
+}
+
+// Reads the bytes that extend a length for which a 15 was stored. Returns
+// false if the input ends first or the length exceeds |max_length|.
+bool ReadLength(const uint8_t** in,
+                const uint8_t* in_end,
+                size_t max_length,
+                size_t* length) {
+  uint8_t byte;
+  do {
+    if (*in == in_end || *length > max_length)
+      return false;
+    byte = *(*in)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+// Decompresses |input_size| bytes at |input| into exactly |output_size|
+// bytes at |output|. Returns false if the input is not valid or does not
+// decompress to that size.
+bool DecompressBlock(const char* input,
+                     size_t input_size,
+                     char* output,
+                     size_t output_size) {
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(input);
+  const uint8_t* const in_end = in + input_size;
+  char* out = output;
+  char* const out_end = output + output_size;
+  while (in != in_end) {
+    const uint8_t token = *in++;
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 &&
+        !ReadLength(&in, in_end, output_size, &literal_length)) {
+      return false;
+    }
+    if (literal_length > static_cast<size_t>(in_end - in) ||
+        literal_length > static_cast<size_t>(out_end - out)) {
+      return false;
+    }
+    memcpy(out, in, literal_length);
+    in += literal_length;
+    out += literal_length;
+    // Only the last token has no match.
+    if (in == in_end)
+      break;
+
+    if (in_end - in < 2)
+      return false;
+    const size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    if (offset == 0 || offset > static_cast<size_t>(out - output))
+      return false;
+    size_t match_length = token & 15;
+    if (match_length == 15 &&
+        !ReadLength(&in, in_end, output_size, &match_length)) {
+      return false;
+    }
+    match_length += kMinMatch;
+    if (match_length > static_cast<size_t>(out_end - out))
+      return false;
+
+    // A match that overlaps the bytes it produces repeats with a period of
+    // |offset|; every copy doubles the bytes that can be copied at once.
+    const char* match = out - offset;
+    while (match_length) {
+      const size_t count =
+          std::min(match_length, static_cast<size_t>(out - match));
+      memcpy(out, match, count);
+      out += count;
+      match_length -= count;
+    }
+  }
+  return out == out_end;
+}
+
+}  // namespace
+
+void AppendPickleFrame(const Pickle& pickle,
+                       PickleFrameCompression compression,
+                       std::string* output) {
+  const char* pickle_data = static_cast<const char*>(pickle.data());
+  const size_t pickle_size = pickle.size();
+  const size_t frame_offset = output->size();
+
+  const bool compress = compression == PickleFrameCompression::kFast;
+  output->resize(frame_offset + kPickleFrameHeaderSize +
+                 (compress ? MaxCompressedSize(pickle_size) : pickle_size));
+  char* data = &(*output)[frame_offset + kPickleFrameHeaderSize];
+
+  uint32_t flags = 0;
+  size_t data_size = 0;
+  uint32_t checksum;
+  if (compress)
+    data_size = CompressBlock(pickle_data, pickle_size, data);
+  if (data_size) {
+    flags |= kPickleFrameCompressed;
+    checksum = Crc32c(0, data, data_size);
+  } else {
+    data_size = pickle_size;
+    checksum = CopyWithChecksum(0, pickle_data, pickle_size, data);
+  }
+  output->resize(frame_offset + kPickleFrameHeaderSize + data_size);
+
+  uint32_t header[6] = {
+      kPickleFrameMagic,
+      flags,
+      static_cast<uint32_t>(data_size),
+      static_cast<uint32_t>(pickle_size),
+      checksum,
+      0,
+  };
+  header[5] = Crc32c(0, header, 5 * sizeof(uint32_t));
+  memcpy(&(*output)[frame_offset], header, sizeof(header));
+}
+
+PickleFrameReader::PickleFrameReader()
+    : state_(State::kHeader),
+      header_bytes_(0),
+      flags_(0),
+      data_size_(0),
+      pickle_size_(0),
+      data_checksum_(0),
+      data_capacity_(0),
+      data_bytes_(0),
+      checksum_(0) {}
+
+PickleFrameReader::~PickleFrameReader() = default;
+
+bool PickleFrameReader::Feed(StringPiece chunk) {
+  if (state_ == State::kHeader) {
+    const size_t count =
+        std::min(chunk.size(), kPickleFrameHeaderSize - header_bytes_);
+    memcpy(header_ + header_bytes_, chunk.data(), count);
+    header_bytes_ += count;
+    chunk.remove_prefix(count);
+    if (header_bytes_ == kPickleFrameHeaderSize)
+      state_ = ReadHeader() ? State::kData : State::kFailed;
+  }
+  if (state_ == State::kData) {
+    const size_t count = std::min(chunk.size(), data_size_ - data_bytes_);
+    if (data_bytes_ + count > data_capacity_)
+      GrowData(data_bytes_ + count);
+    checksum_ = CopyWithChecksum(checksum_, chunk.data(), count,
+                                 data_.get() + data_bytes_);
+    data_bytes_ += count;
+    chunk.remove_prefix(count);
+    if (data_bytes_ == data_size_)
+      state_ = ReadData() ? State::kDone : State::kFailed;
+  }
+  if (!chunk.empty())
+    state_ = State::kFailed;
+  return state_ != State::kFailed;
+}
+
+bool PickleFrameReader::Finish() {
+  if (state_ != State::kDone)
+    state_ = State::kFailed;
+  return state_ == State::kDone;
+}
+
+bool PickleFrameReader::ReadHeader() {
+  uint32_t header[6];
+  memcpy(header, header_, sizeof(header));
+  if (header[0] != kPickleFrameMagic ||
+      header[5] != Crc32c(0, header, 5 * sizeof(uint32_t))) {
+    return false;
+  }
+  flags_ = header[1];
+  data_size_ = header[2];
+  pickle_size_ = header[3];
+  data_checksum_ = header[4];
+
+  if (flags_ & ~kPickleFrameCompressed)
+    return false;
+  // The size of a Pickle is an int.
+  if (pickle_size_ < sizeof(Pickle::Header) ||
+      pickle_size_ > static_cast<uint32_t>(std::numeric_limits<int>::max())) {
+    return false;
+  }
+  // Pickles are only compressed when that makes them smaller. The size of
+  // the pickle is only allocated once the data arrived, so it must be within
+  // reach of the data.
+  if (flags_ & kPickleFrameCompressed) {
+    if (data_size_ == 0 || data_size_ >= pickle_size_ ||
+        pickle_size_ > data_size_ * kMaxExpansion) {
+      return false;
+    }
+  } else if (data_size_ != pickle_size_) {
+    return false;
+  }
+  return true;
+}
+
+bool PickleFrameReader::ReadData() {
+  if (checksum_ != data_checksum_)
+    return false;
+  const char* pickle_data = data_.get();
+  if (flags_ & kPickleFrameCompressed) {
+    decompressed_.reset(new char[pickle_size_]);
+    if (!DecompressBlock(data_.get(), data_size_, decompressed_.get(),
+                         pickle_size_)) {
+      return false;
+    }
+    data_.reset();
+    pickle_data = decompressed_.get();
+  }
+  pickle_.reset(new Pickle(pickle_data, static_cast<int>(pickle_size_)));
+  // Pickle does not use data with an inconsistent header.
+  if (!pickle_->data()) {
+    pickle_.reset();
+    return false;
+  }
+  return true;
+}
+
+void PickleFrameReader::GrowData(size_t size) {
+  // Multiplying first could overflow on 32-bit builds, where the data size
+  // may be up to INT_MAX.
+  const size_t data_size = data_size_;
+  const size_t capacity =
+      size > data_size / kDataGrowthFactor
+          ? data_size
+          : std::min(std::max(size * kDataGrowthFactor, kInitialDataCapacity),
+                     data_size);
+  WINBASE_CHECK_GE(capacity, size);
+  std::unique_ptr<char[]> data(new char[capacity]);
+  if (data_bytes_)
+    memcpy(data.get(), data_.get(), data_bytes_);
+  data_ = std::move(data);
+  data_capacity_ = capacity;
+}
+
+}  // namespace winbase
@@ -0,0 +1,134 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Frames for storing pickles in files or sending them to other processes. A
+// frame holds the bytes of a pickle, optionally compressed, behind a header
+// with checksums, so that corrupt or truncated data is rejected before any of
+// it is read:
+//
+//   std::string frame;
+//   AppendPickleFrame(pickle, PickleFrameCompression::kFast, &frame);
+//   ...
+//   PickleFrameReader reader;
+//   while (ReadChunk(&chunk)) {
+//     if (!reader.Feed(chunk))
+//       return false;
+//   }
+//   if (!reader.Finish())
+//     return false;
+//   PickleIterator iter(*reader.pickle());
+//
+// The header is made of six little-endian uint32 values:
+//
+//   magic           kPickleFrameMagic
+//   flags           kPickleFrameCompressed if the data is compressed
+//   data size       the number of bytes that follow the header
+//   pickle size     the size of the pickle, once decompressed
+//   data checksum   the CRC-32C of the bytes that follow the header
+//   header checksum the CRC-32C of the five values above
+//
+// Compressed data is in the LZ4 block format.
+
+#ifndef WINLIB_WINBASE_PICKLE_FRAME_H_
+#define WINLIB_WINBASE_PICKLE_FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+#include "winbase\base_export.h"
+#include "winbase\pickle.h"
+#include "winbase\strings\string_piece.h"
+
+namespace winbase {
+
+// "PKF1", read as a little-endian uint32.
+const uint32_t kPickleFrameMagic = 0x31464B50;
+const uint32_t kPickleFrameCompressed = 1 << 0;
+const size_t kPickleFrameHeaderSize = 6 * sizeof(uint32_t);
+
+enum class PickleFrameCompression {
+  kNone,
+  // Compresses the pickle with a fast LZ77 compressor, unless that does not
+  // make it smaller.
+  kFast,
+};
+
+// Appends a frame holding |pickle| to |output|.
+WINBASE_EXPORT void AppendPickleFrame(const Pickle& pickle,
+                                      PickleFrameCompression compression,
+                                      std::string* output);
+
+// Reads a frame that arrives in pieces. Call Feed() for every piece in order,
+// then Finish(). Each piece is checked and copied as it arrives, so the frame
+// does not need to be kept in memory in addition to the pickle. Memory for the
+// data is allocated as it arrives rather than as the header claims, so a
+// frame cannot make the reader allocate much more than was fed.
+class WINBASE_EXPORT PickleFrameReader {
+ public:
+  PickleFrameReader();
+  PickleFrameReader(const PickleFrameReader&) = delete;
+  PickleFrameReader& operator=(const PickleFrameReader&) = delete;
+  ~PickleFrameReader();
+
+  // Reads |chunk|, the next piece of the frame. Returns false once the frame
+  // is known to be invalid, including when data follows its end; all further
+  // calls then return false as well.
+  bool Feed(StringPiece chunk);
+
+  // Signals the end of the frame. Returns true if the input fed so far is a
+  // complete, valid frame.
+  bool Finish();
+
+  // Returns the pickle once all of a valid frame was fed, or nullptr. The
+  // pickle refers to memory owned by the reader.
+  const Pickle* pickle() const { return pickle_.get(); }
+
+ private:
+  enum class State {
+    kHeader,
+    kData,
+    kDone,
+    kFailed,
+  };
+
+  // Checks the header once all of it was fed. Returns false if it is
+  // invalid.
+  bool ReadHeader();
+
+  // Checks and decompresses the data once all of it was fed. Returns false if
+  // it is invalid.
+  bool ReadData();
+
+  // Grows |data_| to hold at least |size| bytes.
+  void GrowData(size_t size);
+
+  State state_;
+
+  char header_[kPickleFrameHeaderSize];
+  size_t header_bytes_;
+
+  uint32_t flags_;
+  uint32_t data_size_;
+  uint32_t pickle_size_;
+  uint32_t data_checksum_;
+
+  // The data that follows the header, and the checksum of what was fed of it
+  // so far.
+  std::unique_ptr<char[]> data_;
+  size_t data_capacity_;
+  size_t data_bytes_;
+  uint32_t checksum_;
+
+  // The decompressed pickle, if the data is compressed.
+  std::unique_ptr<char[]> decompressed_;
+
+  std::unique_ptr<Pickle> pickle_;
+};
+
+}  // namespace winbase
+
+#endif  // WINLIB_WINBASE_PICKLE_FRAME_H_
@@ -0,0 +1,476 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Generated Pickle serialization for structs that list their fields once:
+//
+//   struct Bounds {
+//     int x;
+//     int y;
+//     int width;
+//     int height;
+//     std::string title;
+//
+//     using PickleFields = winbase::PickleFields<&Bounds::x, &Bounds::y,
+//                                                &Bounds::width,
+//                                                &Bounds::height,
+//                                                &Bounds::title>;
+//   };
+//
+//   WriteToPickle(bounds, &pickle);
+//   ...
+//   if (!ReadFromPickle(&iter, &bounds))
+//     return false;
+//
+// A type that cannot declare PickleFields itself gets a specialization of
+// PickleSchema instead:
+//
+//   template <>
+//   struct winbase::PickleSchema<Bounds> {
+//     using Fields = PickleFields<&Bounds::x, ...>;
+//   };
+//
+// The fields are written in the order of the list, in the format of the
+// Pickle method for their type, so the result is what the equivalent
+// sequence of Write calls produces and can be read either way:
+//
+//   bool                     WriteBool()
+//   int, uint16_t, uint32_t  WriteInt(), WriteUInt16(), WriteUInt32()
+//   int64_t, uint64_t        WriteInt64(), WriteUInt64()
+//   float, double            WriteFloat(), WriteDouble()
+//   std::string, string16    WriteString(), WriteString16()
+//   std::vector of numbers   WriteSpan()
+//   other std::vectors       WriteInt() with the size, then each element
+//   types with a schema      their fields, in place
+//
+// Consecutive fields of the fixed-size types in the first four rows are
+// written with one WriteBytes() call and read with one TryReadBytes() call, so
+// the bounds are checked once for all of them. When they also follow each
+// other in memory the way they do in the pickle, like |x| to |height| above,
+// they are copied with a single memcpy. Such a run may span two segments of a
+// SegmentedPickle if its fields were written one by one; it is then read one
+// field at a time.
+
+#ifndef WINLIB_WINBASE_PICKLE_SCHEMA_H_
+#define WINLIB_WINBASE_PICKLE_SCHEMA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <array>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "winbase\compiler_specific.h"
+#include "winbase\containers\span.h"
+#include "winbase\pickle.h"
+#include "winbase\strings\string16.h"
+#include "winbase\template_util.h"
+
+namespace winbase {
+
+// The list of fields of a struct, as pointers to its data members.
+template <auto... Members>
+struct PickleFields {};
+
+// Names the PickleFields of T as |Fields|. By default these are the ones that
+// T declares as T::PickleFields.
+template <typename T, typename = void>
+struct PickleSchema {};
+
+template <typename T>
+struct PickleSchema<T, void_t<typename T::PickleFields>> {
+  using Fields = typename T::PickleFields;
+};
+
+namespace internal {
+
+template <typename T, typename = void>
+struct HasPickleSchema : std::false_type {};
+
+template <typename T>
+struct HasPickleSchema<T, void_t<typename PickleSchema<T>::Fields>>
+    : std::true_type {};
+
+template <typename MemberPointer>
+struct PickleMemberTraits;
+
+template <typename Class, typename Field>
+struct PickleMemberTraits<Field Class::*> {
+  using FieldType = Field;
+};
+
+// The encoding of a field of type T. Types of a fixed size have
+// |kWireSize|, the size they take in the pickle, and |kSameInMemory|, true
+// if their bytes are copied as they are. They are written into a buffer with
+// Store() and read from it with Load(). The other types write themselves with
+// Write() and read with Read().
+template <typename T, typename = void>
+struct PickleFieldTraits {
+  static constexpr bool kFixedSize = false;
+  static constexpr bool kSupported = false;
+};
+
+// Numbers of 4 or 8 bytes, which are stored without padding.
+template <typename T>
+struct PickleFieldTraits<
+    T,
+    std::enable_if_t<std::is_same<T, int>::value ||
+                     std::is_same<T, uint32_t>::value ||
+                     std::is_same<T, int64_t>::value ||
+                     std::is_same<T, uint64_t>::value ||
+                     std::is_same<T, float>::value ||
+                     std::is_same<T, double>::value>> {
+  static constexpr bool kFixedSize = true;
+  static constexpr bool kSupported = true;
+  static constexpr size_t kWireSize = sizeof(T);
+  static constexpr bool kSameInMemory = true;
+
+  static void Store(const T& value, char* out) {
+    memcpy(out, &value, sizeof(T));
+  }
+  static void Load(const char* in, T* value) { memcpy(value, in, sizeof(T)); }
+};
+
+template <>
+struct PickleFieldTraits<bool> {
+  static constexpr bool kFixedSize = true;
+  static constexpr bool kSupported = true;
+  static constexpr size_t kWireSize = sizeof(int);
+  static constexpr bool kSameInMemory = false;
+
+  static void Store(bool value, char* out) {
+    int as_int = value ? 1 : 0;
+    memcpy(out, &as_int, sizeof(int));
+  }
+  // PickleIterator::ReadBool() looks at the first byte only.
+  static void Load(const char* in, bool* value) { *value = in[0] != 0; }
+};
+
+template <>
+struct PickleFieldTraits<uint16_t> {
+  static constexpr bool kFixedSize = true;
+  static constexpr bool kSupported = true;
+  static constexpr size_t kWireSize = sizeof(uint32_t);
+  static constexpr bool kSameInMemory = false;
+
+  static void Store(uint16_t value, char* out) {
+    memcpy(out, &value, sizeof(value));
+    memset(out + sizeof(value), 0, kWireSize - sizeof(value));
+  }
+  static void Load(const char* in, uint16_t* value) {
+    memcpy(value, in, sizeof(*value));
+  }
+};
+
+template <>
+struct PickleFieldTraits<std::string> {
+  static constexpr bool kFixedSize = false;
+  static constexpr bool kSupported = true;
+
+  template <typename Writer>
+  static void Write(const std::string& value, Writer* writer) {
+    writer->WriteString(value);
+  }
+  static bool Read(PickleIterator* iter, std::string* value) {
+    return iter->ReadString(value);
+  }
+};
+
+template <>
+struct PickleFieldTraits<string16> {
+  static constexpr bool kFixedSize = false;
+  static constexpr bool kSupported = true;
+
+  template <typename Writer>
+  static void Write(const string16& value, Writer* writer) {
+    writer->WriteString16(value);
+  }
+  static bool Read(PickleIterator* iter, string16* value) {
+    return iter->ReadString16(value);
+  }
+};
+
+template <typename T>
+struct PickleSchemaImpl;
+
+template <typename T>
+struct PickleFieldTraits<T, std::enable_if_t<HasPickleSchema<T>::value>> {
+  static constexpr bool kFixedSize = false;
+  static constexpr bool kSupported = true;
+
+  template <typename Writer>
+  static void Write(const T& value, Writer* writer) {
+    PickleSchemaImpl<typename PickleSchema<T>::Fields>::Write(value, writer);
+  }
+  static bool Read(PickleIterator* iter, T* value) {
+    return PickleSchemaImpl<typename PickleSchema<T>::Fields>::Read(iter,
+                                                                    value);
+  }
+};
+
+// Returns true for the types that are stored in the pickle as they are in
+// memory.
+template <typename T>
+constexpr bool IsPickleNumber() {
+  if constexpr (PickleFieldTraits<T>::kFixedSize)
+    return PickleFieldTraits<T>::kSameInMemory;
+  else
+    return false;
+}
+
+template <typename T>
+struct PickleFieldTraits<std::vector<T>> {
+  static_assert(PickleFieldTraits<T>::kSupported,
+                "The element type has no Pickle encoding");
+
+  // Vectors of numbers are copied at once.
+  static constexpr bool kAsSpan = IsPickleNumber<T>();
+  static constexpr bool kFixedSize = false;
+  static constexpr bool kSupported = true;
+
+  template <typename Writer>
+  static void Write(const std::vector<T>& value, Writer* writer) {
+    if constexpr (kAsSpan) {
+      writer->WriteSpan(make_span(value));
+    } else {
+      writer->WriteInt(static_cast<int>(value.size()));
+      for (const T& element : value)
+        WriteElement(element, writer);
+    }
+  }
+
+  static bool Read(PickleIterator* iter, std::vector<T>* value) {
+    if constexpr (kAsSpan) {
+      return iter->ReadSpan(value);
+    } else {
+      int size;
+      if (!iter->ReadLength(&size))
+        return false;
+      // The size is not trusted for reserving memory; reading stops at the
+      // end of the pickle.
+      value->clear();
+      for (int i = 0; i < size; ++i) {
+        T element;
+        if (!ReadElement(iter, &element))
+          return false;
+        value->push_back(std::move(element));
+      }
+      return true;
+    }
+  }
+
+ private:
+  template <typename Writer>
+  static void WriteElement(const T& element, Writer* writer) {
+    if constexpr (PickleFieldTraits<T>::kFixedSize) {
+      char buffer[PickleFieldTraits<T>::kWireSize];
+      PickleFieldTraits<T>::Store(element, buffer);
+      writer->WriteBytes(buffer, static_cast<int>(sizeof(buffer)));
+    } else {
+      PickleFieldTraits<T>::Write(element, writer);
+    }
+  }
+
+  static bool ReadElement(PickleIterator* iter, T* element) {
+    if constexpr (PickleFieldTraits<T>::kFixedSize) {
+      const char* data;
+      if (!iter->ReadBytes(&data, PickleFieldTraits<T>::kWireSize))
+        return false;
+      PickleFieldTraits<T>::Load(data, element);
+      return true;
+    } else {
+      return PickleFieldTraits<T>::Read(iter, element);
+    }
+  }
+};
+
+// Writes and reads the fields listed in PickleFields<Members...>. Runs of
+// fixed-size fields are handled together; the other fields one at a time.
+template <auto... Members>
+struct PickleSchemaImpl<PickleFields<Members...>> {
+  template <size_t I>
+  using FieldType = typename PickleMemberTraits<std::tuple_element_t<
+      I,
+      std::tuple<decltype(Members)...>>>::FieldType;
+
+  template <size_t I>
+  using Traits = PickleFieldTraits<FieldType<I>>;
+
+  static constexpr size_t kNumFields = sizeof...(Members);
+
+  static_assert(
+      (PickleFieldTraits<
+           typename PickleMemberTraits<decltype(Members)>::FieldType>::
+           kSupported &&
+       ...),
+      "A field type has no Pickle encoding");
+
+  static constexpr bool kFixedSize[] = {
+      PickleFieldTraits<typename PickleMemberTraits<
+          decltype(Members)>::FieldType>::kFixedSize...,
+      false};
+
+  // Returns the index of the first field at |begin| or after it that does
+  // not have a fixed size.
+  static constexpr size_t RunEnd(size_t begin) {
+    while (begin < kNumFields && kFixedSize[begin])
+      ++begin;
+    return begin;
+  }
+
+  template <size_t I, typename T>
+  static const FieldType<I>& Field(const T& value) {
+    return value.*std::get<I>(std::make_tuple(Members...));
+  }
+
+  template <size_t I, typename T>
+  static FieldType<I>& Field(T* value) {
+    return value->*std::get<I>(std::make_tuple(Members...));
+  }
+
+  // The offset of every field of the run starting at |Begin| within its
+  // bytes in the pickle, and the size of the run at the end.
+  template <size_t Begin, size_t... K>
+  static constexpr std::array<size_t, sizeof...(K) + 1> RunOffsets(
+      std::index_sequence<K...>) {
+    constexpr size_t kSizes[] = {Traits<Begin + K>::kWireSize...};
+    std::array<size_t, sizeof...(K) + 1> offsets = {};
+    for (size_t i = 0; i < sizeof...(K); ++i)
+      offsets[i + 1] = offsets[i] + kSizes[i];
+    return offsets;
+  }
+
+  // Returns true if the fields of the run starting at |Begin| are laid out in
+  // |value| exactly as in the pickle. Only the constant offsets of the fields
+  // are compared, so this folds to a constant.
+  template <size_t Begin, size_t... K, typename T>
+  static bool RunIsSameInMemory(const T& value, std::index_sequence<K...>) {
+    if constexpr ((Traits<Begin + K>::kSameInMemory && ...)) {
+      constexpr auto kOffsets = RunOffsets<Begin>(std::index_sequence<K...>());
+      const char* base = reinterpret_cast<const char*>(&Field<Begin>(value));
+      return ((reinterpret_cast<const char*>(&Field<Begin + K>(value)) -
+                   base ==
+               static_cast<ptrdiff_t>(kOffsets[K])) &&
+              ...);
+    } else {
+      return false;
+    }
+  }
+
+  template <size_t Begin, size_t... K, typename T, typename Writer>
+  static void WriteRun(const T& value,
+                       Writer* writer,
+                       std::index_sequence<K...> run) {
+    constexpr auto kOffsets = RunOffsets<Begin>(run);
+    constexpr size_t kRunSize = kOffsets[sizeof...(K)];
+    if (RunIsSameInMemory<Begin>(value, run)) {
+      writer->WriteBytes(&Field<Begin>(value), static_cast<int>(kRunSize));
+      return;
+    }
+    char buffer[kRunSize];
+    (Traits<Begin + K>::Store(Field<Begin + K>(value), buffer + kOffsets[K]),
+     ...);
+    writer->WriteBytes(buffer, static_cast<int>(kRunSize));
+  }
+
+  template <size_t Begin, size_t... K, typename T>
+  static bool ReadRun(PickleIterator* iter,
+                      T* value,
+                      std::index_sequence<K...> run) {
+    constexpr auto kOffsets = RunOffsets<Begin>(run);
+    constexpr size_t kRunSize = kOffsets[sizeof...(K)];
+    const char* data;
+    if (!iter->TryReadBytes(&data, kRunSize))
+      return ReadRunFields<Begin>(iter, value, run);
+    if (RunIsSameInMemory<Begin>(*value, run)) {
+      memcpy(&Field<Begin>(value), data, kRunSize);
+      return true;
+    }
+    (Traits<Begin + K>::Load(data + kOffsets[K], &Field<Begin + K>(value)),
+     ...);
+    return true;
+  }
+
+  // Reads the run starting at |Begin| one field at a time, when it is not in
+  // one piece. This is rare, so it is kept out of ReadRun().
+  template <size_t Begin, size_t... K, typename T>
+  static NOINLINE bool ReadRunFields(PickleIterator* iter,
+                                     T* value,
+                                     std::index_sequence<K...>) {
+    return (ReadField<Begin + K>(iter, value) && ...);
+  }
+
+  template <size_t I, typename T>
+  static bool ReadField(PickleIterator* iter, T* value) {
+    const char* data;
+    if (!iter->ReadBytes(&data, Traits<I>::kWireSize))
+      return false;
+    Traits<I>::Load(data, &Field<I>(value));
+    return true;
+  }
+
+  template <size_t I = 0, typename T, typename Writer>
+  static void Write(const T& value, Writer* writer) {
+    if constexpr (I < kNumFields) {
+      if constexpr (kFixedSize[I]) {
+        constexpr size_t kEnd = RunEnd(I);
+        WriteRun<I>(value, writer, std::make_index_sequence<kEnd - I>());
+        Write<kEnd>(value, writer);
+      } else {
+        Traits<I>::Write(Field<I>(value), writer);
+        Write<I + 1>(value, writer);
+      }
+    }
+  }
+
+  template <size_t I = 0, typename T>
+  static bool Read(PickleIterator* iter, T* value) {
+    if constexpr (I < kNumFields) {
+      if constexpr (kFixedSize[I]) {
+        constexpr size_t kEnd = RunEnd(I);
+        return ReadRun<I>(iter, value, std::make_index_sequence<kEnd - I>()) &&
+               Read<kEnd>(iter, value);
+      } else {
+        return Traits<I>::Read(iter, &Field<I>(value)) &&
+               Read<I + 1>(iter, value);
+      }
+    } else {
+      return true;
+    }
+  }
+};
+
+}  // namespace internal
+
+// Appends the fields of |value| to |pickle|, which is a Pickle or a
+// SegmentedPickle.
+template <typename T, typename Writer>
+void WriteToPickle(const T& value, Writer* pickle) {
+  static_assert(internal::HasPickleSchema<T>::value,
+                "T must declare its PickleFields");
+  internal::PickleSchemaImpl<typename PickleSchema<T>::Fields>::Write(value,
+                                                                      pickle);
+}
+
+// Reads the fields of |*value| from |iter|. Returns false if the pickle ends
+// before all fields are read, in which case some of them may have been
+// changed.
+template <typename T>
+bool ReadFromPickle(PickleIterator* iter, T* value) WARN_UNUSED_RESULT;
+
+template <typename T>
+bool ReadFromPickle(PickleIterator* iter, T* value) {
+  static_assert(internal::HasPickleSchema<T>::value,
+                "T must declare its PickleFields");
+  return internal::PickleSchemaImpl<typename PickleSchema<T>::Fields>::Read(
+      iter, value);
+}
+
+}  // namespace winbase
+
+#endif  // WINLIB_WINBASE_PICKLE_SCHEMA_H_
@@ -28,10 +28,10 @@ SystemMetrics SystemMetrics::Sample() {
 }
 
 std::unique_ptr<Value> SystemMetrics::ToValue() const {
-  std::unique_ptr<DictionaryValue> res(new DictionaryValue());
-
-  res->SetInteger("committed_memory", static_cast<int>(committed_memory_));
-  return std::move(res);
+  std::unique_ptr<Value> res =
+      std::make_unique<Value>(Value::Type::DICTIONARY);
+  res->SetKey("committed_memory", Value(static_cast<int>(committed_memory_)));
+  return res;
 }
 
 std::unique_ptr<ProcessMetrics> ProcessMetrics::CreateCurrentProcessMetrics() {
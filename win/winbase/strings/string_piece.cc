@@ -6,11 +6,20 @@
 #include "winbase\strings\string_piece.h"
 
 #include <limits.h>
+#include <string.h>
 
 #include <algorithm>
 #include <ostream>
 
 ///#include "winbase\logging.h"
+#include "winbase\bits.h"
+#include "winbase\compiler_specific.h"
+#include "winbase\cpu.h"
+#include "winlib\build_config.h"
+
+#if defined(ARCH_CPU_X86_FAMILY)
+#include <immintrin.h>
+#endif
 
 namespace winbase {
 namespace {
@@ -32,6 +41,238 @@ inline void BuildLookupTable(const StringPiece& characters_wanted,
   }
 }
 
+// Substring searchers. Each returns the position of the first instance of
+// |needle| in |haystack|, or |haystack_length| if there is none. |needle| has
+// at least two characters. The SIMD variants compare the first and the last
+// character of |needle| at 16 or 32 bytes worth of positions per step, and
+// compare the rest only where both match. They finish the tail with the scalar
+// variant, so all of them return the same result.
+template <typename Char>
+size_t SearchScalar(const Char* haystack,
+                    size_t haystack_length,
+                    const Char* needle,
+                    size_t needle_length) {
+  return std::search(haystack, haystack + haystack_length, needle,
+                     needle + needle_length) -
+         haystack;
+}
+
+#if defined(ARCH_CPU_X86_FAMILY)
+
+ALWAYS_INLINE __m128i SplatSSE2(char c) {
+  return _mm_set1_epi8(c);
+}
+
+ALWAYS_INLINE __m128i SplatSSE2(char16 c) {
+  return _mm_set1_epi16(static_cast<short>(c));
+}
+
+ALWAYS_INLINE __m128i CompareLanesSSE2(__m128i a, __m128i b, char) {
+  return _mm_cmpeq_epi8(a, b);
+}
+
+ALWAYS_INLINE __m128i CompareLanesSSE2(__m128i a, __m128i b, char16) {
+  return _mm_cmpeq_epi16(a, b);
+}
+
+ALWAYS_INLINE __m256i SplatAVX2(char c) {
+  return _mm256_set1_epi8(c);
+}
+
+ALWAYS_INLINE __m256i SplatAVX2(char16 c) {
+  return _mm256_set1_epi16(static_cast<short>(c));
+}
+
+ALWAYS_INLINE __m256i CompareLanesAVX2(__m256i a, __m256i b, char) {
+  return _mm256_cmpeq_epi8(a, b);
+}
+
+ALWAYS_INLINE __m256i CompareLanesAVX2(__m256i a, __m256i b, char16) {
+  return _mm256_cmpeq_epi16(a, b);
+}
+
+// Keeps one bit of a byte mask per lane.
+ALWAYS_INLINE uint32_t LaneBits(uint32_t mask, char) {
+  return mask;
+}
+
+ALWAYS_INLINE uint32_t LaneBits(uint32_t mask, char16) {
+  return mask & 0x55555555;
+}
+
+template <typename Char>
+size_t SearchSSE2(const Char* haystack,
+                  size_t haystack_length,
+                  const Char* needle,
+                  size_t needle_length) {
+  const size_t kCharsPerChunk = sizeof(__m128i) / sizeof(Char);
+  const __m128i first = SplatSSE2(needle[0]);
+  const __m128i last = SplatSSE2(needle[needle_length - 1]);
+  size_t i = 0;
+  // The needles starting in a chunk end in the chunk |needle_length| - 1
+  // characters further.
+  for (; haystack_length - i >= kCharsPerChunk + needle_length - 1;
+       i += kCharsPerChunk) {
+    const Char* p = haystack + i;
+    __m128i starts = CompareLanesSSE2(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), first, Char());
+    __m128i ends = CompareLanesSSE2(
+        _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(p + needle_length - 1)),
+        last, Char());
+    uint32_t candidates = LaneBits(
+        static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(starts, ends))),
+        Char());
+    for (; candidates; candidates &= candidates - 1) {
+      const Char* candidate =
+          p + bits::CountTrailingZeroBits(candidates) / sizeof(Char);
+      if (!memcmp(candidate + 1, needle + 1,
+                  (needle_length - 2) * sizeof(Char))) {
+        return candidate - haystack;
+      }
+    }
+  }
+  return i + SearchScalar(haystack + i, haystack_length - i, needle,
+                          needle_length);
+}
+
+template <typename Char>
+size_t SearchAVX2(const Char* haystack,
+                  size_t haystack_length,
+                  const Char* needle,
+                  size_t needle_length) {
+  const size_t kCharsPerChunk = sizeof(__m256i) / sizeof(Char);
+  const __m256i first = SplatAVX2(needle[0]);
+  const __m256i last = SplatAVX2(needle[needle_length - 1]);
+  size_t i = 0;
+  for (; haystack_length - i >= kCharsPerChunk + needle_length - 1;
+       i += kCharsPerChunk) {
+    const Char* p = haystack + i;
+    __m256i starts = CompareLanesAVX2(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), first,
+        Char());
+    __m256i ends = CompareLanesAVX2(
+        _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(p + needle_length - 1)),
+        last, Char());
+    uint32_t candidates = LaneBits(static_cast<uint32_t>(_mm256_movemask_epi8(
+                                       _mm256_and_si256(starts, ends))),
+                                   Char());
+    for (; candidates; candidates &= candidates - 1) {
+      const Char* candidate =
+          p + bits::CountTrailingZeroBits(candidates) / sizeof(Char);
+      if (!memcmp(candidate + 1, needle + 1,
+                  (needle_length - 2) * sizeof(Char))) {
+        return candidate - haystack;
+      }
+    }
+  }
+  return i + SearchSSE2(haystack + i, haystack_length - i, needle,
+                        needle_length);
+}
+
+#endif  // defined(ARCH_CPU_X86_FAMILY)
+
+// Character finders. Each returns the position of the first |c| in |text|, or
+// |length| if there is none.
+template <typename Char>
+size_t FindCharScalar(const Char* text, size_t length, Char c) {
+  return std::find(text, text + length, c) - text;
+}
+
+#if defined(ARCH_CPU_X86_FAMILY)
+
+template <typename Char>
+size_t FindCharSSE2(const Char* text, size_t length, Char c) {
+  const size_t kCharsPerChunk = sizeof(__m128i) / sizeof(Char);
+  const __m128i wanted = SplatSSE2(c);
+  size_t i = 0;
+  for (; length - i >= kCharsPerChunk; i += kCharsPerChunk) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+    uint32_t hits = LaneBits(static_cast<uint32_t>(_mm_movemask_epi8(
+                                 CompareLanesSSE2(chunk, wanted, Char()))),
+                             Char());
+    if (hits)
+      return i + bits::CountTrailingZeroBits(hits) / sizeof(Char);
+  }
+  return i + FindCharScalar(text + i, length - i, c);
+}
+
+template <typename Char>
+size_t FindCharAVX2(const Char* text, size_t length, Char c) {
+  const size_t kCharsPerChunk = sizeof(__m256i) / sizeof(Char);
+  const __m256i wanted = SplatAVX2(c);
+  size_t i = 0;
+  for (; length - i >= kCharsPerChunk; i += kCharsPerChunk) {
+    __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+    uint32_t hits = LaneBits(static_cast<uint32_t>(_mm256_movemask_epi8(
+                                 CompareLanesAVX2(chunk, wanted, Char()))),
+                             Char());
+    if (hits)
+      return i + bits::CountTrailingZeroBits(hits) / sizeof(Char);
+  }
+  return i + FindCharSSE2(text + i, length - i, c);
+}
+
+#endif  // defined(ARCH_CPU_X86_FAMILY)
+
+struct StringSearchers {
+  size_t (*search_chars)(const char* haystack,
+                         size_t haystack_length,
+                         const char* needle,
+                         size_t needle_length);
+  size_t (*search_char16s)(const char16* haystack,
+                           size_t haystack_length,
+                           const char16* needle,
+                           size_t needle_length);
+
+  size_t Search(const char* haystack,
+                size_t haystack_length,
+                const char* needle,
+                size_t needle_length) const {
+    return search_chars(haystack, haystack_length, needle, needle_length);
+  }
+  size_t Search(const char16* haystack,
+                size_t haystack_length,
+                const char16* needle,
+                size_t needle_length) const {
+    return search_char16s(haystack, haystack_length, needle, needle_length);
+  }
+
+  size_t (*find_char)(const char* text, size_t length, char c);
+  size_t (*find_char16)(const char16* text, size_t length, char16 c);
+
+  size_t Find(const char* text, size_t length, char c) const {
+    return find_char(text, length, c);
+  }
+  size_t Find(const char16* text, size_t length, char16 c) const {
+    return find_char16(text, length, c);
+  }
+};
+
+StringSearchers SelectStringSearchers() {
+#if defined(ARCH_CPU_X86_FAMILY)
+  CPU cpu;
+  if (cpu.has_avx2()) {
+    return {&SearchAVX2<char>, &SearchAVX2<char16>, &FindCharAVX2<char>,
+            &FindCharAVX2<char16>};
+  }
+  if (cpu.has_sse2()) {
+    return {&SearchSSE2<char>, &SearchSSE2<char16>, &FindCharSSE2<char>,
+            &FindCharSSE2<char16>};
+  }
+#endif
+  return {&SearchScalar<char>, &SearchScalar<char16>, &FindCharScalar<char>,
+          &FindCharScalar<char16>};
+}
+
+// The CPU is only queried once.
+const StringSearchers& GetStringSearchers() {
+  static const StringSearchers searchers = SelectStringSearchers();
+  return searchers;
+}
+
 }  // namespace
 
 // MSVC doesn't like complex extern templates and DLLs.
@@ -110,10 +351,15 @@ size_t findT(const BasicStringPiece<STR>& self,
   if (pos > self.size())
     return BasicStringPiece<STR>::npos;
 
-  typename BasicStringPiece<STR>::const_iterator result =
-      std::search(self.begin() + pos, self.end(), s.begin(), s.end());
-  const size_t xpos =
-    static_cast<size_t>(result - self.begin());
+  size_t xpos;
+  if (s.size() < 2) {
+    typename BasicStringPiece<STR>::const_iterator result =
+        std::search(self.begin() + pos, self.end(), s.begin(), s.end());
+    xpos = static_cast<size_t>(result - self.begin());
+  } else {
+    xpos = pos + GetStringSearchers().Search(
+                     self.data() + pos, self.size() - pos, s.data(), s.size());
+  }
   return xpos + s.size() <= self.size() ? xpos : BasicStringPiece<STR>::npos;
 }
 
@@ -132,10 +378,13 @@ size_t findT(const BasicStringPiece<STR>& self,
   if (pos >= self.size())
     return BasicStringPiece<STR>::npos;
 
-  typename BasicStringPiece<STR>::const_iterator result =
-      std::find(self.begin() + pos, self.end(), c);
-  return result != self.end() ?
-      static_cast<size_t>(result - self.begin()) : BasicStringPiece<STR>::npos;
+  const typename STR::value_type* text = self.data() + pos;
+  size_t length = self.size() - pos;
+  // Short stretches are not worth the dispatch.
+  size_t xpos = pos + (length * sizeof(c) <= 32
+                           ? FindCharScalar(text, length, c)
+                           : GetStringSearchers().Find(text, length, c));
+  return xpos != self.size() ? xpos : BasicStringPiece<STR>::npos;
 }
 
 size_t find(const StringPiece& self, char c, size_t pos) {
@@ -101,6 +101,40 @@ static std::vector<OutputStringType> SplitStringT(
   return result;
 }
 
+// One step of SplitStringT(), for the lazy ranges. The separators are looked
+// at on every step, so that the ranges don't need to be templates on them.
+template <typename Str>
+bool NextSplitPieceT(BasicStringPiece<Str> input,
+                     BasicStringPiece<Str> separators,
+                     WhitespaceHandling whitespace,
+                     SplitResult result_type,
+                     size_t* start,
+                     BasicStringPiece<Str>* piece) {
+  while (*start != Str::npos) {
+    size_t end = separators.size() == 1
+                     ? FindFirstOf(input, separators[0], *start)
+                     : FindFirstOf(input, separators, *start);
+
+    BasicStringPiece<Str> current;
+    if (end == Str::npos) {
+      current = input.substr(*start);
+      *start = Str::npos;
+    } else {
+      current = input.substr(*start, end - *start);
+      *start = end + 1;
+    }
+
+    if (whitespace == TRIM_WHITESPACE)
+      current = TrimString(current, WhitespaceForType<Str>(), TRIM_ALL);
+
+    if (result_type == SPLIT_WANT_ALL || !current.empty()) {
+      *piece = current;
+      return true;
+    }
+  }
+  return false;
+}
+
 bool AppendStringKeyValue(StringPiece input,
                           char delimiter,
                           StringPairs* result) {
@@ -205,6 +239,30 @@ std::vector<StringPiece16> SplitStringPiece(StringPiece16 input,
       input, separators, whitespace, result_type);
 }
 
+namespace internal {
+
+bool NextSplitPiece(StringPiece input,
+                    StringPiece separators,
+                    WhitespaceHandling whitespace,
+                    SplitResult result_type,
+                    size_t* start,
+                    StringPiece* piece) {
+  return NextSplitPieceT(input, separators, whitespace, result_type, start,
+                         piece);
+}
+
+bool NextSplitPiece(StringPiece16 input,
+                    StringPiece16 separators,
+                    WhitespaceHandling whitespace,
+                    SplitResult result_type,
+                    size_t* start,
+                    StringPiece16* piece) {
+  return NextSplitPieceT(input, separators, whitespace, result_type, start,
+                         piece);
+}
+
+}  // namespace internal
+
 bool SplitStringIntoKeyValuePairs(StringPiece input,
                                   char key_value_delimiter,
                                   char key_value_pair_delimiter,
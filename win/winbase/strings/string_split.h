@@ -5,6 +5,9 @@
 #ifndef WINLIB_WINBASE_STRINGS_STRING_SPLIT_H_
 #define WINLIB_WINBASE_STRINGS_STRING_SPLIT_H_
 
+#include <stddef.h>
+
+#include <iterator>
 #include <string>
 #include <utility>
 #include <vector>
@@ -77,6 +80,123 @@ WINBASE_EXPORT std::vector<StringPiece16> SplitStringPiece(
     WhitespaceHandling whitespace,
     SplitResult result_type);
 
+namespace internal {
+
+// Finds the next result of splitting |input| as SplitStringPiece() does,
+// starting the search at |*start|. Returns false if there is none. Otherwise
+// sets |piece| to it, and |*start| to where the search for the one after it
+// starts, which is npos once the end of |input| is reached.
+WINBASE_EXPORT bool NextSplitPiece(StringPiece input,
+                                   StringPiece separators,
+                                   WhitespaceHandling whitespace,
+                                   SplitResult result_type,
+                                   size_t* start,
+                                   StringPiece* piece);
+WINBASE_EXPORT bool NextSplitPiece(StringPiece16 input,
+                                   StringPiece16 separators,
+                                   WhitespaceHandling whitespace,
+                                   SplitResult result_type,
+                                   size_t* start,
+                                   StringPiece16* piece);
+
+}  // namespace internal
+
+// Like SplitStringPiece, except that the results are found one at a time as
+// the range is iterated instead of all up front, and nothing is allocated.
+// Stopping early leaves the rest of the input unscanned, which makes this the
+// better choice when only the first few results are needed:
+//
+//   for (StringPiece field : winbase::SplitStringPieceRange(
+//            line, ",", winbase::TRIM_WHITESPACE, winbase::SPLIT_WANT_ALL)) {
+//     if (++index > 3)
+//       break;
+//     ...
+//
+// As with SplitStringPiece, the input and the separators must outlive the
+// range and its iterators.
+template <typename STRING_TYPE>
+class BasicSplitStringPieceRange {
+ public:
+  typedef BasicStringPiece<STRING_TYPE> Piece;
+
+  class const_iterator {
+   public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef Piece value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const Piece* pointer;
+    typedef const Piece& reference;
+
+    // The end iterator.
+    const_iterator() : range_(nullptr), start_(Piece::npos), done_(true) {}
+
+    reference operator*() const { return piece_; }
+    pointer operator->() const { return &piece_; }
+
+    const_iterator& operator++() {
+      Advance();
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator previous = *this;
+      Advance();
+      return previous;
+    }
+
+    // |start_| grows with every result, so it tells them apart.
+    bool operator==(const const_iterator& other) const {
+      return done_ == other.done_ && (done_ || start_ == other.start_);
+    }
+    bool operator!=(const const_iterator& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    friend class BasicSplitStringPieceRange;
+
+    explicit const_iterator(const BasicSplitStringPieceRange* range)
+        : range_(range),
+          start_(range->input_.empty() ? Piece::npos : 0),
+          done_(false) {
+      Advance();
+    }
+
+    void Advance() {
+      done_ = !internal::NextSplitPiece(range_->input_, range_->separators_,
+                                        range_->whitespace_,
+                                        range_->result_type_, &start_,
+                                        &piece_);
+    }
+
+    const BasicSplitStringPieceRange* range_;
+    Piece piece_;
+    size_t start_;
+    bool done_;
+  };
+  typedef const_iterator iterator;
+
+  BasicSplitStringPieceRange(Piece input,
+                             Piece separators,
+                             WhitespaceHandling whitespace,
+                             SplitResult result_type)
+      : input_(input),
+        separators_(separators),
+        whitespace_(whitespace),
+        result_type_(result_type) {}
+
+  const_iterator begin() const { return const_iterator(this); }
+  const_iterator end() const { return const_iterator(); }
+
+ private:
+  Piece input_;
+  Piece separators_;
+  WhitespaceHandling whitespace_;
+  SplitResult result_type_;
+};
+
+using SplitStringPieceRange = BasicSplitStringPieceRange<std::string>;
+using SplitStringPieceRange16 = BasicSplitStringPieceRange<string16>;
+
 using StringPairs = std::vector<std::pair<std::string, std::string>>;
 
 // Splits |line| into key value pairs according to the given delimiters and
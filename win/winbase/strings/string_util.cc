@@ -18,16 +18,25 @@
 
 #include <algorithm>
 #include <limits>
+#include <type_traits>
 #include <vector>
 
-///#include "winbase\logging.h"
+#include "winbase\bits.h"
+#include "winbase\compiler_specific.h"
+#include "winbase\cpu.h"
+#include "winbase\logging.h"
 #include "winbase\macros.h"
 #include "winbase\memory\singleton.h"
+#include "winbase\strings\substring_set_matcher.h"
 #include "winbase\strings\utf_string_conversion_utils.h"
 #include "winbase\strings\utf_string_conversions.h"
 #include "winbase\third_party\icu\icu_utf.h"
 #include "winlib\build_config.h"
 
+#if defined(ARCH_CPU_X86_FAMILY)
+#include <immintrin.h>
+#endif
+
 namespace winbase {
 
 namespace {
@@ -146,40 +155,402 @@ bool IsWprintfFormatPortable(const wchar_t* format) {
 
 namespace {
 
-template<typename StringType>
-StringType ToLowerASCIIImpl(BasicStringPiece<StringType> str) {
-  StringType ret;
-  ret.reserve(str.size());
-  for (size_t i = 0; i < str.size(); i++)
-    ret.push_back(ToLowerASCII(str[i]));
-  return ret;
+// ASCII case kernels. Case mapping flips the 0x20 bit of the letters from
+// |first_letter| ('A' or 'a') to 26 letters on; a mismatch is the index of the
+// first characters that differ once lowercased. The SSE2 variants handle 16
+// bytes per step, and leave the tails to the machine word variants, which
+// also handle the input on other CPUs.
+
+// Returns |value| repeated in every Char-sized lane of a machine word.
+template <typename Char>
+constexpr MachineWord RepeatInLanes(MachineWord value) {
+  return ~MachineWord(0) / ((MachineWord(1) << (8 * sizeof(Char))) - 1) *
+         value;
+}
+
+// Returns a word with the top bit set in the lanes of |word| that hold one of
+// the 26 letters from |first_letter| on.
+template <typename Char>
+MachineWord FindLettersInWord(MachineWord word, Char first_letter) {
+  const MachineWord top_bits =
+      RepeatInLanes<Char>(MachineWord(1) << (8 * sizeof(Char) - 1));
+  // Adding to the low bits of a lane sets its top bit when they reach the
+  // bound, and never carries into the next lane.
+  const MachineWord low_bits = word & ~top_bits;
+  const MachineWord non_ascii =
+      word | (low_bits + (top_bits - RepeatInLanes<Char>(0x80)));
+  const MachineWord from_first =
+      low_bits + (top_bits - RepeatInLanes<Char>(first_letter));
+  const MachineWord past_last =
+      low_bits + (top_bits - RepeatInLanes<Char>(first_letter + 26));
+  return from_first & ~past_last & ~non_ascii & top_bits;
+}
+
+// Loads the |size| bytes at |p|, fewer than a machine word, into the low bytes
+// of a word. Two overlapping loads avoid the stall of loading a word that
+// memcpy() just wrote a byte at a time.
+inline MachineWord LoadPartialWord(const void* p, size_t size) {
+  const char* bytes = static_cast<const char*>(p);
+  if (sizeof(MachineWord) == 8 && size >= 4) {
+    uint32_t low, high;
+    memcpy(&low, bytes, sizeof(low));
+    memcpy(&high, bytes + size - 4, sizeof(high));
+    return low | (static_cast<MachineWord>(high) << (8 * (size - 4)));
+  }
+  if (size >= 2) {
+    uint16_t low, high;
+    memcpy(&low, bytes, sizeof(low));
+    memcpy(&high, bytes + size - 2, sizeof(high));
+    return low | (static_cast<MachineWord>(high) << (8 * (size - 2)));
+  }
+  return size ? static_cast<uint8_t>(*bytes) : 0;
+}
+
+// Stores the low |size| bytes of |word|, fewer than a machine word, at |p|.
+inline void StorePartialWord(void* p, size_t size, MachineWord word) {
+  char* bytes = static_cast<char*>(p);
+  if (sizeof(MachineWord) == 8 && size >= 4) {
+    uint32_t low = static_cast<uint32_t>(word);
+    uint32_t high = static_cast<uint32_t>(word >> (8 * (size - 4)));
+    memcpy(bytes, &low, sizeof(low));
+    memcpy(bytes + size - 4, &high, sizeof(high));
+  } else if (size >= 2) {
+    uint16_t low = static_cast<uint16_t>(word);
+    uint16_t high = static_cast<uint16_t>(word >> (8 * (size - 2)));
+    memcpy(bytes, &low, sizeof(low));
+    memcpy(bytes + size - 2, &high, sizeof(high));
+  } else if (size) {
+    *bytes = static_cast<char>(word);
+  }
+}
+
+// Moves the top bit of every lane to the 0x20 bit.
+template <typename Char>
+MachineWord TopBitsToCaseBits(MachineWord top_bits) {
+  return top_bits >> (8 * sizeof(Char) - 6);
+}
+
+template <typename Char>
+void ConvertCaseASCIIWords(const Char* src,
+                           size_t length,
+                           Char* dest,
+                           Char first_letter) {
+  const size_t kCharsPerWord = sizeof(MachineWord) / sizeof(Char);
+  size_t i = 0;
+  for (; length - i >= kCharsPerWord; i += kCharsPerWord) {
+    MachineWord word;
+    memcpy(&word, src + i, sizeof(word));
+    word ^= TopBitsToCaseBits<Char>(FindLettersInWord(word, first_letter));
+    memcpy(dest + i, &word, sizeof(word));
+  }
+  // The tail is done as one zero-padded word too; short strings are common.
+  if (i < length) {
+    const size_t tail_size = (length - i) * sizeof(Char);
+    MachineWord word = LoadPartialWord(src + i, tail_size);
+    word ^= TopBitsToCaseBits<Char>(FindLettersInWord(word, first_letter));
+    StorePartialWord(dest + i, tail_size, word);
+  }
+}
+
+// Returns the bits that differ between |word_a| and |word_b| once lowercased,
+// or once |word_a| is if not |kLowerB|.
+template <bool kLowerB, typename Char>
+MachineWord CaseMismatchInWords(MachineWord word_a, MachineWord word_b) {
+  word_a ^= TopBitsToCaseBits<Char>(FindLettersInWord(word_a, Char('A')));
+  if (kLowerB)
+    word_b ^= TopBitsToCaseBits<Char>(FindLettersInWord(word_b, Char('A')));
+  // Windows is little-endian, so the first character is the lowest.
+  return word_a ^ word_b;
+}
+
+// Finds the first mismatch between |a| and |b|, lowercasing |b| too if
+// |kLowerB|. Otherwise |b| is compared as is, which is how
+// LowerCaseEqualsASCII() treats its previously-lowercased argument.
+template <bool kLowerB, typename Char, typename BChar>
+size_t FindCaseMismatchASCIIChars(const Char* a,
+                                  const BChar* b,
+                                  size_t length) {
+  size_t i = 0;
+  for (; i < length; ++i) {
+    if (ToLowerASCII(a[i]) != (kLowerB ? ToLowerASCII(b[i]) : b[i]))
+      break;
+  }
+  return i;
+}
+
+// Like FindCaseMismatchASCIIChars(), a machine word at a time.
+template <bool kLowerB, typename Char, typename BChar>
+size_t FindCaseMismatchASCIIWords(const Char* a,
+                                  const BChar* b,
+                                  size_t length) {
+  // Mixed widths are compared a character at a time.
+  if constexpr (std::is_same<Char, BChar>::value) {
+    size_t i = 0;
+    const size_t kCharsPerWord = sizeof(MachineWord) / sizeof(Char);
+    for (; length - i >= kCharsPerWord; i += kCharsPerWord) {
+      MachineWord word_a, word_b;
+      memcpy(&word_a, a + i, sizeof(word_a));
+      memcpy(&word_b, b + i, sizeof(word_b));
+      if (MachineWord diff = CaseMismatchInWords<kLowerB, Char>(word_a, word_b))
+        return i + bits::CountTrailingZeroBits(diff) / (8 * sizeof(Char));
+    }
+    // Zero-padded words differ only where the characters do.
+    if (i < length) {
+      const size_t tail_size = (length - i) * sizeof(Char);
+      MachineWord word_a = LoadPartialWord(a + i, tail_size);
+      MachineWord word_b = LoadPartialWord(b + i, tail_size);
+      if (MachineWord diff = CaseMismatchInWords<kLowerB, Char>(word_a, word_b))
+        return i + bits::CountTrailingZeroBits(diff) / (8 * sizeof(Char));
+    }
+    return length;
+  }
+  return FindCaseMismatchASCIIChars<kLowerB>(a, b, length);
 }
 
-template<typename StringType>
-StringType ToUpperASCIIImpl(BasicStringPiece<StringType> str) {
+#if defined(ARCH_CPU_X86_FAMILY)
+
+// Returns 0x20 in the lanes of |chunk| that hold one of the 26 letters from
+// |first_letter| on. Shifted so that |first_letter| is the smallest signed
+// value, they are the only values less than it plus 26.
+ALWAYS_INLINE __m128i FindCaseBitsSSE2(__m128i chunk, char first_letter) {
+  const __m128i shifted = _mm_add_epi8(
+      chunk, _mm_set1_epi8(static_cast<char>(0x80 - first_letter)));
+  const __m128i letters = _mm_cmplt_epi8(
+      shifted, _mm_set1_epi8(static_cast<char>(0x80 + 26)));
+  return _mm_and_si128(letters, _mm_set1_epi8(0x20));
+}
+
+ALWAYS_INLINE __m128i FindCaseBitsSSE2(__m128i chunk, char16 first_letter) {
+  const __m128i shifted = _mm_add_epi16(
+      chunk, _mm_set1_epi16(static_cast<short>(0x8000 - first_letter)));
+  const __m128i letters = _mm_cmplt_epi16(
+      shifted, _mm_set1_epi16(static_cast<short>(0x8000 + 26)));
+  return _mm_and_si128(letters, _mm_set1_epi16(0x20));
+}
+
+template <typename Char>
+ALWAYS_INLINE __m128i LoadLanesSSE2(const Char* p, Char) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+// Loads 8 ASCII bytes into char16 lanes.
+ALWAYS_INLINE __m128i LoadLanesSSE2(const char* p, char16) {
+  return _mm_unpacklo_epi8(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+      _mm_setzero_si128());
+}
+
+template <typename Char>
+void ConvertCaseASCIISSE2(const Char* src,
+                          size_t length,
+                          Char* dest,
+                          Char first_letter) {
+  const size_t kCharsPerChunk = sizeof(__m128i) / sizeof(Char);
+  size_t i = 0;
+  for (; length - i >= kCharsPerChunk; i += kCharsPerChunk) {
+    __m128i chunk = LoadLanesSSE2(src + i, Char());
+    __m128i case_bits = FindCaseBitsSSE2(chunk, first_letter);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i),
+                     _mm_xor_si128(chunk, case_bits));
+  }
+  ConvertCaseASCIIWords(src + i, length - i, dest + i, first_letter);
+}
+
+template <bool kLowerB, typename Char, typename BChar>
+size_t FindCaseMismatchASCIISSE2(const Char* a,
+                                 const BChar* b,
+                                 size_t length) {
+  const size_t kCharsPerChunk = sizeof(__m128i) / sizeof(Char);
+  size_t i = 0;
+  for (; length - i >= kCharsPerChunk; i += kCharsPerChunk) {
+    __m128i chunk_a = LoadLanesSSE2(a + i, Char());
+    __m128i chunk_b = LoadLanesSSE2(b + i, Char());
+    chunk_a = _mm_xor_si128(chunk_a, FindCaseBitsSSE2(chunk_a, Char('A')));
+    if (kLowerB)
+      chunk_b = _mm_xor_si128(chunk_b, FindCaseBitsSSE2(chunk_b, Char('A')));
+    // Lanes are equal if all of their bytes are.
+    uint32_t diff = ~static_cast<uint32_t>(
+                        _mm_movemask_epi8(_mm_cmpeq_epi8(chunk_a, chunk_b))) &
+                    0xFFFF;
+    if (diff)
+      return i + bits::CountTrailingZeroBits(diff) / sizeof(Char);
+  }
+  return i + FindCaseMismatchASCIIWords<kLowerB>(a + i, b + i, length - i);
+}
+
+#endif  // defined(ARCH_CPU_X86_FAMILY)
+
+struct CaseKernels {
+  void (*convert_chars)(const char* src,
+                        size_t length,
+                        char* dest,
+                        char first_letter);
+  void (*convert_char16s)(const char16* src,
+                          size_t length,
+                          char16* dest,
+                          char16 first_letter);
+  size_t (*mismatch_chars)(const char* a, const char* b, size_t length);
+  size_t (*mismatch_char16s)(const char16* a, const char16* b, size_t length);
+  size_t (*lower_mismatch_chars)(const char* str,
+                                 const char* lowercase_ascii,
+                                 size_t length);
+  size_t (*lower_mismatch_char16s)(const char16* str,
+                                   const char* lowercase_ascii,
+                                   size_t length);
+
+  void ConvertCase(const char* src,
+                   size_t length,
+                   char* dest,
+                   char first_letter) const {
+    convert_chars(src, length, dest, first_letter);
+  }
+  void ConvertCase(const char16* src,
+                   size_t length,
+                   char16* dest,
+                   char16 first_letter) const {
+    convert_char16s(src, length, dest, first_letter);
+  }
+  size_t FindMismatch(const char* a, const char* b, size_t length) const {
+    return mismatch_chars(a, b, length);
+  }
+  size_t FindMismatch(const char16* a, const char16* b, size_t length) const {
+    return mismatch_char16s(a, b, length);
+  }
+  size_t FindLowerMismatch(const char* str,
+                           const char* lowercase_ascii,
+                           size_t length) const {
+    return lower_mismatch_chars(str, lowercase_ascii, length);
+  }
+  size_t FindLowerMismatch(const char16* str,
+                           const char* lowercase_ascii,
+                           size_t length) const {
+    return lower_mismatch_char16s(str, lowercase_ascii, length);
+  }
+};
+
+CaseKernels SelectCaseKernels() {
+#if defined(ARCH_CPU_X86_FAMILY)
+  if (CPU().has_sse2()) {
+    return {&ConvertCaseASCIISSE2<char>,
+            &ConvertCaseASCIISSE2<char16>,
+            &FindCaseMismatchASCIISSE2<true, char, char>,
+            &FindCaseMismatchASCIISSE2<true, char16, char16>,
+            &FindCaseMismatchASCIISSE2<false, char, char>,
+            &FindCaseMismatchASCIISSE2<false, char16, char>};
+  }
+#endif
+  return {&ConvertCaseASCIIWords<char>,
+          &ConvertCaseASCIIWords<char16>,
+          &FindCaseMismatchASCIIWords<true, char, char>,
+          &FindCaseMismatchASCIIWords<true, char16, char16>,
+          &FindCaseMismatchASCIIWords<false, char, char>,
+          &FindCaseMismatchASCIIWords<false, char16, char>};
+}
+
+// The CPU is only queried once.
+const CaseKernels& GetCaseKernels() {
+  static const CaseKernels kernels = SelectCaseKernels();
+  return kernels;
+}
+
+// Strings shorter than a SIMD chunk, like most header and key names, skip the
+// dispatch. They are compared a character at a time: comparisons usually stop
+// within a few characters, sooner than words can be set up.
+const size_t kCaseChunkSize = 16;
+
+template <typename Char>
+void ConvertCaseASCII(const Char* src,
+                      size_t length,
+                      Char* dest,
+                      Char first_letter) {
+  if (length * sizeof(Char) < kCaseChunkSize)
+    ConvertCaseASCIIWords(src, length, dest, first_letter);
+  else
+    GetCaseKernels().ConvertCase(src, length, dest, first_letter);
+}
+
+template <typename Char>
+size_t FindCaseMismatchASCII(const Char* a, const Char* b, size_t length) {
+  if (length * sizeof(Char) < kCaseChunkSize)
+    return FindCaseMismatchASCIIChars<true>(a, b, length);
+  return GetCaseKernels().FindMismatch(a, b, length);
+}
+
+template <typename Char>
+size_t FindLowerCaseMismatchASCII(const Char* str,
+                                  const char* lowercase_ascii,
+                                  size_t length) {
+  if (length * sizeof(Char) < kCaseChunkSize)
+    return FindCaseMismatchASCIIChars<false>(str, lowercase_ascii, length);
+  return GetCaseKernels().FindLowerMismatch(str, lowercase_ascii, length);
+}
+
+template <typename StringType>
+StringType ConvertCaseASCIIImpl(BasicStringPiece<StringType> str,
+                                typename StringType::value_type first_letter) {
   StringType ret;
-  ret.reserve(str.size());
-  for (size_t i = 0; i < str.size(); i++)
-    ret.push_back(ToUpperASCII(str[i]));
+  ret.resize(str.size());
+  // It is OK to call operator[] on an empty string.
+  ConvertCaseASCII(str.data(), str.size(), &ret[0], first_letter);
   return ret;
 }
 
+template <typename StringType>
+void ConvertCaseASCIIInPlace(StringType* str,
+                             typename StringType::value_type first_letter) {
+  // It is OK to call operator[] on an empty string.
+  auto* data = &(*str)[0];
+  ConvertCaseASCII(data, str->size(), data, first_letter);
+}
+
 }  // namespace
 
 std::string ToLowerASCII(StringPiece str) {
-  return ToLowerASCIIImpl<std::string>(str);
+  return ConvertCaseASCIIImpl<std::string>(str, 'A');
 }
 
 string16 ToLowerASCII(StringPiece16 str) {
-  return ToLowerASCIIImpl<string16>(str);
+  return ConvertCaseASCIIImpl<string16>(str, 'A');
 }
 
 std::string ToUpperASCII(StringPiece str) {
-  return ToUpperASCIIImpl<std::string>(str);
+  return ConvertCaseASCIIImpl<std::string>(str, 'a');
 }
 
 string16 ToUpperASCII(StringPiece16 str) {
-  return ToUpperASCIIImpl<string16>(str);
+  return ConvertCaseASCIIImpl<string16>(str, 'a');
+}
+
+void ToLowerASCII(StringPiece str, char* output) {
+  ConvertCaseASCII(str.data(), str.size(), output, 'A');
+}
+
+void ToLowerASCII(StringPiece16 str, char16* output) {
+  ConvertCaseASCII(str.data(), str.size(), output, char16('A'));
+}
+
+void ToUpperASCII(StringPiece str, char* output) {
+  ConvertCaseASCII(str.data(), str.size(), output, 'a');
+}
+
+void ToUpperASCII(StringPiece16 str, char16* output) {
+  ConvertCaseASCII(str.data(), str.size(), output, char16('a'));
+}
+
+void ToLowerASCIIInPlace(std::string* str) {
+  ConvertCaseASCIIInPlace(str, 'A');
+}
+
+void ToLowerASCIIInPlace(string16* str) {
+  ConvertCaseASCIIInPlace(str, 'A');
+}
+
+void ToUpperASCIIInPlace(std::string* str) {
+  ConvertCaseASCIIInPlace(str, 'a');
+}
+
+void ToUpperASCIIInPlace(string16* str) {
+  ConvertCaseASCIIInPlace(str, 'a');
 }
 
 template<class StringType>
@@ -188,15 +559,12 @@ int CompareCaseInsensitiveASCIIT(BasicStringPiece<StringType> a,
   // Find the first characters that aren't equal and compare them.  If the end
   // of one of the strings is found before a nonequal character, the lengths
   // of the strings are compared.
-  size_t i = 0;
-  while (i < a.length() && i < b.length()) {
+  size_t length = std::min(a.length(), b.length());
+  size_t i = FindCaseMismatchASCII(a.data(), b.data(), length);
+  if (i < length) {
     typename StringType::value_type lower_a = ToLowerASCII(a[i]);
     typename StringType::value_type lower_b = ToLowerASCII(b[i]);
-    if (lower_a < lower_b)
-      return -1;
-    if (lower_a > lower_b)
-      return 1;
-    i++;
+    return lower_a < lower_b ? -1 : 1;
   }
 
   // End of one string hit before finding a different character. Expect the
@@ -497,16 +865,281 @@ bool IsStringASCII(StringPiece16 str) {
   return DoIsStringASCII(str.data(), str.length());
 }
 
+namespace {
+
+// UTF-8 prefix validators. Each returns the length of a prefix of [begin,
+// begin + length) that is valid for IsStringUTF8() and ends at a character
+// boundary. They check 16 or 32 bytes at a time and stop at the first block
+// that has an error, a noncharacter or a byte sequence that might be one, so
+// that IsStringUTF8() decodes that part one code point at a time and gives
+// the exact same result.
+typedef size_t (*UTF8PrefixValidator)(const char* begin, size_t length);
+
+// Returns |end| moved back to the lead byte of the sequence that is cut off
+// there, if any. The bytes before |end| are valid UTF-8 apart from that
+// sequence.
+size_t BackUpToCharacterBoundary(const char* begin, size_t end) {
+  for (size_t back = 1; back <= 3 && back <= end; ++back) {
+    const uint8_t byte = static_cast<uint8_t>(begin[end - back]);
+    if (byte < 0x80)
+      break;
+    if (byte >= 0xC0) {
+      const size_t sequence_length = byte >= 0xF0 ? 4 : byte >= 0xE0 ? 3 : 2;
+      if (sequence_length > back)
+        end -= back;
+      break;
+    }
+  }
+  return end;
+}
+
+#if defined(ARCH_CPU_X86_FAMILY)
+
+// The validators use the lookup algorithm of John Keiser and Daniel Lemire,
+// "Validating UTF-8 In Less Than One Instruction Per Byte". Three table
+// lookups on the high and low nibbles of each byte and the high nibble of the
+// byte after it give the errors that the pair may be part of, one per bit;
+// only a pair with a bit set in all three is an error.
+const uint8_t kTooShort = 1 << 0;   // A lead not followed by a continuation.
+const uint8_t kTooLong = 1 << 1;    // ASCII followed by a continuation.
+const uint8_t kOverlong3 = 1 << 2;  // 11100000 100_____
+const uint8_t kTooLarge = 1 << 3;   // Above U+10FFFF.
+const uint8_t kSurrogate = 1 << 4;  // 11101101 101_____
+const uint8_t kOverlong2 = 1 << 5;  // 1100000_ 10______
+const uint8_t kTooLarge1000 = 1 << 6;  // 11110101+ 1000____
+const uint8_t kOverlong4 = 1 << 6;  // 11110000 1000____
+// Two continuations, which is an error unless a 3 or 4-byte lead precedes
+// them.
+const uint8_t kTwoConts = 1 << 7;
+const uint8_t kCarry = kTooShort | kTooLong | kTwoConts;
+
+// Indexed by the high nibble of the first byte.
+const uint8_t kByte1High[16] = {
+    kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong,
+    kTooLong, kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+    kTooShort | kOverlong2, kTooShort, kTooShort | kOverlong3 | kSurrogate,
+    kTooShort | kTooLarge | kTooLarge1000 | kOverlong4,
+};
+
+// Indexed by the low nibble of the first byte.
+const uint8_t kByte1Low[16] = {
+    kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+    kCarry | kOverlong2,
+    kCarry,
+    kCarry,
+    kCarry | kTooLarge,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+};
+
+// Indexed by the high nibble of the second byte.
+const uint8_t kByte2High[16] = {
+    kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort,
+    kTooShort, kTooShort,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooShort, kTooShort, kTooShort, kTooShort,
+};
+
+// Subtracted from the last bytes of a block with saturation, this leaves
+// nonzero bytes where a sequence starts that does not end in the block.
+const uint8_t kIncompleteLimits[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1,
+};
+
+__m128i LoadTable16(const uint8_t* table) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(table));
+}
+
+__m128i SplatSSE(uint8_t byte) {
+  return _mm_set1_epi8(static_cast<char>(byte));
+}
+
+__m256i SplatAVX2(uint8_t byte) {
+  return _mm256_set1_epi8(static_cast<char>(byte));
+}
+
+// The noncharacters are U+FDD0..U+FDEF, encoded as EF B7 90..EF B7 AF, and
+// the last two code points of every plane, which end in BF BE or BF BF. The
+// validators flag every BE or BF after a BF, which also matches some other
+// characters, and every 90..AF after EF B7.
+
+ALWAYS_INLINE __m128i CheckUTF8BlockSSE41(__m128i input, __m128i previous) {
+  const __m128i low_nibble = SplatSSE(0x0F);
+  const __m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+  const __m128i prev2 = _mm_alignr_epi8(input, previous, 14);
+  const __m128i prev3 = _mm_alignr_epi8(input, previous, 13);
+  const __m128i byte_1_high =
+      _mm_shuffle_epi8(LoadTable16(kByte1High),
+                       _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble));
+  const __m128i byte_1_low = _mm_shuffle_epi8(
+      LoadTable16(kByte1Low), _mm_and_si128(prev1, low_nibble));
+  const __m128i byte_2_high =
+      _mm_shuffle_epi8(LoadTable16(kByte2High),
+                       _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble));
+  const __m128i special_cases =
+      _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+  // The bytes that must be the second or third continuation of a sequence
+  // get their high bit set.
+  const __m128i must_be_continuation = _mm_and_si128(
+      _mm_or_si128(_mm_subs_epu8(prev2, SplatSSE(0xE0 - 0x80)),
+                   _mm_subs_epu8(prev3, SplatSSE(0xF0 - 0x80))),
+      SplatSSE(0x80));
+  const __m128i errors = _mm_xor_si128(must_be_continuation, special_cases);
+
+  const __m128i after_bf = _mm_and_si128(
+      _mm_cmpeq_epi8(prev1, SplatSSE(0xBF)),
+      _mm_cmpeq_epi8(_mm_or_si128(input, SplatSSE(0x01)), SplatSSE(0xBF)));
+  const __m128i from_90 = _mm_sub_epi8(input, SplatSSE(0x90));
+  const __m128i after_ef_b7 = _mm_and_si128(
+      _mm_and_si128(_mm_cmpeq_epi8(prev2, SplatSSE(0xEF)),
+                    _mm_cmpeq_epi8(prev1, SplatSSE(0xB7))),
+      _mm_cmpeq_epi8(_mm_min_epu8(from_90, SplatSSE(0xAF - 0x90)), from_90));
+  return _mm_or_si128(errors, _mm_or_si128(after_bf, after_ef_b7));
+}
+
+size_t ValidateUTF8PrefixSSE41(const char* begin, size_t length) {
+  const __m128i incomplete_limits = LoadTable16(kIncompleteLimits + 16);
+  __m128i previous = _mm_setzero_si128();
+  size_t i = 0;
+  for (; length - i >= 16; i += 16) {
+    const __m128i input =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin + i));
+    if (!_mm_movemask_epi8(input)) {
+      // ASCII is valid unless the previous block ends in the middle of a
+      // sequence.
+      const __m128i incomplete = _mm_subs_epu8(previous, incomplete_limits);
+      if (!_mm_testz_si128(incomplete, incomplete))
+        break;
+    } else {
+      const __m128i check = CheckUTF8BlockSSE41(input, previous);
+      if (!_mm_testz_si128(check, check))
+        break;
+    }
+    previous = input;
+  }
+  return BackUpToCharacterBoundary(begin, i);
+}
+
+ALWAYS_INLINE __m256i CheckUTF8BlockAVX2(__m256i input, __m256i previous) {
+  const __m256i low_nibble = SplatAVX2(0x0F);
+  // The last 16 bytes of |previous| and the first 16 of |input|, to shift
+  // bytes across the two lanes.
+  const __m256i shifted = _mm256_permute2x128_si256(previous, input, 0x21);
+  const __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+  const __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+  const __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+  const __m256i byte_1_high = _mm256_shuffle_epi8(
+      _mm256_broadcastsi128_si256(LoadTable16(kByte1High)),
+      _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble));
+  const __m256i byte_1_low = _mm256_shuffle_epi8(
+      _mm256_broadcastsi128_si256(LoadTable16(kByte1Low)),
+      _mm256_and_si256(prev1, low_nibble));
+  const __m256i byte_2_high = _mm256_shuffle_epi8(
+      _mm256_broadcastsi128_si256(LoadTable16(kByte2High)),
+      _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble));
+  const __m256i special_cases = _mm256_and_si256(
+      _mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+  const __m256i must_be_continuation = _mm256_and_si256(
+      _mm256_or_si256(_mm256_subs_epu8(prev2, SplatAVX2(0xE0 - 0x80)),
+                      _mm256_subs_epu8(prev3, SplatAVX2(0xF0 - 0x80))),
+      SplatAVX2(0x80));
+  const __m256i errors =
+      _mm256_xor_si256(must_be_continuation, special_cases);
+
+  const __m256i after_bf = _mm256_and_si256(
+      _mm256_cmpeq_epi8(prev1, SplatAVX2(0xBF)),
+      _mm256_cmpeq_epi8(_mm256_or_si256(input, SplatAVX2(0x01)),
+                        SplatAVX2(0xBF)));
+  const __m256i from_90 = _mm256_sub_epi8(input, SplatAVX2(0x90));
+  const __m256i after_ef_b7 = _mm256_and_si256(
+      _mm256_and_si256(_mm256_cmpeq_epi8(prev2, SplatAVX2(0xEF)),
+                       _mm256_cmpeq_epi8(prev1, SplatAVX2(0xB7))),
+      _mm256_cmpeq_epi8(_mm256_min_epu8(from_90, SplatAVX2(0xAF - 0x90)),
+                        from_90));
+  return _mm256_or_si256(errors, _mm256_or_si256(after_bf, after_ef_b7));
+}
+
+size_t ValidateUTF8PrefixAVX2(const char* begin, size_t length) {
+  const __m256i incomplete_limits =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kIncompleteLimits));
+  __m256i previous = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; length - i >= 32; i += 32) {
+    const __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin + i));
+    if (!_mm256_movemask_epi8(input)) {
+      const __m256i incomplete =
+          _mm256_subs_epu8(previous, incomplete_limits);
+      if (!_mm256_testz_si256(incomplete, incomplete))
+        break;
+    } else {
+      const __m256i check = CheckUTF8BlockAVX2(input, previous);
+      if (!_mm256_testz_si256(check, check))
+        break;
+    }
+    previous = input;
+  }
+  // Finish with 16 bytes at a time, starting at a character boundary.
+  i = BackUpToCharacterBoundary(begin, i);
+  return i + ValidateUTF8PrefixSSE41(begin + i, length - i);
+}
+
+#endif  // defined(ARCH_CPU_X86_FAMILY)
+
+UTF8PrefixValidator SelectUTF8PrefixValidator() {
+#if defined(ARCH_CPU_X86_FAMILY)
+  CPU cpu;
+  if (cpu.has_avx2())
+    return &ValidateUTF8PrefixAVX2;
+  if (cpu.has_sse41())
+    return &ValidateUTF8PrefixSSE41;
+#endif
+  return nullptr;
+}
+
+// After a validator stops, IsStringUTF8() decodes at least this many bytes
+// one code point at a time before it uses the validator again.
+const int32_t kUTF8DecodeStride = 64;
+
+}  // namespace
+
 bool IsStringUTF8(StringPiece str) {
+  // The CPU is only queried once.
+  static const UTF8PrefixValidator validator = SelectUTF8PrefixValidator();
+
   const char *src = str.data();
   int32_t src_len = static_cast<int32_t>(str.length());
   int32_t char_index = 0;
 
   while (char_index < src_len) {
-    int32_t code_point;
-    CBU8_NEXT(src, char_index, src_len, code_point);
-    if (!IsValidCharacter(code_point))
-      return false;
+    int32_t decode_end = src_len;
+    if (validator) {
+      char_index += static_cast<int32_t>(
+          validator(src + char_index, src_len - char_index));
+      decode_end = std::min(src_len, char_index + kUTF8DecodeStride);
+    }
+    while (char_index < decode_end) {
+      int32_t code_point;
+      CBU8_NEXT(src, char_index, src_len, code_point);
+      if (!IsValidCharacter(code_point))
+        return false;
+    }
   }
   return true;
 }
@@ -531,11 +1164,12 @@ static inline bool DoLowerCaseEqualsASCII(BasicStringPiece<Str> str,
                                           StringPiece lowercase_ascii) {
   if (str.size() != lowercase_ascii.size())
     return false;
-  for (size_t i = 0; i < str.size(); i++) {
-    if (ToLowerASCII(str[i]) != lowercase_ascii[i])
-      return false;
-  }
-  return true;
+  // A non-ASCII byte equals no lowercased char16, and the kernels compare
+  // bytes with char16s zero-extended.
+  if (sizeof(typename Str::value_type) > 1 && !IsStringASCII(lowercase_ascii))
+    return false;
+  return FindLowerCaseMismatchASCII(str.data(), lowercase_ascii.data(),
+                                    str.size()) == str.size();
 }
 
 bool LowerCaseEqualsASCII(StringPiece str, StringPiece lowercase_ascii) {
@@ -684,7 +1318,8 @@ struct SubstringMatcher {
   BasicStringPiece<StringType> find_this;
 
   size_t Find(const StringType& input, size_t pos) {
-    return input.find(find_this.data(), pos, find_this.length());
+    // StringPiece's find() is faster than the string's.
+    return BasicStringPiece<StringType>(input).find(find_this, pos);
   }
   size_t MatchSize() { return find_this.length(); }
 };
@@ -901,6 +1536,33 @@ void ReplaceSubstringsAfterOffset(std::string* str,
                               replace_with, ReplaceType::REPLACE_ALL);
 }
 
+void ReplaceSubstringsAfterOffset(
+    std::string* str,
+    size_t start_offset,
+    const SubstringSetMatcher& find_these,
+    const std::vector<StringPiece>& replace_with) {
+  // Every pattern needs a replacement; |pattern| indexes |replace_with|.
+  WINBASE_CHECK_EQ(find_these.pattern_count(), replace_with.size());
+  size_t pattern;
+  size_t match = find_these.Find(*str, start_offset, &pattern);
+  if (match == StringPiece::npos)
+    return;
+
+  // Build the result in one pass rather than shifting the tail of |str| for
+  // every match.
+  std::string result;
+  result.reserve(str->size());
+  size_t copied = 0;
+  while (match != StringPiece::npos) {
+    result.append(*str, copied, match - copied);
+    replace_with[pattern].AppendToString(&result);
+    copied = match + find_these.pattern_length(pattern);
+    match = find_these.Find(*str, copied, &pattern);
+  }
+  result.append(*str, copied, std::string::npos);
+  str->swap(result);
+}
+
 template <class string_type>
 inline typename string_type::value_type* WriteIntoT(string_type* str,
                                                     size_t length_with_null) {
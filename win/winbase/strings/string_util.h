@@ -23,6 +23,8 @@
 
 namespace winbase {
 
+class SubstringSetMatcher;
+
 // C standard-library functions that aren't cross-platform are provided as
 // "winbase::...", and their prototypes are listed below. These functions are
 // then implemented as inline calls to the platform-specific equivalents in the
@@ -140,6 +142,20 @@ WINBASE_EXPORT string16 ToLowerASCII(StringPiece16 str);
 WINBASE_EXPORT std::string ToUpperASCII(StringPiece str);
 WINBASE_EXPORT string16 ToUpperASCII(StringPiece16 str);
 
+// Like the above, but write the result to |output|, which must have room for
+// str.size() characters. |output| may be str.data() to convert in place, but
+// must not overlap |str| otherwise.
+WINBASE_EXPORT void ToLowerASCII(StringPiece str, char* output);
+WINBASE_EXPORT void ToLowerASCII(StringPiece16 str, char16* output);
+WINBASE_EXPORT void ToUpperASCII(StringPiece str, char* output);
+WINBASE_EXPORT void ToUpperASCII(StringPiece16 str, char16* output);
+
+// Converts |str| to its ASCII-lowercase or -uppercase equivalent in place.
+WINBASE_EXPORT void ToLowerASCIIInPlace(std::string* str);
+WINBASE_EXPORT void ToLowerASCIIInPlace(string16* str);
+WINBASE_EXPORT void ToUpperASCIIInPlace(std::string* str);
+WINBASE_EXPORT void ToUpperASCIIInPlace(string16* str);
+
 // Functor for case-insensitive ASCII comparisons for STL algorithms like
 // std::search.
 //
@@ -458,6 +474,18 @@ WINBASE_EXPORT void ReplaceSubstringsAfterOffset(
     StringPiece find_this,
     StringPiece replace_with);
 
+// Like the above, but replaces every match of any of the patterns of
+// |find_these| with the corresponding entry of |replace_with|, all in one pass
+// over |str|. |replace_with| must have one entry per pattern. Where matches
+// overlap, the leftmost one wins, then the longest.
+// Use this rather than one call per pattern when there are several patterns,
+// for example to scrub a set of tokens from log lines.
+WINBASE_EXPORT void ReplaceSubstringsAfterOffset(
+    std::string* str,
+    size_t start_offset,
+    const SubstringSetMatcher& find_these,
+    const std::vector<StringPiece>& replace_with);
+
 // Reserves enough memory in |str| to accommodate |length_with_null| characters,
 // sets the size of |str| to |length_with_null - 1| characters, and returns a
 // pointer to the underlying contiguous array of characters.  This is typically
@@ -0,0 +1,248 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "winbase\strings\substring_set_matcher.h"
+
+#include <string.h>
+
+#include "winbase\bits.h"
+#include "winbase\compiler_specific.h"
+#include "winbase\cpu.h"
+#include "winlib\build_config.h"
+
+#if defined(ARCH_CPU_X86_FAMILY)
+#include <immintrin.h>
+#endif
+
+namespace winbase {
+
+namespace {
+
+void AddToNibbleTable(uint8_t* table, uint8_t byte) {
+  table[(byte >> 7) * 16 + (byte & 15)] |=
+      static_cast<uint8_t>(1 << ((byte >> 4) & 7));
+}
+
+// Start byte scanners. Each returns the offset of the first byte in |text|
+// that may start a pattern, or |length|. The scalar variant only looks at the
+// first byte. The SSSE3 variant looks at the first two bytes of 16 positions
+// per step, and finishes the tail with the scalar variant.
+typedef size_t (*StartByteScanner)(const uint8_t* text,
+                                   size_t length,
+                                   const bool* start_bytes,
+                                   const uint8_t* start_nibbles,
+                                   const uint8_t* second_nibbles);
+
+size_t ScanForStartByteScalar(const uint8_t* text,
+                              size_t length,
+                              const bool* start_bytes,
+                              const uint8_t* start_nibbles,
+                              const uint8_t* second_nibbles) {
+  size_t i = 0;
+  while (i < length && !start_bytes[text[i]])
+    ++i;
+  return i;
+}
+
+#if defined(ARCH_CPU_X86_FAMILY)
+
+// Returns 0xFF in the lanes of |chunk| whose byte is in the nibble table
+// given by its halves, and 0 in the others.
+ALWAYS_INLINE __m128i FindInNibbleTableSSSE3(__m128i chunk,
+                                             __m128i low_half_rows,
+                                             __m128i high_half_rows) {
+  // 1 << (h & 7) for every high nibble h.
+  const __m128i high_nibble_bits =
+      _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40,
+                    static_cast<char>(0x80), 0x01, 0x02, 0x04, 0x08, 0x10,
+                    0x20, 0x40, static_cast<char>(0x80));
+  const __m128i low_nibble_mask = _mm_set1_epi8(0x0F);
+  __m128i low = _mm_and_si128(chunk, low_nibble_mask);
+  __m128i high = _mm_and_si128(_mm_srli_epi16(chunk, 4), low_nibble_mask);
+  // Pick the row for the low nibble from the table for the byte's half, then
+  // the bit for the high nibble from the row.
+  __m128i in_high_half = _mm_cmpgt_epi8(high, _mm_set1_epi8(7));
+  __m128i rows = _mm_or_si128(
+      _mm_andnot_si128(in_high_half, _mm_shuffle_epi8(low_half_rows, low)),
+      _mm_and_si128(in_high_half, _mm_shuffle_epi8(high_half_rows, low)));
+  __m128i bits = _mm_and_si128(rows, _mm_shuffle_epi8(high_nibble_bits, high));
+  return _mm_xor_si128(_mm_cmpeq_epi8(bits, _mm_setzero_si128()),
+                       _mm_set1_epi8(-1));
+}
+
+size_t ScanForStartByteSSSE3(const uint8_t* text,
+                             size_t length,
+                             const bool* start_bytes,
+                             const uint8_t* start_nibbles,
+                             const uint8_t* second_nibbles) {
+  const __m128i start_low_rows =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(start_nibbles));
+  const __m128i start_high_rows =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(start_nibbles + 16));
+  const __m128i second_low_rows =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(second_nibbles));
+  const __m128i second_high_rows =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(second_nibbles + 16));
+  size_t i = 0;
+  // The second bytes are read one further on, so one byte is kept back.
+  for (; length - i > 16; i += 16) {
+    __m128i firsts = FindInNibbleTableSSSE3(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i)),
+        start_low_rows, start_high_rows);
+    __m128i seconds = FindInNibbleTableSSSE3(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i + 1)),
+        second_low_rows, second_high_rows);
+    uint32_t hits = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_and_si128(firsts, seconds)));
+    if (hits)
+      return i + bits::CountTrailingZeroBits(hits);
+  }
+  return i + ScanForStartByteScalar(text + i, length - i, start_bytes,
+                                    start_nibbles, second_nibbles);
+}
+
+#endif  // defined(ARCH_CPU_X86_FAMILY)
+
+StartByteScanner SelectStartByteScanner() {
+#if defined(ARCH_CPU_X86_FAMILY)
+  if (CPU().has_ssse3())
+    return &ScanForStartByteSSSE3;
+#endif
+  return &ScanForStartByteScalar;
+}
+
+}  // namespace
+
+SubstringSetMatcher::SubstringSetMatcher(
+    const std::vector<StringPiece>& patterns)
+    : class_count_(1) {
+  memset(byte_classes_, 0, sizeof(byte_classes_));
+  memset(start_bytes_, 0, sizeof(start_bytes_));
+  memset(start_nibbles_, 0, sizeof(start_nibbles_));
+  memset(second_nibbles_, 0, sizeof(second_nibbles_));
+  for (StringPiece pattern : patterns) {
+    for (char c : pattern) {
+      uint16_t& byte_class = byte_classes_[static_cast<uint8_t>(c)];
+      if (!byte_class)
+        byte_class = static_cast<uint16_t>(class_count_++);
+    }
+  }
+
+  // Build the trie. While building, transition 0 means there is none, as
+  // nothing leads back to the root yet.
+  states_.push_back({0, 0, 0});
+  transitions_.assign(class_count_, 0);
+  pattern_lengths_.reserve(patterns.size());
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    StringPiece pattern = patterns[i];
+    pattern_lengths_.push_back(pattern.size());
+    if (pattern.empty())
+      continue;
+
+    uint32_t state = 0;
+    for (char c : pattern) {
+      size_t transition =
+          state * class_count_ + byte_classes_[static_cast<uint8_t>(c)];
+      if (!transitions_[transition]) {
+        transitions_[transition] = static_cast<uint32_t>(states_.size());
+        states_.push_back({states_[state].depth + 1, 0, 0});
+        transitions_.resize(transitions_.size() + class_count_, 0);
+      }
+      state = transitions_[transition];
+    }
+    // Of identical patterns, the first one given wins.
+    State& end = states_[state];
+    if (!end.match_length) {
+      end.match_length = static_cast<uint32_t>(pattern.size());
+      end.match_pattern = static_cast<uint32_t>(i);
+    }
+
+    uint8_t first = static_cast<uint8_t>(pattern[0]);
+    start_bytes_[first] = true;
+    AddToNibbleTable(start_nibbles_, first);
+    if (pattern.size() > 1)
+      AddToNibbleTable(second_nibbles_, static_cast<uint8_t>(pattern[1]));
+    else
+      memset(second_nibbles_, 0xFF, sizeof(second_nibbles_));
+  }
+
+  // Turn the trie into an automaton, breadth first so that the state a
+  // mismatch falls back to is complete before the states that use it. Missing
+  // transitions from the root already lead back to it.
+  std::vector<uint32_t> fallbacks(states_.size(), 0);
+  std::vector<uint32_t> queue;
+  queue.reserve(states_.size());
+  for (size_t byte_class = 0; byte_class < class_count_; ++byte_class) {
+    if (uint32_t child = transitions_[byte_class])
+      queue.push_back(child);
+  }
+  for (size_t head = 0; head < queue.size(); ++head) {
+    uint32_t state = queue[head];
+    uint32_t fallback = fallbacks[state];
+    // The longest pattern ending here is either the one that ends in this
+    // state, or one that ends in its fallback.
+    if (!states_[state].match_length) {
+      states_[state].match_length = states_[fallback].match_length;
+      states_[state].match_pattern = states_[fallback].match_pattern;
+    }
+    for (size_t byte_class = 0; byte_class < class_count_; ++byte_class) {
+      uint32_t& next = transitions_[state * class_count_ + byte_class];
+      uint32_t fallback_next =
+          transitions_[fallback * class_count_ + byte_class];
+      if (next) {
+        fallbacks[next] = fallback_next;
+        queue.push_back(next);
+      } else {
+        next = fallback_next;
+      }
+    }
+  }
+}
+
+SubstringSetMatcher::~SubstringSetMatcher() = default;
+
+size_t SubstringSetMatcher::Find(StringPiece text,
+                                 size_t pos,
+                                 size_t* pattern_index) const {
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+  const size_t length = text.size();
+  size_t best_start = StringPiece::npos;
+  size_t best_length = 0;
+  uint32_t state = 0;
+  for (size_t i = pos; i < length;) {
+    // Only the bytes that start a pattern leave the root.
+    if (!state && !start_bytes_[data[i]]) {
+      i += 1 + SkipToStartByte(data + i + 1, length - i - 1);
+      if (i == length)
+        break;
+    }
+    state = transitions_[state * class_count_ + byte_classes_[data[i]]];
+    ++i;
+
+    const State& info = states_[state];
+    if (info.match_length) {
+      size_t start = i - info.match_length;
+      if (start < best_start ||
+          (start == best_start && info.match_length > best_length)) {
+        best_start = start;
+        best_length = info.match_length;
+        *pattern_index = info.match_pattern;
+      }
+    }
+    // Matches that end further on start at i - depth or later.
+    if (best_start != StringPiece::npos && i - info.depth > best_start)
+      break;
+  }
+  return best_start;
+}
+
+size_t SubstringSetMatcher::SkipToStartByte(const uint8_t* text,
+                                            size_t length) const {
+  // The CPU is only queried once.
+  static const StartByteScanner scanner = SelectStartByteScanner();
+  return scanner(text, length, start_bytes_, start_nibbles_,
+                 second_nibbles_);
+}
+
+}  // namespace winbase
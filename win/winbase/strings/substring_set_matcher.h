@@ -0,0 +1,85 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef WINLIB_WINBASE_STRINGS_SUBSTRING_SET_MATCHER_H_
+#define WINLIB_WINBASE_STRINGS_SUBSTRING_SET_MATCHER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "winbase\base_export.h"
+#include "winbase\strings\string_piece.h"
+
+namespace winbase {
+
+// Finds any of a set of patterns in a text in one pass, however many patterns
+// there are. Build the matcher once and use it for many texts:
+//
+//   SubstringSetMatcher matcher({"password=", "token=", "secret="});
+//   size_t pattern;
+//   size_t pos = matcher.Find(line, 0, &pattern);
+//   if (pos != StringPiece::npos)
+//     ... line.substr(pos, matcher.pattern_length(pattern)) ...
+//
+// This is an Aho-Corasick automaton. Stretches of the text that cannot start
+// a match are skipped 16 bytes at a time on CPUs with SSSE3, looking at the
+// first two bytes of every position.
+class WINBASE_EXPORT SubstringSetMatcher {
+ public:
+  // Empty patterns never match.
+  explicit SubstringSetMatcher(const std::vector<StringPiece>& patterns);
+  SubstringSetMatcher(const SubstringSetMatcher&) = delete;
+  SubstringSetMatcher& operator=(const SubstringSetMatcher&) = delete;
+  ~SubstringSetMatcher();
+
+  // Returns the position of the leftmost match in |text| that starts at or
+  // after |pos|, or StringPiece::npos. Of the patterns that match there, the
+  // longest wins, then the first one given. Sets |pattern_index| to its index.
+  size_t Find(StringPiece text, size_t pos, size_t* pattern_index) const;
+
+  size_t pattern_count() const { return pattern_lengths_.size(); }
+  size_t pattern_length(size_t pattern_index) const {
+    return pattern_lengths_[pattern_index];
+  }
+
+ private:
+  struct State {
+    // The length of the longest suffix of the text read so far that is a
+    // prefix of a pattern, which is what this state stands for.
+    uint32_t depth;
+    // The longest pattern that ends here, if |match_length| is not 0.
+    uint32_t match_length;
+    uint32_t match_pattern;
+  };
+
+  // Returns the offset of the first byte in |text| that starts a pattern, or
+  // |length|.
+  size_t SkipToStartByte(const uint8_t* text, size_t length) const;
+
+  std::vector<size_t> pattern_lengths_;
+
+  // Bytes that appear in no pattern share class 0; the others get a class
+  // each, so the transition table has one column per class.
+  uint16_t byte_classes_[256];
+  size_t class_count_;
+
+  // The next state for every state and byte class, row by row. The root is
+  // state 0.
+  std::vector<uint32_t> transitions_;
+  std::vector<State> states_;
+
+  // The bytes that start a pattern, as a table and as nibble tables for
+  // SSSE3: a byte b is in a nibble table if bit (b >> 4) & 7 is set in
+  // table[(b >> 7) * 16 + (b & 15)]. |second_nibbles_| holds the bytes that
+  // can follow the first byte, which is any byte if a pattern is one long.
+  bool start_bytes_[256];
+  uint8_t start_nibbles_[32];
+  uint8_t second_nibbles_[32];
+};
+
+}  // namespace winbase
+
+#endif  // WINLIB_WINBASE_STRINGS_SUBSTRING_SET_MATCHER_H_
@@ -6,12 +6,21 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <limits>
+
+#include "winbase\bits.h"
+#include "winbase\cpu.h"
 #include "winbase\strings\string_piece.h"
 #include "winbase\strings\string_util.h"
 #include "winbase\strings\utf_string_conversion_utils.h"
 #include "winbase\third_party\icu\icu_utf.h"
 #include "winlib\build_config.h"
 
+#if defined(ARCH_CPU_X86_FAMILY)
+#include <immintrin.h>
+#endif
+
 namespace winbase {
 
 namespace {
@@ -122,25 +131,411 @@ bool DoUTFConversion(const char16* src,
   return success;
 }
 
+// Transcoders ----------------------------------------------------------------
+// Fast paths for valid input. A first pass counts the code units of the output
+// exactly, so that it is allocated once; a second pass copies runs of ASCII
+// 16 or 32 bytes per step and converts everything else one character at a
+// time. The second pass gives up at the first invalid character and leaves
+// the input to DoUTFConversion, which replaces it with U+FFFD.
+//
+// The counters return the length of the output for [begin, end) assuming the
+// input is valid. The copiers copy the longest ASCII prefix of [begin, end) to
+// |dest|, which has room for all of it, and return its length. The SIMD
+// variants finish the tail with the scalar ones, so all return the same
+// result; the copiers may write past the prefix, but not past the room.
+
+size_t CountUTF16UnitsScalar(const char* begin, const char* end) {
+  size_t length = 0;
+  for (const char* p = begin; p != end; ++p) {
+    uint8_t byte = static_cast<uint8_t>(*p);
+    // Every lead byte starts a character, and four-byte sequences need a
+    // surrogate pair.
+    length += !CBU8_IS_TRAIL(byte);
+    length += byte >= 0xF0;
+  }
+  return length;
+}
+
+size_t CountUTF8UnitsScalar(const char16* begin, const char16* end) {
+  size_t length = 0;
+  for (const char16* p = begin; p != end; ++p) {
+    // Each half of a surrogate pair accounts for two of its four bytes.
+    length += *p < 0x80 ? 1 : *p < 0x800 || CBU16_IS_SURROGATE(*p) ? 2 : 3;
+  }
+  return length;
+}
+
+inline bool IsASCIICodeUnit(char c) {
+  return static_cast<uint8_t>(c) < 0x80;
+}
+
+inline bool IsASCIICodeUnit(char16 c) {
+  return c < 0x80;
+}
+
+template <typename SrcChar, typename DestChar>
+size_t CopyASCIIScalar(const SrcChar* begin, const SrcChar* end,
+                       DestChar* dest) {
+  const SrcChar* p = begin;
+  for (; p != end && IsASCIICodeUnit(*p); ++p, ++dest)
+    *dest = static_cast<DestChar>(*p);
+  return p - begin;
+}
+
+#if defined(ARCH_CPU_X86_FAMILY)
+
+// Sums the bytes of |counts|.
+size_t SumBytesSSE2(__m128i counts) {
+  __m128i sums = _mm_sad_epu8(counts, _mm_setzero_si128());
+  return _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+}
+
+// Sums the signed 16-bit values of |counts|.
+size_t SumInt16sSSE2(__m128i counts) {
+  __m128i sums = _mm_madd_epi16(counts, _mm_set1_epi16(1));
+  sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+  sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sums);
+}
+
+size_t CountUTF16UnitsSSE2(const char* begin, const char* end) {
+  const __m128i min_lead = _mm_set1_epi8(static_cast<char>(0xC0));
+  const __m128i four_byte_lead = _mm_set1_epi8(static_cast<char>(0xF0));
+  const char* p = begin;
+  size_t trail_bytes = 0;
+  size_t four_byte_leads = 0;
+  while (end - p >= 16) {
+    // Count in bytes for up to 255 blocks, then add up.
+    size_t blocks = std::min<size_t>((end - p) / 16, 255);
+    __m128i trails = _mm_setzero_si128();
+    __m128i fours = _mm_setzero_si128();
+    for (; blocks; --blocks, p += 16) {
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      // As signed bytes, trail bytes are the ones less than 0xC0; ASCII is
+      // positive. Matches are -1, so subtracting them counts them.
+      trails = _mm_sub_epi8(trails, _mm_cmplt_epi8(chunk, min_lead));
+      fours = _mm_sub_epi8(
+          fours, _mm_cmpeq_epi8(_mm_max_epu8(chunk, four_byte_lead), chunk));
+    }
+    trail_bytes += SumBytesSSE2(trails);
+    four_byte_leads += SumBytesSSE2(fours);
+  }
+  return (p - begin) - trail_bytes + four_byte_leads +
+         CountUTF16UnitsScalar(p, end);
+}
+
+size_t CountUTF8UnitsSSE2(const char16* begin, const char16* end) {
+  // Unsigned units are compared as signed ones after flipping the top bit.
+  const __m128i top_bit = _mm_set1_epi16(static_cast<short>(0x8000));
+  const __m128i max_one_byte = _mm_set1_epi16(static_cast<short>(0x807F));
+  const __m128i max_two_bytes = _mm_set1_epi16(static_cast<short>(0x87FF));
+  const __m128i surrogate_mask = _mm_set1_epi16(static_cast<short>(0xF800));
+  const __m128i surrogate = _mm_set1_epi16(static_cast<short>(0xD800));
+  const char16* p = begin;
+  size_t extra_bytes = 0;
+  while (end - p >= 8) {
+    // A block adds at most 2 to a lane: count in 16 bits for up to 8192
+    // blocks, then add up.
+    size_t blocks = std::min<size_t>((end - p) / 8, 8192);
+    __m128i extra = _mm_setzero_si128();
+    for (; blocks; --blocks, p += 8) {
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i flipped = _mm_xor_si128(chunk, top_bit);
+      // Units from 0x80 up take a second byte and units from 0x800 up a
+      // third, except for surrogates.
+      extra = _mm_sub_epi16(extra, _mm_cmpgt_epi16(flipped, max_one_byte));
+      extra = _mm_sub_epi16(extra, _mm_cmpgt_epi16(flipped, max_two_bytes));
+      extra = _mm_add_epi16(
+          extra,
+          _mm_cmpeq_epi16(_mm_and_si128(chunk, surrogate_mask), surrogate));
+    }
+    extra_bytes += SumInt16sSSE2(extra);
+  }
+  return (p - begin) + extra_bytes + CountUTF8UnitsScalar(p, end);
+}
+
+size_t CopyASCIICharsSSE2(const char* begin, const char* end, char16* dest) {
+  const __m128i zero = _mm_setzero_si128();
+  const char* p = begin;
+  for (; end - p >= 16; p += 16, dest += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest),
+                     _mm_unpacklo_epi8(chunk, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 8),
+                     _mm_unpackhi_epi8(chunk, zero));
+    uint32_t stop = static_cast<uint32_t>(_mm_movemask_epi8(chunk));
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop);
+  }
+  return (p - begin) + CopyASCIIScalar(p, end, dest);
+}
+
+size_t CopyASCIIChar16sSSE2(const char16* begin, const char16* end,
+                            char* dest) {
+  const __m128i non_ascii_mask = _mm_set1_epi16(static_cast<short>(0xFF80));
+  const __m128i zero = _mm_setzero_si128();
+  const char16* p = begin;
+  for (; end - p >= 16; p += 16, dest += 16) {
+    __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest),
+                     _mm_packus_epi16(low, high));
+    // Packing saturates, so non-ASCII units are found before it.
+    __m128i ascii = _mm_packs_epi16(
+        _mm_cmpeq_epi16(_mm_and_si128(low, non_ascii_mask), zero),
+        _mm_cmpeq_epi16(_mm_and_si128(high, non_ascii_mask), zero));
+    uint32_t stop = ~static_cast<uint32_t>(_mm_movemask_epi8(ascii)) & 0xFFFF;
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop);
+  }
+  return (p - begin) + CopyASCIIScalar(p, end, dest);
+}
+
+size_t SumBytesAVX2(__m256i counts) {
+  return SumBytesSSE2(_mm256_castsi256_si128(counts)) +
+         SumBytesSSE2(_mm256_extracti128_si256(counts, 1));
+}
+
+size_t SumInt16sAVX2(__m256i counts) {
+  return SumInt16sSSE2(_mm_add_epi16(_mm256_castsi256_si128(counts),
+                                     _mm256_extracti128_si256(counts, 1)));
+}
+
+size_t CountUTF16UnitsAVX2(const char* begin, const char* end) {
+  const __m256i min_lead = _mm256_set1_epi8(static_cast<char>(0xC0));
+  const __m256i four_byte_lead = _mm256_set1_epi8(static_cast<char>(0xF0));
+  const char* p = begin;
+  size_t trail_bytes = 0;
+  size_t four_byte_leads = 0;
+  while (end - p >= 32) {
+    size_t blocks = std::min<size_t>((end - p) / 32, 255);
+    __m256i trails = _mm256_setzero_si256();
+    __m256i fours = _mm256_setzero_si256();
+    for (; blocks; --blocks, p += 32) {
+      __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      trails = _mm256_sub_epi8(trails, _mm256_cmpgt_epi8(min_lead, chunk));
+      fours = _mm256_sub_epi8(
+          fours,
+          _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, four_byte_lead), chunk));
+    }
+    trail_bytes += SumBytesAVX2(trails);
+    four_byte_leads += SumBytesAVX2(fours);
+  }
+  return (p - begin) - trail_bytes + four_byte_leads +
+         CountUTF16UnitsSSE2(p, end);
+}
+
+size_t CountUTF8UnitsAVX2(const char16* begin, const char16* end) {
+  const __m256i top_bit = _mm256_set1_epi16(static_cast<short>(0x8000));
+  const __m256i max_one_byte = _mm256_set1_epi16(static_cast<short>(0x807F));
+  const __m256i max_two_bytes = _mm256_set1_epi16(static_cast<short>(0x87FF));
+  const __m256i surrogate_mask =
+      _mm256_set1_epi16(static_cast<short>(0xF800));
+  const __m256i surrogate = _mm256_set1_epi16(static_cast<short>(0xD800));
+  const char16* p = begin;
+  size_t extra_bytes = 0;
+  while (end - p >= 16) {
+    // The two halves are added in 16 bits before summing, so count for half
+    // as many blocks as the SSE2 variant.
+    size_t blocks = std::min<size_t>((end - p) / 16, 4096);
+    __m256i extra = _mm256_setzero_si256();
+    for (; blocks; --blocks, p += 16) {
+      __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      __m256i flipped = _mm256_xor_si256(chunk, top_bit);
+      extra =
+          _mm256_sub_epi16(extra, _mm256_cmpgt_epi16(flipped, max_one_byte));
+      extra =
+          _mm256_sub_epi16(extra, _mm256_cmpgt_epi16(flipped, max_two_bytes));
+      extra = _mm256_add_epi16(
+          extra, _mm256_cmpeq_epi16(_mm256_and_si256(chunk, surrogate_mask),
+                                    surrogate));
+    }
+    extra_bytes += SumInt16sAVX2(extra);
+  }
+  return (p - begin) + extra_bytes + CountUTF8UnitsSSE2(p, end);
+}
+
+size_t CopyASCIICharsAVX2(const char* begin, const char* end, char16* dest) {
+  const char* p = begin;
+  for (; end - p >= 32; p += 32, dest += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(dest),
+        _mm256_cvtepu8_epi16(_mm256_castsi256_si128(chunk)));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(dest + 16),
+        _mm256_cvtepu8_epi16(_mm256_extracti128_si256(chunk, 1)));
+    uint32_t stop = static_cast<uint32_t>(_mm256_movemask_epi8(chunk));
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop);
+  }
+  return (p - begin) + CopyASCIICharsSSE2(p, end, dest);
+}
+
+size_t CopyASCIIChar16sAVX2(const char16* begin, const char16* end,
+                            char* dest) {
+  const __m256i non_ascii_mask =
+      _mm256_set1_epi16(static_cast<short>(0xFF80));
+  const __m256i zero = _mm256_setzero_si256();
+  const char16* p = begin;
+  for (; end - p >= 32; p += 32, dest += 32) {
+    __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i high =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 16));
+    // Packing works within 128-bit lanes; the permutes put the quarters back
+    // in order.
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(dest),
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xD8));
+    __m256i ascii = _mm256_permute4x64_epi64(
+        _mm256_packs_epi16(
+            _mm256_cmpeq_epi16(_mm256_and_si256(low, non_ascii_mask), zero),
+            _mm256_cmpeq_epi16(_mm256_and_si256(high, non_ascii_mask), zero)),
+        0xD8);
+    uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(ascii));
+    if (stop)
+      return (p - begin) + bits::CountTrailingZeroBits(stop);
+  }
+  return (p - begin) + CopyASCIIChar16sSSE2(p, end, dest);
+}
+
+#endif  // defined(ARCH_CPU_X86_FAMILY)
+
+struct Transcoders {
+  size_t (*count_utf16_units)(const char* begin, const char* end);
+  size_t (*count_utf8_units)(const char16* begin, const char16* end);
+  size_t (*copy_ascii_chars)(const char* begin, const char* end, char16* dest);
+  size_t (*copy_ascii_char16s)(const char16* begin, const char16* end,
+                               char* dest);
+
+  size_t Count(const char* begin, const char* end) const {
+    return count_utf16_units(begin, end);
+  }
+  size_t Count(const char16* begin, const char16* end) const {
+    return count_utf8_units(begin, end);
+  }
+  size_t CopyASCII(const char* begin, const char* end, char16* dest) const {
+    return copy_ascii_chars(begin, end, dest);
+  }
+  size_t CopyASCII(const char16* begin, const char16* end, char* dest) const {
+    return copy_ascii_char16s(begin, end, dest);
+  }
+};
+
+Transcoders SelectTranscoders() {
+#if defined(ARCH_CPU_X86_FAMILY)
+  CPU cpu;
+  if (cpu.has_avx2()) {
+    return {&CountUTF16UnitsAVX2, &CountUTF8UnitsAVX2, &CopyASCIICharsAVX2,
+            &CopyASCIIChar16sAVX2};
+  }
+  if (cpu.has_sse2()) {
+    return {&CountUTF16UnitsSSE2, &CountUTF8UnitsSSE2, &CopyASCIICharsSSE2,
+            &CopyASCIIChar16sSSE2};
+  }
+#endif
+  return {&CountUTF16UnitsScalar, &CountUTF8UnitsScalar,
+          &CopyASCIIScalar<char, char16>, &CopyASCIIScalar<char16, char>};
+}
+
+// The CPU is only queried once.
+const Transcoders& GetTranscoders() {
+  static const Transcoders transcoders = SelectTranscoders();
+  return transcoders;
+}
+
+// DoValidUTFConversion -------------------------------------------------------
+// Converts src to exactly dest_len codeunits, as counted by the transcoders.
+// Returns false at the first invalid character, or if the output does not fit
+// in dest_len; dest is then only partly written.
+
+bool DoValidUTFConversion(const char* src,
+                          int32_t src_len,
+                          char16* dest,
+                          int32_t dest_len) {
+  const Transcoders& transcoders = GetTranscoders();
+  int32_t i = 0;
+  int32_t j = 0;
+  while (i < src_len) {
+    int32_t run = static_cast<int32_t>(transcoders.CopyASCII(
+        src + i, src + i + std::min(src_len - i, dest_len - j), dest + j));
+    i += run;
+    j += run;
+
+    // Convert characters one at a time up to the next ASCII one. The first
+    // one is ASCII if the run stopped for lack of room.
+    while (i < src_len) {
+      int32_t code_point;
+      CBU8_NEXT(src, i, src_len, code_point);
+      if (!IsValidCodepoint(code_point) ||
+          dest_len - j < static_cast<int32_t>(CBU16_LENGTH(code_point))) {
+        return false;
+      }
+      CBU16_APPEND_UNSAFE(dest, j, code_point);
+      if (i < src_len && IsASCIICodeUnit(src[i]))
+        break;
+    }
+  }
+  return j == dest_len;
+}
+
+bool DoValidUTFConversion(const char16* src,
+                          int32_t src_len,
+                          char* dest,
+                          int32_t dest_len) {
+  const Transcoders& transcoders = GetTranscoders();
+  int32_t i = 0;
+  int32_t j = 0;
+  while (i < src_len) {
+    int32_t run = static_cast<int32_t>(transcoders.CopyASCII(
+        src + i, src + i + std::min(src_len - i, dest_len - j), dest + j));
+    i += run;
+    j += run;
+
+    while (i < src_len) {
+      uint32_t code_point = src[i++];
+      if (CBU16_IS_SURROGATE(code_point)) {
+        if (!CBU16_IS_SURROGATE_LEAD(code_point) || i == src_len ||
+            !CBU16_IS_TRAIL(src[i])) {
+          return false;
+        }
+        code_point = CBU16_GET_SUPPLEMENTARY(code_point, src[i]);
+        ++i;
+      }
+      if (dest_len - j < static_cast<int32_t>(CBU8_LENGTH(code_point)))
+        return false;
+      CBU8_APPEND_UNSAFE(dest, j, code_point);
+      if (i < src_len && IsASCIICodeUnit(src[i]))
+        break;
+    }
+  }
+  return j == dest_len;
+}
+
 // UTFConversion --------------------------------------------------------------
 // Function template for generating all UTF conversions.
 
 template <typename InputString, typename DestString>
 bool UTFConversion(const InputString& src_str, DestString* dest_str) {
-  if (IsStringASCII(src_str)) {
-    dest_str->assign(src_str.begin(), src_str.end());
-    return true;
+  // ICU requires 32 bit numbers.
+  int32_t src_len32 = static_cast<int32_t>(src_str.length());
+
+  // Most input is valid: size the output exactly and convert it in one go.
+  size_t length = GetTranscoders().Count(
+      src_str.data(), src_str.data() + src_str.length());
+  if (length <= static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+    dest_str->resize(length);
+    // It is OK to call operator[] on an empty string.
+    if (DoValidUTFConversion(src_str.data(), src_len32, &(*dest_str)[0],
+                             static_cast<int32_t>(length))) {
+      return true;
+    }
   }
 
   dest_str->resize(src_str.length() *
                    size_coefficient_v<typename InputString::value_type,
                                       typename DestString::value_type>);
-
-  // Empty string is ASCII => it OK to call operator[].
   auto* dest = &(*dest_str)[0];
-
-  // ICU requires 32 bit numbers.
-  int32_t src_len32 = static_cast<int32_t>(src_str.length());
   int32_t dest_len32 = 0;
 
   bool res = DoUTFConversion(src_str.data(), src_len32, dest, &dest_len32);
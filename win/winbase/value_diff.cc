@@ -0,0 +1,467 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "winbase\value_diff.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "winbase\hash.h"
+#include "winbase\strings\string_number_conversions.h"
+#include "winbase\strings\string_piece.h"
+#include "winbase\strings\string_util.h"
+
+namespace winbase {
+
+namespace {
+
+const char kOpKey[] = "op";
+const char kPathKey[] = "path";
+const char kValueKey[] = "value";
+
+const char kAddOp[] = "add";
+const char kRemoveOp[] = "remove";
+const char kReplaceOp[] = "replace";
+
+// How far ahead DiffLists() looks for an element that matches again after
+// elements were inserted or removed.
+const size_t kListLookahead = 8;
+
+// Returns whether |value| is a dictionary or list that holds dictionaries or
+// lists.
+bool HoldsContainers(const Value& value) {
+  if (value.is_dict()) {
+    for (const auto& item : value.DictItems()) {
+      if (item.second.is_dict() || item.second.is_list())
+        return true;
+    }
+  } else if (value.is_list()) {
+    for (const Value& element : value.GetList()) {
+      if (element.is_dict() || element.is_list())
+        return true;
+    }
+  }
+  return false;
+}
+
+// Appends the JSON Pointer token for |key| to |path|.
+void AppendKeyToken(StringPiece key, std::string* path) {
+  path->push_back('/');
+  for (char c : key) {
+    if (c == '~')
+      path->append("~0");
+    else if (c == '/')
+      path->append("~1");
+    else
+      path->push_back(c);
+  }
+}
+
+void AppendIndexToken(size_t index, std::string* path) {
+  path->push_back('/');
+  path->append(NumberToString(index));
+}
+
+// Decodes the escape sequences of a JSON Pointer token. Returns false if it
+// contains an invalid one.
+bool UnescapeToken(StringPiece token, std::string* key) {
+  key->clear();
+  key->reserve(token.size());
+  for (size_t i = 0; i < token.size(); ++i) {
+    if (token[i] != '~') {
+      key->push_back(token[i]);
+      continue;
+    }
+    if (i + 1 == token.size())
+      return false;
+    ++i;
+    if (token[i] == '0')
+      key->push_back('~');
+    else if (token[i] == '1')
+      key->push_back('/');
+    else
+      return false;
+  }
+  return true;
+}
+
+// Parses a list index token, which is a decimal number without leading
+// zeros.
+bool ParseIndexToken(StringPiece token, size_t* index) {
+  if (token.empty() || (token.size() > 1 && token[0] == '0'))
+    return false;
+  for (char c : token) {
+    if (!IsAsciiDigit(c))
+      return false;
+  }
+  return StringToSizeT(token, index);
+}
+
+// Returns the value that |pointer| refers to, starting at |root|, or nullptr
+// if there is none.
+Value* ResolvePointer(Value* root, StringPiece pointer) {
+  Value* cur = root;
+  std::string key;
+  while (!pointer.empty()) {
+    if (pointer[0] != '/')
+      return nullptr;
+    pointer.remove_prefix(1);
+    size_t end = std::min(pointer.find('/'), pointer.size());
+    StringPiece token = pointer.substr(0, end);
+    pointer.remove_prefix(end);
+
+    if (cur->is_dict()) {
+      if (!UnescapeToken(token, &key) || !(cur = cur->FindKey(key)))
+        return nullptr;
+    } else if (cur->is_list()) {
+      size_t index;
+      if (!ParseIndexToken(token, &index) || index >= cur->GetList().size())
+        return nullptr;
+      cur = &cur->GetList()[index];
+    } else {
+      return nullptr;
+    }
+  }
+  return cur;
+}
+
+// Collects the operations that turn one tree into another. |path_| is the
+// JSON Pointer of the values being compared.
+class ValueDiffer {
+ public:
+  ValueDiffer()
+      : op_key_(kOpKey), path_key_(kPathKey), value_key_(kValueKey) {}
+  ValueDiffer(const ValueDiffer&) = delete;
+  ValueDiffer& operator=(const ValueDiffer&) = delete;
+
+  Value::ListStorage TakeOperations() { return std::move(operations_); }
+
+  void Diff(const Value& from, const Value& to) {
+    if (from.type() != to.type()) {
+      AddOperation(kReplaceOp, &to);
+      return;
+    }
+    switch (from.type()) {
+      case Value::Type::DICTIONARY:
+        DiffDicts(from, to);
+        return;
+      case Value::Type::LIST:
+        DiffLists(from.GetList(), to.GetList());
+        return;
+      default:
+        if (from != to)
+          AddOperation(kReplaceOp, &to);
+        return;
+    }
+  }
+
+ private:
+  // Walks both sets of keys in their sorted order.
+  void DiffDicts(const Value& from, const Value& to) {
+    const size_t path_length = path_.size();
+    auto from_items = from.DictItems();
+    auto to_items = to.DictItems();
+    auto from_it = from_items.begin();
+    auto to_it = to_items.begin();
+    while (from_it != from_items.end() || to_it != to_items.end()) {
+      if (to_it == to_items.end() ||
+          (from_it != from_items.end() && (*from_it).first < (*to_it).first)) {
+        AppendKeyToken((*from_it).first, &path_);
+        AddOperation(kRemoveOp, nullptr);
+        ++from_it;
+      } else if (from_it == from_items.end() ||
+                 (*to_it).first < (*from_it).first) {
+        AppendKeyToken((*to_it).first, &path_);
+        AddOperation(kAddOp, &(*to_it).second);
+        ++to_it;
+      } else {
+        AppendKeyToken((*from_it).first, &path_);
+        Diff((*from_it).second, (*to_it).second);
+        ++from_it;
+        ++to_it;
+      }
+      path_.resize(path_length);
+    }
+  }
+
+  // Skips the elements that the lists end with, then walks both lists. Where
+  // elements differ, an element that matches again within kListLookahead
+  // positions of either list is taken to mean that the elements before it
+  // were inserted or removed; otherwise the two elements are compared. Once
+  // the elements up to a position of |to| have been handled, the patched list
+  // matches |to| up to there, so that position is the index of the next
+  // operation.
+  void DiffLists(const Value::ListStorage& from,
+                 const Value::ListStorage& to) {
+    size_t from_end = from.size();
+    size_t to_end = to.size();
+    while (from_end > 0 && to_end > 0 &&
+           Equal(from[from_end - 1], to[to_end - 1])) {
+      --from_end;
+      --to_end;
+    }
+
+    size_t i = 0;
+    size_t j = 0;
+    while (i < from_end && j < to_end) {
+      if (Equal(from[i], to[j])) {
+        ++i;
+        ++j;
+        continue;
+      }
+      size_t skip = 1;
+      for (; skip <= kListLookahead; ++skip) {
+        if (i + skip < from_end && Equal(from[i + skip], to[j])) {
+          RemoveListElements(j, skip);
+          i += skip;
+          break;
+        }
+        if (j + skip < to_end && Equal(from[i], to[j + skip])) {
+          AddListElements(to, j, j + skip);
+          j += skip;
+          break;
+        }
+      }
+      if (skip > kListLookahead) {
+        const size_t path_length = path_.size();
+        AppendIndexToken(j, &path_);
+        Diff(from[i], to[j]);
+        path_.resize(path_length);
+        ++i;
+        ++j;
+      }
+    }
+    RemoveListElements(j, from_end - i);
+    AddListElements(to, j, to_end);
+  }
+
+  // Adds to[begin, end) at the same indices of the list at |path_|.
+  void AddListElements(const Value::ListStorage& to,
+                       size_t begin,
+                       size_t end) {
+    const size_t path_length = path_.size();
+    for (size_t i = begin; i < end; ++i) {
+      if (end == to.size())
+        path_.append("/-");
+      else
+        AppendIndexToken(i, &path_);
+      AddOperation(kAddOp, &to[i]);
+      path_.resize(path_length);
+    }
+  }
+
+  // Removes |count| elements at |index| of the list at |path_|. Removing at
+  // the same index repeatedly removes the following elements.
+  void RemoveListElements(size_t index, size_t count) {
+    const size_t path_length = path_.size();
+    for (size_t i = 0; i < count; ++i) {
+      AppendIndexToken(index, &path_);
+      AddOperation(kRemoveOp, nullptr);
+      path_.resize(path_length);
+    }
+  }
+
+  // Compares list elements. Comparing elements that differ can walk far into
+  // them, and Diff() then walks them again, and so on down every level of
+  // nested lists. So once elements that hold dictionaries or lists turn out
+  // to differ, they are hashed, along with what they hold, and comparing any
+  // of these again stops at differing hashes.
+  bool Equal(const Value& a, const Value& b) {
+    if (a.type() != b.type())
+      return false;
+    if (!a.is_dict() && !a.is_list())
+      return a == b;
+    auto a_hash = hashes_.find(&a);
+    auto b_hash = hashes_.find(&b);
+    if (a_hash != hashes_.end() && b_hash != hashes_.end())
+      return a_hash->second == b_hash->second && a == b;
+    if (a == b)
+      return true;
+    if (HoldsContainers(a))
+      SubtreeHash(a);
+    if (HoldsContainers(b))
+      SubtreeHash(b);
+    return false;
+  }
+
+  // Returns a hash of |value| and everything below it. The hashes of the
+  // dictionaries and lists that hold dictionaries or lists are kept, so that
+  // each value is hashed once however deeply the lists are nested.
+  size_t SubtreeHash(const Value& value) {
+    if (value.is_dict() || value.is_list()) {
+      auto it = hashes_.find(&value);
+      if (it != hashes_.end())
+        return it->second;
+    }
+
+    size_t hash = 0;
+    bool has_containers = false;
+    switch (value.type()) {
+      case Value::Type::NONE:
+        break;
+      case Value::Type::BOOLEAN:
+        hash = value.GetBool();
+        break;
+      case Value::Type::INTEGER:
+        hash = static_cast<uint32_t>(value.GetInt());
+        break;
+      case Value::Type::DOUBLE: {
+        // 0.0 and -0.0 are equal.
+        double number = value.GetDouble() + 0.0;
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        hash = HashInts64(bits >> 32, bits & 0xFFFFFFFF);
+        break;
+      }
+      case Value::Type::STRING:
+        hash = Hash(value.GetString());
+        break;
+      case Value::Type::BINARY: {
+        const Value::BlobStorage& blob = value.GetBlob();
+        hash = Hash(blob.data(), blob.size());
+        break;
+      }
+      case Value::Type::DICTIONARY:
+        for (const auto& item : value.DictItems()) {
+          hash = HashInts64(
+              hash, HashInts64(Hash(item.first), SubtreeHash(item.second)));
+          has_containers |= item.second.is_dict() || item.second.is_list();
+        }
+        break;
+      case Value::Type::LIST:
+        for (const Value& element : value.GetList()) {
+          hash = HashInts64(hash, SubtreeHash(element));
+          has_containers |= element.is_dict() || element.is_list();
+        }
+        break;
+    }
+    hash = HashInts64(static_cast<uint64_t>(value.type()), hash);
+    if (has_containers)
+      hashes_.emplace(&value, hash);
+    return hash;
+  }
+
+  // Adds an operation on |path_|, with a copy of |value| if it is not null.
+  void AddOperation(const char* op, const Value* value) {
+    std::vector<Value::DictStorage::value_type> entries;
+    entries.reserve(3);
+    entries.emplace_back(op_key_, Value(op));
+    entries.emplace_back(path_key_, Value(path_));
+    if (value)
+      entries.emplace_back(value_key_, value->Clone());
+    operations_.emplace_back(Value::DictStorage(std::move(entries)));
+  }
+
+  // The keys of every operation, which are short enough to copy cheaply.
+  const ValueKey op_key_;
+  const ValueKey path_key_;
+  const ValueKey value_key_;
+
+  std::string path_;
+  Value::ListStorage operations_;
+
+  // The hashes of the dictionaries and lists of both trees that hold
+  // dictionaries or lists, computed so far.
+  std::unordered_map<const Value*, size_t> hashes_;
+};
+
+bool ApplyOperation(const Value& operation, Value* root) {
+  if (!operation.is_dict())
+    return false;
+  const Value* op = operation.FindKeyOfType(kOpKey, Value::Type::STRING);
+  const Value* path = operation.FindKeyOfType(kPathKey, Value::Type::STRING);
+  if (!op || !path)
+    return false;
+
+  const std::string& name = op->GetString();
+  const bool is_add = name == kAddOp;
+  const bool is_remove = name == kRemoveOp;
+  const bool is_replace = name == kReplaceOp;
+  const Value* value = operation.FindKey(kValueKey);
+  if (!(is_add || is_remove || is_replace) || (!is_remove && !value))
+    return false;
+
+  StringPiece pointer = path->GetString();
+  if (pointer.empty()) {
+    if (is_remove)
+      return false;
+    *root = value->Clone();
+    return true;
+  }
+
+  const size_t last_slash = pointer.rfind('/');
+  if (last_slash == StringPiece::npos)
+    return false;
+  Value* parent = ResolvePointer(root, pointer.substr(0, last_slash));
+  if (!parent)
+    return false;
+  const StringPiece token = pointer.substr(last_slash + 1);
+
+  if (parent->is_dict()) {
+    std::string key;
+    if (!UnescapeToken(token, &key))
+      return false;
+    if (is_add) {
+      parent->SetKey(std::move(key), value->Clone());
+      return true;
+    }
+    if (is_remove)
+      return parent->RemoveKey(key);
+    Value* target = parent->FindKey(key);
+    if (!target)
+      return false;
+    *target = value->Clone();
+    return true;
+  }
+
+  if (parent->is_list()) {
+    Value::ListStorage& list = parent->GetList();
+    size_t index;
+    if (is_add) {
+      if (token == "-") {
+        index = list.size();
+      } else if (!ParseIndexToken(token, &index) || index > list.size()) {
+        return false;
+      }
+      list.insert(list.begin() + index, value->Clone());
+      return true;
+    }
+    if (!ParseIndexToken(token, &index) || index >= list.size())
+      return false;
+    if (is_remove)
+      list.erase(list.begin() + index);
+    else
+      list[index] = value->Clone();
+    return true;
+  }
+
+  return false;
+}
+
+}  // namespace
+
+Value ComputeValueDiff(const Value& from, const Value& to) {
+  ValueDiffer differ;
+  differ.Diff(from, to);
+  return Value(differ.TakeOperations());
+}
+
+bool ApplyValuePatch(const Value& patch, Value* value) {
+  if (!patch.is_list())
+    return false;
+  for (const Value& operation : patch.GetList()) {
+    if (!ApplyOperation(operation, value))
+      return false;
+  }
+  return true;
+}
+
+}  // namespace winbase
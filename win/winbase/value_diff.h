@@ -0,0 +1,49 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Structural differences between Value trees, for sending a small update
+// instead of a whole tree when only a few leaves change.
+//
+//   Value patch = ComputeValueDiff(old_config, new_config);
+//   ... send JSONWriter::Write(patch) ...
+//   ApplyValuePatch(patch, &config);  // |config| now equals |new_config|.
+//
+// A patch is a list of operations in the form of a JSON Patch (RFC 6902),
+// restricted to the operations "add", "remove" and "replace":
+//
+//   [{"op": "replace", "path": "/browser/homepage", "value": "about:blank"},
+//    {"op": "remove", "path": "/plugins/2"},
+//    {"op": "add", "path": "/sync/types/-", "value": "bookmarks"}]
+//
+// Paths are JSON Pointers (RFC 6901): "" is the whole tree, and every
+// "/token" selects a dictionary entry by key or a list element by index, with
+// "~" and "/" in keys written as "~0" and "~1". Adding to a list inserts
+// before the element at the index, or appends for the index "-". The
+// operations are applied in order, each to the result of the previous ones.
+
+#ifndef WINLIB_WINBASE_VALUE_DIFF_H_
+#define WINLIB_WINBASE_VALUE_DIFF_H_
+
+#include "winbase\base_export.h"
+#include "winbase\values.h"
+
+namespace winbase {
+
+// Returns a patch that turns |from| into |to|, as a list Value. The patch is
+// empty if the trees are equal. Dictionaries are compared by walking their
+// sorted keys side by side, and lists element by element after skipping
+// their common beginning and end, so the time taken is linear in the size of
+// the trees. Changes inside lists other than at one place may produce more
+// operations than needed, but never a wrong patch.
+WINBASE_EXPORT Value ComputeValueDiff(const Value& from, const Value& to);
+
+// Applies the operations of |patch| to |value| in order. Returns false if
+// |patch| is not a list of valid operations, or if an operation refers to an
+// entry that does not exist; the operations before the one that failed stay
+// applied in that case.
+WINBASE_EXPORT bool ApplyValuePatch(const Value& patch, Value* value);
+
+}  // namespace winbase
+
+#endif  // WINLIB_WINBASE_VALUE_DIFF_H_
@@ -4,6 +4,8 @@
 
 #include "winbase\value_iterators.h"
 
+#include "winbase\values.h"
+
 namespace winbase {
 
 namespace detail {
@@ -26,7 +28,7 @@ dict_iterator& dict_iterator::operator=(const dict_iterator& dict_iter) =
 dict_iterator::~dict_iterator() = default;
 
 dict_iterator::reference dict_iterator::operator*() {
-  return {dict_iter_->first, *dict_iter_->second};
+  return {dict_iter_->first, dict_iter_->second};
 }
 
 dict_iterator::pointer dict_iterator::operator->() {
@@ -82,7 +84,7 @@ const_dict_iterator& const_dict_iterator::operator=(
 const_dict_iterator::~const_dict_iterator() = default;
 
 const_dict_iterator::reference const_dict_iterator::operator*() const {
-  return {dict_iter_->first, *dict_iter_->second};
+  return {dict_iter_->first, dict_iter_->second};
 }
 
 const_dict_iterator::pointer const_dict_iterator::operator->() const {
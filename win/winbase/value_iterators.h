@@ -12,6 +12,7 @@
 #include "winbase\base_export.h"
 #include "winbase\containers\flat_map.h"
 #include "winbase\macros.h"
+#include "winbase\value_key.h"
 
 namespace winbase {
 
@@ -19,10 +20,10 @@ class Value;
 
 namespace detail {
 
-using DictStorage = winbase::flat_map<std::string, std::unique_ptr<Value>>;
+using DictStorage = winbase::flat_map<ValueKey, Value>;
 
 // This iterator closely resembles DictStorage::iterator, with one
-// important exception. It abstracts the underlying unique_ptr away, meaning its
+// important exception. It abstracts the underlying ValueKey away, meaning its
 // value_type is std::pair<const std::string, Value>. It's reference type is a
 // std::pair<const std::string&, Value&>, so that callers have read-write
 // access without incurring a copy.
@@ -68,7 +69,7 @@ class WINBASE_EXPORT dict_iterator {
 };
 
 // This iterator closely resembles DictStorage::const_iterator, with one
-// important exception. It abstracts the underlying unique_ptr away, meaning its
+// important exception. It abstracts the underlying ValueKey away, meaning its
 // value_type is std::pair<const std::string, Value>. It's reference type is a
 // std::pair<const std::string&, const Value&>, so that callers have read-only
 // access without incurring a copy.
@@ -121,7 +122,7 @@ class WINBASE_EXPORT const_dict_iterator {
 class WINBASE_EXPORT dict_iterator_proxy {
  public:
   using key_type = DictStorage::key_type;
-  using mapped_type = DictStorage::mapped_type::element_type;
+  using mapped_type = DictStorage::mapped_type;
   using value_type = std::pair<key_type, mapped_type>;
   using key_compare = DictStorage::key_compare;
   using size_type = DictStorage::size_type;
@@ -160,7 +161,7 @@ class WINBASE_EXPORT dict_iterator_proxy {
 class WINBASE_EXPORT const_dict_iterator_proxy {
  public:
   using key_type = const DictStorage::key_type;
-  using mapped_type = const DictStorage::mapped_type::element_type;
+  using mapped_type = const DictStorage::mapped_type;
   using value_type = std::pair<key_type, mapped_type>;
   using key_compare = DictStorage::key_compare;
   using size_type = DictStorage::size_type;
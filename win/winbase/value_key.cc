@@ -0,0 +1,108 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "winbase\value_key.h"
+
+#include <new>
+#include <utility>
+
+namespace winbase {
+
+namespace {
+
+// Returns true if |lhs| and |rhs| are the same characters in memory.
+bool SameStorage(StringPiece lhs, StringPiece rhs) {
+  return lhs.data() == rhs.data() && lhs.size() == rhs.size();
+}
+
+}  // namespace
+
+ValueKey::ValueKey() : is_shared_(false), owned_() {}
+
+ValueKey::ValueKey(StringPiece key)
+    : is_shared_(false), owned_(key.data(), key.size()) {}
+
+ValueKey::ValueKey(std::string&& key)
+    : is_shared_(false), owned_(std::move(key)) {}
+
+ValueKey::ValueKey(const char* key) : is_shared_(false), owned_(key) {}
+
+ValueKey::ValueKey(scoped_refptr<SharedKey> shared)
+    : is_shared_(true), shared_(std::move(shared)) {}
+
+ValueKey::ValueKey(const ValueKey& other) {
+  InternalCopyFrom(other);
+}
+
+ValueKey& ValueKey::operator=(const ValueKey& other) {
+  if (&other != this) {
+    InternalCleanup();
+    InternalCopyFrom(other);
+  }
+  return *this;
+}
+
+void ValueKey::InternalCopyFrom(const ValueKey& other) {
+  is_shared_ = other.is_shared_;
+  if (is_shared_)
+    new (&shared_) scoped_refptr<SharedKey>(other.shared_);
+  else
+    new (&owned_) std::string(other.owned_);
+}
+
+void ValueKey::InternalReplaceWith(ValueKey&& other) {
+  InternalCleanup();
+  InternalMoveFrom(std::move(other));
+}
+
+bool operator==(const ValueKey& lhs, const ValueKey& rhs) {
+  return lhs.SharesStorageWith(rhs) || lhs.str() == rhs.str();
+}
+
+bool operator!=(const ValueKey& lhs, const ValueKey& rhs) {
+  return !(lhs == rhs);
+}
+
+bool operator<(const ValueKey& lhs, const ValueKey& rhs) {
+  return !lhs.SharesStorageWith(rhs) && lhs.str() < rhs.str();
+}
+
+bool operator==(const ValueKey& lhs, StringPiece rhs) {
+  return SameStorage(lhs.str(), rhs) || StringPiece(lhs.str()) == rhs;
+}
+
+bool operator==(StringPiece lhs, const ValueKey& rhs) {
+  return rhs == lhs;
+}
+
+bool operator!=(const ValueKey& lhs, StringPiece rhs) {
+  return !(lhs == rhs);
+}
+
+bool operator!=(StringPiece lhs, const ValueKey& rhs) {
+  return !(rhs == lhs);
+}
+
+bool operator<(const ValueKey& lhs, StringPiece rhs) {
+  return !SameStorage(lhs.str(), rhs) && StringPiece(lhs.str()) < rhs;
+}
+
+bool operator<(StringPiece lhs, const ValueKey& rhs) {
+  return !SameStorage(lhs, rhs.str()) && lhs < StringPiece(rhs.str());
+}
+
+ValueKeyTable::ValueKeyTable() = default;
+
+ValueKeyTable::~ValueKeyTable() = default;
+
+ValueKey ValueKeyTable::Intern(StringPiece key) {
+  auto found = keys_.find(key);
+  if (found != keys_.end())
+    return found->second;
+  ValueKey interned(new ValueKey::SharedKey(key.as_string()));
+  keys_.emplace(interned.str(), interned);
+  return interned;
+}
+
+}  // namespace winbase
@@ -0,0 +1,140 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef WINLIB_WINBASE_VALUE_KEY_H_
+#define WINLIB_WINBASE_VALUE_KEY_H_
+
+#include <stddef.h>
+
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "winbase\base_export.h"
+#include "winbase\memory\ref_counted.h"
+#include "winbase\strings\string_piece.h"
+
+namespace winbase {
+
+// The key of a dictionary entry in a Value. A ValueKey is an immutable string.
+// By default it owns its characters like a std::string; keys obtained from a
+// ValueKeyTable instead share one reference counted copy of them, so copying
+// such a key does not copy the string. Two keys that share storage compare
+// equal without looking at the characters. A ValueKey converts to
+// const std::string&, so code written against std::string keys keeps working.
+class WINBASE_EXPORT ValueKey {
+ public:
+  // Creates the empty key.
+  ValueKey();
+
+  explicit ValueKey(StringPiece key);
+  explicit ValueKey(std::string&& key);
+  // This overload is necessary to avoid ambiguity for const char* arguments.
+  explicit ValueKey(const char* key);
+
+  ValueKey(const ValueKey& other);
+  // Keys are moved whenever the entries of a dictionary are, so moving and
+  // destroying them is inline.
+  ValueKey(ValueKey&& other) noexcept { InternalMoveFrom(std::move(other)); }
+  ValueKey& operator=(const ValueKey& other);
+  ValueKey& operator=(ValueKey&& other) noexcept {
+    if (&other == this)
+      return *this;
+    if (!is_shared_ && !other.is_shared_)
+      owned_ = std::move(other.owned_);
+    else
+      InternalReplaceWith(std::move(other));
+    return *this;
+  }
+
+  ~ValueKey() { InternalCleanup(); }
+
+  const std::string& str() const {
+    return is_shared_ ? shared_->data : owned_;
+  }
+  operator const std::string&() const { return str(); }
+
+  // Returns true if this key and |other| were obtained from the same
+  // ValueKeyTable for the same string, in which case they are equal.
+  bool SharesStorageWith(const ValueKey& other) const {
+    return is_shared_ && other.is_shared_ && shared_ == other.shared_;
+  }
+
+ private:
+  friend class ValueKeyTable;
+
+  using SharedKey = RefCountedData<std::string>;
+
+  explicit ValueKey(scoped_refptr<SharedKey> shared);
+
+  void InternalCopyFrom(const ValueKey& other);
+  void InternalMoveFrom(ValueKey&& other) {
+    is_shared_ = other.is_shared_;
+    if (is_shared_)
+      new (&shared_) scoped_refptr<SharedKey>(std::move(other.shared_));
+    else
+      new (&owned_) std::string(std::move(other.owned_));
+  }
+  void InternalReplaceWith(ValueKey&& other);
+  void InternalCleanup() {
+    if (is_shared_)
+      shared_.~scoped_refptr<SharedKey>();
+    else
+      owned_.~basic_string();
+  }
+
+  // True if the characters are in |shared_| rather than |owned_|.
+  bool is_shared_;
+
+  union {
+    std::string owned_;
+    scoped_refptr<SharedKey> shared_;
+  };
+};
+
+// Compares first by storage, then by characters.
+WINBASE_EXPORT bool operator==(const ValueKey& lhs, const ValueKey& rhs);
+WINBASE_EXPORT bool operator!=(const ValueKey& lhs, const ValueKey& rhs);
+WINBASE_EXPORT bool operator<(const ValueKey& lhs, const ValueKey& rhs);
+
+// Comparisons with a StringPiece, so that a dictionary can be searched for a
+// key without creating a ValueKey. These compare by pointer first as well,
+// which is what happens when |rhs| was taken from a key of the dictionary.
+WINBASE_EXPORT bool operator==(const ValueKey& lhs, StringPiece rhs);
+WINBASE_EXPORT bool operator==(StringPiece lhs, const ValueKey& rhs);
+WINBASE_EXPORT bool operator!=(const ValueKey& lhs, StringPiece rhs);
+WINBASE_EXPORT bool operator!=(StringPiece lhs, const ValueKey& rhs);
+WINBASE_EXPORT bool operator<(const ValueKey& lhs, StringPiece rhs);
+WINBASE_EXPORT bool operator<(StringPiece lhs, const ValueKey& rhs);
+
+// Hands out ValueKeys that share storage: Intern() returns a key using the
+// same string for all calls with equal arguments. Passed to
+// JSONReader::ReadWithKeyTable() or BinaryValueReader::Node::ToValue(), a
+// table stores the keys that repeat in every element of a large list once; it
+// can also be kept by any other code that builds many dictionaries with the
+// same keys. Interning costs a lookup per key, so it pays off only when keys
+// repeat. The keys stay valid after the table is destroyed. A table is not
+// thread-safe.
+class WINBASE_EXPORT ValueKeyTable {
+ public:
+  ValueKeyTable();
+  ValueKeyTable(const ValueKeyTable&) = delete;
+  ValueKeyTable& operator=(const ValueKeyTable&) = delete;
+  ~ValueKeyTable();
+
+  // Returns the key for |key|, creating it on first use.
+  ValueKey Intern(StringPiece key);
+
+  // Returns the number of distinct keys in the table.
+  size_t size() const { return keys_.size(); }
+
+ private:
+  // The StringPiece of every entry refers to the storage of its key.
+  std::unordered_map<StringPiece, ValueKey, StringPieceHash> keys_;
+};
+
+}  // namespace winbase
+
+#endif  // WINLIB_WINBASE_VALUE_KEY_H_
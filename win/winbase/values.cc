@@ -74,6 +74,24 @@ std::unique_ptr<Value> CopyWithoutEmptyChildren(const Value& node) {
   }
 }
 
+// Copies the entries of a dictionary or list. The children of shared storage
+// are normally shared themselves, so that this only takes a reference to them.
+Value::DictStorage CopyDictStorage(const Value::DictStorage& dict) {
+  Value::DictStorage copy;
+  copy.reserve(dict.size());
+  for (const auto& it : dict)
+    copy.try_emplace(copy.end(), it.first, it.second.Clone());
+  return copy;
+}
+
+Value::ListStorage CopyListStorage(const Value::ListStorage& list) {
+  Value::ListStorage copy;
+  copy.reserve(list.size());
+  for (const auto& val : list)
+    copy.emplace_back(val.Clone());
+  return copy;
+}
+
 }  // namespace
 
 // static
@@ -160,22 +178,14 @@ Value::Value(const BlobStorage& in_blob)
 Value::Value(BlobStorage&& in_blob) noexcept
     : type_(Type::BINARY), binary_value_(std::move(in_blob)) {}
 
-Value::Value(const DictStorage& in_dict) : type_(Type::DICTIONARY), dict_() {
-  dict_.reserve(in_dict.size());
-  for (const auto& it : in_dict) {
-    dict_.try_emplace(dict_.end(), it.first,
-                      std::make_unique<Value>(it.second->Clone()));
-  }
-}
+Value::Value(const DictStorage& in_dict)
+    : type_(Type::DICTIONARY), dict_(CopyDictStorage(in_dict)) {}
 
 Value::Value(DictStorage&& in_dict) noexcept
     : type_(Type::DICTIONARY), dict_(std::move(in_dict)) {}
 
-Value::Value(const ListStorage& in_list) : type_(Type::LIST), list_() {
-  list_.reserve(in_list.size());
-  for (const auto& val : in_list)
-    list_.emplace_back(val.Clone());
-}
+Value::Value(const ListStorage& in_list)
+    : type_(Type::LIST), list_(CopyListStorage(in_list)) {}
 
 Value::Value(ListStorage&& in_list) noexcept
     : type_(Type::LIST), list_(std::move(in_list)) {}
@@ -202,8 +212,22 @@ Value Value::Clone() const {
     case Type::BINARY:
       return Value(binary_value_);
     case Type::DICTIONARY:
+      if (is_shared_) {
+        Value copy;
+        copy.type_ = Type::DICTIONARY;
+        copy.is_shared_ = true;
+        new (&copy.shared_dict_) scoped_refptr<SharedDict>(shared_dict_);
+        return copy;
+      }
       return Value(dict_);
     case Type::LIST:
+      if (is_shared_) {
+        Value copy;
+        copy.type_ = Type::LIST;
+        copy.is_shared_ = true;
+        new (&copy.shared_list_) scoped_refptr<SharedList>(shared_list_);
+        return copy;
+      }
       return Value(list_);
   }
 
@@ -211,6 +235,33 @@ Value Value::Clone() const {
   return Value();
 }
 
+void Value::Share() {
+  if (is_dict()) {
+    // Storage that other Values share already has shared children.
+    if (is_shared_ && !shared_dict_->HasOneRef())
+      return;
+    for (auto& entry : mutable_dict())
+      entry.second.Share();
+    if (!is_shared_) {
+      scoped_refptr<SharedDict> shared(new SharedDict(std::move(dict_)));
+      dict_.~DictStorage();
+      new (&shared_dict_) scoped_refptr<SharedDict>(std::move(shared));
+      is_shared_ = true;
+    }
+  } else if (is_list()) {
+    if (is_shared_ && !shared_list_->HasOneRef())
+      return;
+    for (auto& val : mutable_list())
+      val.Share();
+    if (!is_shared_) {
+      scoped_refptr<SharedList> shared(new SharedList(std::move(list_)));
+      list_.~ListStorage();
+      new (&shared_list_) scoped_refptr<SharedList>(std::move(shared));
+      is_shared_ = true;
+    }
+  }
+}
+
 Value::~Value() {
   InternalCleanup();
 }
@@ -253,29 +304,55 @@ const Value::BlobStorage& Value::GetBlob() const {
 
 Value::ListStorage& Value::GetList() {
   WINBASE_CHECK(is_list());
-  return list_;
+  return mutable_list();
 }
 
 const Value::ListStorage& Value::GetList() const {
   WINBASE_CHECK(is_list());
-  return list_;
+  return list();
 }
 
+// The non-const lookups copy shared storage first, since the caller may
+// modify what they return.
 Value* Value::FindKey(StringPiece key) {
-  return const_cast<Value*>(static_cast<const Value*>(this)->FindKey(key));
+  WINBASE_CHECK(is_dict());
+  DictStorage& storage = mutable_dict();
+  auto found = storage.find(key);
+  if (found == storage.end())
+    return nullptr;
+  return &found->second;
 }
 
 const Value* Value::FindKey(StringPiece key) const {
   WINBASE_CHECK(is_dict());
-  auto found = dict_.find(key);
-  if (found == dict_.end())
+  auto found = dict().find(key);
+  if (found == dict().end())
     return nullptr;
-  return found->second.get();
+  return &found->second;
+}
+
+Value* Value::FindKey(const ValueKey& key) {
+  WINBASE_CHECK(is_dict());
+  DictStorage& storage = mutable_dict();
+  auto found = storage.find(key);
+  if (found == storage.end())
+    return nullptr;
+  return &found->second;
+}
+
+const Value* Value::FindKey(const ValueKey& key) const {
+  WINBASE_CHECK(is_dict());
+  auto found = dict().find(key);
+  if (found == dict().end())
+    return nullptr;
+  return &found->second;
 }
 
 Value* Value::FindKeyOfType(StringPiece key, Type type) {
-  return const_cast<Value*>(
-      static_cast<const Value*>(this)->FindKeyOfType(key, type));
+  Value* result = FindKey(key);
+  if (!result || result->type() != type)
+    return nullptr;
+  return result;
 }
 
 const Value* Value::FindKeyOfType(StringPiece key, Type type) const {
@@ -285,43 +362,63 @@ const Value* Value::FindKeyOfType(StringPiece key, Type type) const {
   return result;
 }
 
+void Value::SetKeys(std::vector<DictStorage::value_type> entries) {
+  WINBASE_CHECK(is_dict());
+  DictStorage& storage = mutable_dict();
+  if (storage.empty()) {
+    storage = DictStorage(std::move(entries), KEEP_LAST_OF_DUPES);
+    return;
+  }
+  storage.insert(std::make_move_iterator(entries.begin()),
+                 std::make_move_iterator(entries.end()), KEEP_LAST_OF_DUPES);
+}
+
 bool Value::RemoveKey(StringPiece key) {
   WINBASE_CHECK(is_dict());
   // NOTE: Can't directly return dict_->erase(key) due to MSVC warning C4800.
-  return dict_.erase(key) != 0;
+  return mutable_dict().erase(key) != 0;
 }
 
 Value* Value::SetKey(StringPiece key, Value value) {
   WINBASE_CHECK(is_dict());
   // NOTE: We can't use |insert_or_assign| here, as only |try_emplace| does
-  // an explicit conversion from StringPiece to std::string if necessary.
-  auto val_ptr = std::make_unique<Value>(std::move(value));
-  auto result = dict_.try_emplace(key, std::move(val_ptr));
+  // an explicit conversion from StringPiece to ValueKey if necessary.
+  auto result = mutable_dict().try_emplace(key, std::move(value));
   if (!result.second) {
-    // val_ptr is guaranteed to be still intact at this point.
-    result.first->second = std::move(val_ptr);
+    // value is guaranteed to be still intact at this point.
+    result.first->second = std::move(value);
   }
-  return result.first->second.get();
+  return &result.first->second;
 }
 
 Value* Value::SetKey(std::string&& key, Value value) {
   WINBASE_CHECK(is_dict());
-  return dict_
-      .insert_or_assign(std::move(key),
-                        std::make_unique<Value>(std::move(value)))
-      .first->second.get();
+  return &mutable_dict().insert_or_assign(std::move(key), std::move(value))
+              .first->second;
 }
 
 Value* Value::SetKey(const char* key, Value value) {
   return SetKey(StringPiece(key), std::move(value));
 }
 
+Value* Value::SetKey(ValueKey key, Value value) {
+  WINBASE_CHECK(is_dict());
+  return &mutable_dict().insert_or_assign(std::move(key), std::move(value))
+              .first->second;
+}
+
 Value* Value::FindPath(std::initializer_list<StringPiece> path) {
-  return const_cast<Value*>(const_cast<const Value*>(this)->FindPath(path));
+  WINBASE_DCHECK_GE(path.size(), 2u) << "Use FindKey() for a path of length 1.";
+  return FindPath(make_span(path.begin(), path.size()));
 }
 
 Value* Value::FindPath(span<const StringPiece> path) {
-  return const_cast<Value*>(const_cast<const Value*>(this)->FindPath(path));
+  Value* cur = this;
+  for (const StringPiece component : path) {
+    if (!cur->is_dict() || (cur = cur->FindKey(component)) == nullptr)
+      return nullptr;
+  }
+  return cur;
 }
 
 const Value* Value::FindPath(std::initializer_list<StringPiece> path) const {
@@ -340,13 +437,16 @@ const Value* Value::FindPath(span<const StringPiece> path) const {
 
 Value* Value::FindPathOfType(std::initializer_list<StringPiece> path,
                              Type type) {
-  return const_cast<Value*>(
-      const_cast<const Value*>(this)->FindPathOfType(path, type));
+  WINBASE_DCHECK_GE(path.size(), 2u)
+      << "Use FindKeyOfType() for a path of length 1.";
+  return FindPathOfType(make_span(path.begin(), path.size()), type);
 }
 
 Value* Value::FindPathOfType(span<const StringPiece> path, Type type) {
-  return const_cast<Value*>(
-      const_cast<const Value*>(this)->FindPathOfType(path, type));
+  Value* result = FindPath(path);
+  if (!result || result->type() != type)
+    return nullptr;
+  return result;
 }
 
 const Value* Value::FindPathOfType(std::initializer_list<StringPiece> path,
@@ -382,14 +482,15 @@ Value* Value::SetPath(span<const StringPiece> path, Value value) {
 
     // Use lower_bound to avoid doing the search twice for missing keys.
     const StringPiece path_component = *cur_path;
-    auto found = cur->dict_.lower_bound(path_component);
-    if (found == cur->dict_.end() || found->first != path_component) {
+    DictStorage& storage = cur->mutable_dict();
+    auto found = storage.lower_bound(path_component);
+    if (found == storage.end() || found->first != path_component) {
       // No key found, insert one.
-      auto inserted = cur->dict_.try_emplace(
-          found, path_component, std::make_unique<Value>(Type::DICTIONARY));
-      cur = inserted->second.get();
+      auto inserted =
+          storage.try_emplace(found, path_component, Type::DICTIONARY);
+      cur = &inserted->second;
     } else {
-      cur = found->second.get();
+      cur = &found->second;
     }
   }
 
@@ -412,35 +513,36 @@ bool Value::RemovePath(span<const StringPiece> path) {
   if (path.size() == 1)
     return RemoveKey(path[0]);
 
-  auto found = dict_.find(path[0]);
-  if (found == dict_.end() || !found->second->is_dict())
+  DictStorage& storage = mutable_dict();
+  auto found = storage.find(path[0]);
+  if (found == storage.end() || !found->second.is_dict())
     return false;
 
-  bool removed = found->second->RemovePath(path.subspan(1));
-  if (removed && found->second->dict_.empty())
-    dict_.erase(found);
+  bool removed = found->second.RemovePath(path.subspan(1));
+  if (removed && found->second.dict().empty())
+    storage.erase(found);
 
   return removed;
 }
 
 Value::dict_iterator_proxy Value::DictItems() {
   WINBASE_CHECK(is_dict());
-  return dict_iterator_proxy(&dict_);
+  return dict_iterator_proxy(&mutable_dict());
 }
 
 Value::const_dict_iterator_proxy Value::DictItems() const {
   WINBASE_CHECK(is_dict());
-  return const_dict_iterator_proxy(&dict_);
+  return const_dict_iterator_proxy(&dict());
 }
 
 size_t Value::DictSize() const {
   WINBASE_CHECK(is_dict());
-  return dict_.size();
+  return dict().size();
 }
 
 bool Value::DictEmpty() const {
   WINBASE_CHECK(is_dict());
-  return dict_.empty();
+  return dict().empty();
 }
 
 bool Value::GetAsBoolean(bool* out_value) const {
@@ -560,19 +662,14 @@ bool operator==(const Value& lhs, const Value& rhs) {
       return lhs.string_value_ == rhs.string_value_;
     case Value::Type::BINARY:
       return lhs.binary_value_ == rhs.binary_value_;
-    // TODO(crbug.com/646113): Clean this up when DictionaryValue and ListValue
-    // are completely inlined.
     case Value::Type::DICTIONARY:
-      if (lhs.dict_.size() != rhs.dict_.size())
-        return false;
-      return std::equal(std::begin(lhs.dict_), std::end(lhs.dict_),
-                        std::begin(rhs.dict_),
-                        [](const auto& u, const auto& v) {
-                          return std::tie(u.first, *u.second) ==
-                                 std::tie(v.first, *v.second);
-                        });
+      return (lhs.is_shared_ && rhs.is_shared_ &&
+              lhs.shared_dict_ == rhs.shared_dict_) ||
+             lhs.dict() == rhs.dict();
     case Value::Type::LIST:
-      return lhs.list_ == rhs.list_;
+      return (lhs.is_shared_ && rhs.is_shared_ &&
+              lhs.shared_list_ == rhs.shared_list_) ||
+             lhs.list() == rhs.list();
   }
 
   WINBASE_NOTREACHED();
@@ -600,18 +697,10 @@ bool operator<(const Value& lhs, const Value& rhs) {
       return lhs.string_value_ < rhs.string_value_;
     case Value::Type::BINARY:
       return lhs.binary_value_ < rhs.binary_value_;
-    // TODO(crbug.com/646113): Clean this up when DictionaryValue and ListValue
-    // are completely inlined.
     case Value::Type::DICTIONARY:
-      return std::lexicographical_compare(
-          std::begin(lhs.dict_), std::end(lhs.dict_), std::begin(rhs.dict_),
-          std::end(rhs.dict_),
-          [](const Value::DictStorage::value_type& u,
-             const Value::DictStorage::value_type& v) {
-            return std::tie(u.first, *u.second) < std::tie(v.first, *v.second);
-          });
+      return lhs.dict() < rhs.dict();
     case Value::Type::LIST:
-      return lhs.list_ < rhs.list_;
+      return lhs.list() < rhs.list();
   }
 
   WINBASE_NOTREACHED();
@@ -652,6 +741,7 @@ bool Value::Equals(const Value* other) const {
 
 void Value::InternalMoveConstructFrom(Value&& that) {
   type_ = that.type_;
+  is_shared_ = false;
 
   switch (type_) {
     case Type::NONE:
@@ -672,14 +762,49 @@ void Value::InternalMoveConstructFrom(Value&& that) {
       new (&binary_value_) BlobStorage(std::move(that.binary_value_));
       return;
     case Type::DICTIONARY:
+      if (that.is_shared_) {
+        // Leave |that| an empty dictionary that owns its storage.
+        new (&shared_dict_)
+            scoped_refptr<SharedDict>(std::move(that.shared_dict_));
+        that.shared_dict_.~scoped_refptr();
+        new (&that.dict_) DictStorage();
+        that.is_shared_ = false;
+        is_shared_ = true;
+        return;
+      }
       new (&dict_) DictStorage(std::move(that.dict_));
       return;
     case Type::LIST:
+      if (that.is_shared_) {
+        new (&shared_list_)
+            scoped_refptr<SharedList>(std::move(that.shared_list_));
+        that.shared_list_.~scoped_refptr();
+        new (&that.list_) ListStorage();
+        that.is_shared_ = false;
+        is_shared_ = true;
+        return;
+      }
       new (&list_) ListStorage(std::move(that.list_));
       return;
   }
 }
 
+Value::DictStorage& Value::mutable_dict() {
+  if (!is_shared_)
+    return dict_;
+  if (!shared_dict_->HasOneRef())
+    shared_dict_ = new SharedDict(CopyDictStorage(shared_dict_->data));
+  return shared_dict_->data;
+}
+
+Value::ListStorage& Value::mutable_list() {
+  if (!is_shared_)
+    return list_;
+  if (!shared_list_->HasOneRef())
+    shared_list_ = new SharedList(CopyListStorage(shared_list_->data));
+  return shared_list_->data;
+}
+
 void Value::InternalCleanup() {
   switch (type_) {
     case Type::NONE:
@@ -696,10 +821,16 @@ void Value::InternalCleanup() {
       binary_value_.~BlobStorage();
       return;
     case Type::DICTIONARY:
-      dict_.~DictStorage();
+      if (is_shared_)
+        shared_dict_.~scoped_refptr();
+      else
+        dict_.~DictStorage();
       return;
     case Type::LIST:
-      list_.~ListStorage();
+      if (is_shared_)
+        shared_list_.~scoped_refptr();
+      else
+        list_.~ListStorage();
       return;
   }
 }
@@ -724,13 +855,11 @@ DictionaryValue::DictionaryValue(DictStorage&& in_dict) noexcept
 
 bool DictionaryValue::HasKey(StringPiece key) const {
   WINBASE_DCHECK(IsStringUTF8(key));
-  auto current_entry = dict_.find(key);
-  WINBASE_DCHECK((current_entry == dict_.end()) || current_entry->second);
-  return current_entry != dict_.end();
+  return dict().find(key) != dict().end();
 }
 
 void DictionaryValue::Clear() {
-  dict_.clear();
+  mutable_dict().clear();
 }
 
 Value* DictionaryValue::Set(StringPiece path, std::unique_ptr<Value> in_value) {
@@ -794,13 +923,14 @@ Value* DictionaryValue::SetWithoutPathExpansion(
     StringPiece key,
     std::unique_ptr<Value> in_value) {
   // NOTE: We can't use |insert_or_assign| here, as only |try_emplace| does
-  // an explicit conversion from StringPiece to std::string if necessary.
-  auto result = dict_.try_emplace(key, std::move(in_value));
+  // an explicit conversion from StringPiece to ValueKey if necessary.
+  WINBASE_DCHECK(in_value);
+  auto result = mutable_dict().try_emplace(key, std::move(*in_value));
   if (!result.second) {
-    // in_value is guaranteed to be still intact at this point.
-    result.first->second = std::move(in_value);
+    // *in_value is guaranteed to be still intact at this point.
+    result.first->second = std::move(*in_value);
   }
-  return result.first->second.get();
+  return &result.first->second;
 }
 
 bool DictionaryValue::Get(StringPiece path,
@@ -825,9 +955,23 @@ bool DictionaryValue::Get(StringPiece path,
 }
 
 bool DictionaryValue::Get(StringPiece path, Value** out_value)  {
-  return static_cast<const DictionaryValue&>(*this).Get(
-      path,
-      const_cast<const Value**>(out_value));
+  WINBASE_DCHECK(IsStringUTF8(path));
+  StringPiece current_path(path);
+  DictionaryValue* current_dictionary = this;
+  for (size_t delimiter_position = current_path.find('.');
+       delimiter_position != std::string::npos;
+       delimiter_position = current_path.find('.')) {
+    DictionaryValue* child_dictionary = nullptr;
+    if (!current_dictionary->GetDictionaryWithoutPathExpansion(
+            current_path.substr(0, delimiter_position), &child_dictionary)) {
+      return false;
+    }
+
+    current_dictionary = child_dictionary;
+    current_path = current_path.substr(delimiter_position + 1);
+  }
+
+  return current_dictionary->GetWithoutPathExpansion(current_path, out_value);
 }
 
 bool DictionaryValue::GetBoolean(StringPiece path, bool* bool_value) const {
@@ -900,8 +1044,15 @@ bool DictionaryValue::GetBinary(StringPiece path,
 }
 
 bool DictionaryValue::GetBinary(StringPiece path, Value** out_value) {
-  return static_cast<const DictionaryValue&>(*this).GetBinary(
-      path, const_cast<const Value**>(out_value));
+  Value* value;
+  bool result = Get(path, &value);
+  if (!result || !value->is_blob())
+    return false;
+
+  if (out_value)
+    *out_value = value;
+
+  return true;
 }
 
 bool DictionaryValue::GetDictionary(StringPiece path,
@@ -919,9 +1070,15 @@ bool DictionaryValue::GetDictionary(StringPiece path,
 
 bool DictionaryValue::GetDictionary(StringPiece path,
                                     DictionaryValue** out_value) {
-  return static_cast<const DictionaryValue&>(*this).GetDictionary(
-      path,
-      const_cast<const DictionaryValue**>(out_value));
+  Value* value;
+  bool result = Get(path, &value);
+  if (!result || !value->is_dict())
+    return false;
+
+  if (out_value)
+    *out_value = static_cast<DictionaryValue*>(value);
+
+  return true;
 }
 
 bool DictionaryValue::GetList(StringPiece path,
@@ -938,28 +1095,39 @@ bool DictionaryValue::GetList(StringPiece path,
 }
 
 bool DictionaryValue::GetList(StringPiece path, ListValue** out_value) {
-  return static_cast<const DictionaryValue&>(*this).GetList(
-      path,
-      const_cast<const ListValue**>(out_value));
+  Value* value;
+  bool result = Get(path, &value);
+  if (!result || !value->is_list())
+    return false;
+
+  if (out_value)
+    *out_value = static_cast<ListValue*>(value);
+
+  return true;
 }
 
 bool DictionaryValue::GetWithoutPathExpansion(StringPiece key,
                                               const Value** out_value) const {
   WINBASE_DCHECK(IsStringUTF8(key));
-  auto entry_iterator = dict_.find(key);
-  if (entry_iterator == dict_.end())
+  auto entry_iterator = dict().find(key);
+  if (entry_iterator == dict().end())
     return false;
 
   if (out_value)
-    *out_value = entry_iterator->second.get();
+    *out_value = &entry_iterator->second;
   return true;
 }
 
 bool DictionaryValue::GetWithoutPathExpansion(StringPiece key,
                                               Value** out_value) {
-  return static_cast<const DictionaryValue&>(*this).GetWithoutPathExpansion(
-      key,
-      const_cast<const Value**>(out_value));
+  WINBASE_DCHECK(IsStringUTF8(key));
+  Value* value = FindKey(key);
+  if (!value)
+    return false;
+
+  if (out_value)
+    *out_value = value;
+  return true;
 }
 
 bool DictionaryValue::GetBooleanWithoutPathExpansion(StringPiece key,
@@ -1025,11 +1193,15 @@ bool DictionaryValue::GetDictionaryWithoutPathExpansion(
 bool DictionaryValue::GetDictionaryWithoutPathExpansion(
     StringPiece key,
     DictionaryValue** out_value) {
-  const DictionaryValue& const_this =
-      static_cast<const DictionaryValue&>(*this);
-  return const_this.GetDictionaryWithoutPathExpansion(
-          key,
-          const_cast<const DictionaryValue**>(out_value));
+  Value* value;
+  bool result = GetWithoutPathExpansion(key, &value);
+  if (!result || !value->is_dict())
+    return false;
+
+  if (out_value)
+    *out_value = static_cast<DictionaryValue*>(value);
+
+  return true;
 }
 
 bool DictionaryValue::GetListWithoutPathExpansion(
@@ -1048,10 +1220,15 @@ bool DictionaryValue::GetListWithoutPathExpansion(
 
 bool DictionaryValue::GetListWithoutPathExpansion(StringPiece key,
                                                   ListValue** out_value) {
-  return
-      static_cast<const DictionaryValue&>(*this).GetListWithoutPathExpansion(
-          key,
-          const_cast<const ListValue**>(out_value));
+  Value* value;
+  bool result = GetWithoutPathExpansion(key, &value);
+  if (!result || !value->is_list())
+    return false;
+
+  if (out_value)
+    *out_value = static_cast<ListValue*>(value);
+
+  return true;
 }
 
 bool DictionaryValue::Remove(StringPiece path,
@@ -1075,13 +1252,14 @@ bool DictionaryValue::RemoveWithoutPathExpansion(
     StringPiece key,
     std::unique_ptr<Value>* out_value) {
   WINBASE_DCHECK(IsStringUTF8(key));
-  auto entry_iterator = dict_.find(key);
-  if (entry_iterator == dict_.end())
+  DictStorage& storage = mutable_dict();
+  auto entry_iterator = storage.find(key);
+  if (entry_iterator == storage.end())
     return false;
 
   if (out_value)
-    *out_value = std::move(entry_iterator->second);
-  dict_.erase(entry_iterator);
+    *out_value = std::make_unique<Value>(std::move(entry_iterator->second));
+  storage.erase(entry_iterator);
   return true;
 }
 
@@ -1116,40 +1294,47 @@ std::unique_ptr<DictionaryValue> DictionaryValue::DeepCopyWithoutEmptyChildren()
 
 void DictionaryValue::MergeDictionary(const DictionaryValue* dictionary) {
   WINBASE_CHECK(dictionary->is_dict());
-  for (DictionaryValue::Iterator it(*dictionary); !it.IsAtEnd(); it.Advance()) {
-    const Value* merge_value = &it.value();
+  // The copies are set at once at the end, which keeps the pointers to the
+  // dictionaries merged into valid and avoids moving the existing entries for
+  // every new key.
+  std::vector<DictStorage::value_type> copies;
+  for (const auto& entry : dictionary->dict()) {
+    const Value* merge_value = &entry.second;
     // Check whether we have to merge dictionaries.
     if (merge_value->is_dict()) {
       DictionaryValue* sub_dict;
-      if (GetDictionaryWithoutPathExpansion(it.key(), &sub_dict)) {
+      if (GetDictionaryWithoutPathExpansion(entry.first.str(), &sub_dict)) {
         sub_dict->MergeDictionary(
             static_cast<const DictionaryValue*>(merge_value));
         continue;
       }
     }
     // All other cases: Make a copy and hook it up.
-    SetKey(it.key(), merge_value->Clone());
+    copies.emplace_back(entry.first, merge_value->Clone());
   }
+  SetKeys(std::move(copies));
 }
 
 void DictionaryValue::Swap(DictionaryValue* other) {
   WINBASE_CHECK(other->is_dict());
-  dict_.swap(other->dict_);
+  Value tmp = std::move(*other);
+  *static_cast<Value*>(other) = std::move(*this);
+  *static_cast<Value*>(this) = std::move(tmp);
 }
 
 DictionaryValue::Iterator::Iterator(const DictionaryValue& target)
-    : target_(target), it_(target.dict_.begin()) {}
+    : target_(target), it_(target.dict().begin()) {}
 
 DictionaryValue::Iterator::Iterator(const Iterator& other) = default;
 
 DictionaryValue::Iterator::~Iterator() = default;
 
 DictionaryValue* DictionaryValue::DeepCopy() const {
-  return new DictionaryValue(dict_);
+  return new DictionaryValue(dict());
 }
 
 std::unique_ptr<DictionaryValue> DictionaryValue::CreateDeepCopy() const {
-  return std::make_unique<DictionaryValue>(dict_);
+  return std::make_unique<DictionaryValue>(dict());
 }
 
 ///////////////////// ListValue ////////////////////
@@ -1170,38 +1355,44 @@ ListValue::ListValue(ListStorage&& in_list) noexcept
     : Value(std::move(in_list)) {}
 
 void ListValue::Clear() {
-  list_.clear();
+  mutable_list().clear();
 }
 
 void ListValue::Reserve(size_t n) {
-  list_.reserve(n);
+  mutable_list().reserve(n);
 }
 
 bool ListValue::Set(size_t index, std::unique_ptr<Value> in_value) {
   if (!in_value)
     return false;
 
-  if (index >= list_.size())
-    list_.resize(index + 1);
+  ListStorage& storage = mutable_list();
+  if (index >= storage.size())
+    storage.resize(index + 1);
 
-  list_[index] = std::move(*in_value);
+  storage[index] = std::move(*in_value);
   return true;
 }
 
 bool ListValue::Get(size_t index, const Value** out_value) const {
-  if (index >= list_.size())
+  if (index >= list().size())
     return false;
 
   if (out_value)
-    *out_value = &list_[index];
+    *out_value = &list()[index];
 
   return true;
 }
 
 bool ListValue::Get(size_t index, Value** out_value) {
-  return static_cast<const ListValue&>(*this).Get(
-      index,
-      const_cast<const Value**>(out_value));
+  ListStorage& storage = mutable_list();
+  if (index >= storage.size())
+    return false;
+
+  if (out_value)
+    *out_value = &storage[index];
+
+  return true;
 }
 
 bool ListValue::GetBoolean(size_t index, bool* bool_value) const {
@@ -1258,9 +1449,15 @@ bool ListValue::GetDictionary(size_t index,
 }
 
 bool ListValue::GetDictionary(size_t index, DictionaryValue** out_value) {
-  return static_cast<const ListValue&>(*this).GetDictionary(
-      index,
-      const_cast<const DictionaryValue**>(out_value));
+  Value* value;
+  bool result = Get(index, &value);
+  if (!result || !value->is_dict())
+    return false;
+
+  if (out_value)
+    *out_value = static_cast<DictionaryValue*>(value);
+
+  return true;
 }
 
 bool ListValue::GetList(size_t index, const ListValue** out_value) const {
@@ -1276,32 +1473,40 @@ bool ListValue::GetList(size_t index, const ListValue** out_value) const {
 }
 
 bool ListValue::GetList(size_t index, ListValue** out_value) {
-  return static_cast<const ListValue&>(*this).GetList(
-      index,
-      const_cast<const ListValue**>(out_value));
+  Value* value;
+  bool result = Get(index, &value);
+  if (!result || !value->is_list())
+    return false;
+
+  if (out_value)
+    *out_value = static_cast<ListValue*>(value);
+
+  return true;
 }
 
 bool ListValue::Remove(size_t index, std::unique_ptr<Value>* out_value) {
-  if (index >= list_.size())
+  ListStorage& storage = mutable_list();
+  if (index >= storage.size())
     return false;
 
   if (out_value)
-    *out_value = std::make_unique<Value>(std::move(list_[index]));
+    *out_value = std::make_unique<Value>(std::move(storage[index]));
 
-  list_.erase(list_.begin() + index);
+  storage.erase(storage.begin() + index);
   return true;
 }
 
 bool ListValue::Remove(const Value& value, size_t* index) {
-  auto it = std::find(list_.begin(), list_.end(), value);
+  ListStorage& storage = mutable_list();
+  auto it = std::find(storage.begin(), storage.end(), value);
 
-  if (it == list_.end())
+  if (it == storage.end())
     return false;
 
   if (index)
-    *index = std::distance(list_.begin(), it);
+    *index = std::distance(storage.begin(), it);
 
-  list_.erase(it);
+  storage.erase(it);
   return true;
 }
 
@@ -1310,78 +1515,84 @@ ListValue::iterator ListValue::Erase(iterator iter,
   if (out_value)
     *out_value = std::make_unique<Value>(std::move(*iter));
 
-  return list_.erase(iter);
+  return mutable_list().erase(iter);
 }
 
 void ListValue::Append(std::unique_ptr<Value> in_value) {
-  list_.push_back(std::move(*in_value));
+  mutable_list().push_back(std::move(*in_value));
 }
 
 void ListValue::AppendBoolean(bool in_value) {
-  list_.emplace_back(in_value);
+  mutable_list().emplace_back(in_value);
 }
 
 void ListValue::AppendInteger(int in_value) {
-  list_.emplace_back(in_value);
+  mutable_list().emplace_back(in_value);
 }
 
 void ListValue::AppendDouble(double in_value) {
-  list_.emplace_back(in_value);
+  mutable_list().emplace_back(in_value);
 }
 
 void ListValue::AppendString(StringPiece in_value) {
-  list_.emplace_back(in_value);
+  mutable_list().emplace_back(in_value);
 }
 
 void ListValue::AppendString(const string16& in_value) {
-  list_.emplace_back(in_value);
+  mutable_list().emplace_back(in_value);
 }
 
 void ListValue::AppendStrings(const std::vector<std::string>& in_values) {
-  list_.reserve(list_.size() + in_values.size());
+  ListStorage& storage = mutable_list();
+  storage.reserve(storage.size() + in_values.size());
   for (const auto& in_value : in_values)
-    list_.emplace_back(in_value);
+    storage.emplace_back(in_value);
 }
 
 void ListValue::AppendStrings(const std::vector<string16>& in_values) {
-  list_.reserve(list_.size() + in_values.size());
+  ListStorage& storage = mutable_list();
+  storage.reserve(storage.size() + in_values.size());
   for (const auto& in_value : in_values)
-    list_.emplace_back(in_value);
+    storage.emplace_back(in_value);
 }
 
 bool ListValue::AppendIfNotPresent(std::unique_ptr<Value> in_value) {
   WINBASE_DCHECK(in_value);
-  if (ContainsValue(list_, *in_value))
+  ListStorage& storage = mutable_list();
+  if (ContainsValue(storage, *in_value))
     return false;
 
-  list_.push_back(std::move(*in_value));
+  storage.push_back(std::move(*in_value));
   return true;
 }
 
 bool ListValue::Insert(size_t index, std::unique_ptr<Value> in_value) {
   WINBASE_DCHECK(in_value);
-  if (index > list_.size())
+  ListStorage& storage = mutable_list();
+  if (index > storage.size())
     return false;
 
-  list_.insert(list_.begin() + index, std::move(*in_value));
+  storage.insert(storage.begin() + index, std::move(*in_value));
   return true;
 }
 
 ListValue::const_iterator ListValue::Find(const Value& value) const {
-  return std::find(list_.begin(), list_.end(), value);
+  return std::find(list().begin(), list().end(), value);
 }
 
 void ListValue::Swap(ListValue* other) {
   WINBASE_CHECK(other->is_list());
-  list_.swap(other->list_);
+  Value tmp = std::move(*other);
+  *static_cast<Value*>(other) = std::move(*this);
+  *static_cast<Value*>(this) = std::move(tmp);
 }
 
 ListValue* ListValue::DeepCopy() const {
-  return new ListValue(list_);
+  return new ListValue(list());
 }
 
 std::unique_ptr<ListValue> ListValue::CreateDeepCopy() const {
-  return std::make_unique<ListValue>(list_);
+  return std::make_unique<ListValue>(list());
 }
 
 ValueSerializer::~ValueSerializer() = default;
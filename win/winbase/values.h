@@ -35,9 +35,11 @@
 #include "winbase\containers\flat_map.h"
 #include "winbase\containers\span.h"
 #include "winbase\macros.h"
+#include "winbase\memory\ref_counted.h"
 #include "winbase\strings\string16.h"
 #include "winbase\strings\string_piece.h"
 #include "winbase\value_iterators.h"
+#include "winbase\value_key.h"
 
 namespace winbase {
 
@@ -71,6 +73,10 @@ class Value;
 // use heap allocated values. The DictionaryValue and ListValue subclasses
 // exist only as a compatibility shim that we're in the process of removing.
 //
+// The entries of a dictionary are stored inline next to their keys, like the
+// elements of a list. As with lists, adding or removing an entry invalidates
+// pointers to the other entries of the same dictionary.
+//
 // NEW WAY:
 //
 //   winbase::Value GetFoo() {
@@ -81,7 +87,7 @@ class Value;
 class WINBASE_EXPORT Value {
  public:
   using BlobStorage = std::vector<char>;
-  using DictStorage = flat_map<std::string, std::unique_ptr<Value>>;
+  using DictStorage = flat_map<ValueKey, Value>;
   using ListStorage = std::vector<Value>;
 
   enum class Type {
@@ -112,9 +118,30 @@ class WINBASE_EXPORT Value {
   Value() noexcept;  // A null value.
 
   // Value's copy constructor and copy assignment operator are deleted. Use this
-  // to obtain a deep copy explicitly.
+  // to obtain a deep copy explicitly. The copy of a shared dictionary or list
+  // shares its contents instead; see Share().
   Value Clone() const;
 
+  // Makes the dictionaries and lists in this tree shared: their contents move
+  // into reference counted storage, which Clone() then shares instead of
+  // copying, in constant time. A shared dictionary or list is copied when it
+  // is first modified while other Values share it, and the copy shares its
+  // children with the original, so modifying a leaf of a cloned tree copies
+  // only the containers on the path to it. Call Share() on a large tree that
+  // is cloned often, like a configuration snapshot handed to many tasks.
+  //
+  // The non-const accessors of a shared container, such as GetList(),
+  // DictItems() and the non-const FindKey(), count as modifications; use
+  // const access to read. Like insertion, Clone() invalidates the pointers
+  // that these returned before, as far as modifying through them goes, since
+  // the clone may share what they point to. Containers added to the tree later
+  // are not shared until Share() is called again. Sharing is safe across
+  // threads as long as every thread modifies only its own Values.
+  void Share();
+
+  // Returns true if this is a dictionary or list whose contents are shared.
+  bool is_shared() const { return is_shared_; }
+
   explicit Value(Type type);
   explicit Value(bool in_bool);
   explicit Value(int in_int);
@@ -182,6 +209,11 @@ class WINBASE_EXPORT Value {
   //   auto* found = FindKey("foo");
   Value* FindKey(StringPiece key);
   const Value* FindKey(StringPiece key) const;
+  // This overload compares the storage of |key| with that of the keys in the
+  // dictionary before their characters, which is faster when both come from
+  // the same ValueKeyTable.
+  Value* FindKey(const ValueKey& key);
+  const Value* FindKey(const ValueKey& key) const;
 
   // |FindKeyOfType| is similar to |FindKey|, but it also requires the found
   // value to have type |type|. If no type is found, or the found value is of a
@@ -207,6 +239,19 @@ class WINBASE_EXPORT Value {
   Value* SetKey(std::string&& key, Value value);
   // This overload is necessary to avoid ambiguity for const char* arguments.
   Value* SetKey(const char* key, Value value);
+  // This overload stores |key| itself, sharing its storage, when the key is
+  // new; use it with a ValueKeyTable to store a key used by many
+  // dictionaries only once.
+  Value* SetKey(ValueKey key, Value value);
+
+  // |SetKeys| sets all of |entries| in the underlying dictionary, with the
+  // same result as calling SetKey() for each of them in order. Since a new key
+  // moves every entry after it, adding n keys that are not in order one at a
+  // time takes O(n^2) time; SetKeys() instead sorts |entries| once and merges
+  // them in, in O(size() + n log n). Use it, or construct the Value from a
+  // DictStorage, to build large dictionaries.
+  // Note: This fatally asserts if type() is not Type::DICTIONARY.
+  void SetKeys(std::vector<DictStorage::value_type> entries);
 
   // This attemps to remove the value associated with |key|. In case of failure,
   // e.g. the key does not exist, |false| is returned and the underlying
@@ -358,10 +403,29 @@ class WINBASE_EXPORT Value {
   ///size_t EstimateMemoryUsage() const;
 
  protected:
+  // The contents of a shared dictionary or list; see Share().
+  using SharedDict = RefCountedData<DictStorage>;
+  using SharedList = RefCountedData<ListStorage>;
+
+  // Return the storage of a dictionary or list, whether it is shared or not.
+  // The mutable versions first copy shared storage that other Values use too.
+  const DictStorage& dict() const {
+    return is_shared_ ? shared_dict_->data : dict_;
+  }
+  const ListStorage& list() const {
+    return is_shared_ ? shared_list_->data : list_;
+  }
+  DictStorage& mutable_dict();
+  ListStorage& mutable_list();
+
   // TODO(crbug.com/646113): Make these private once DictionaryValue and
   // ListValue are properly inlined.
   Type type_;
 
+  // True if a dictionary or list keeps its contents in |shared_dict_| or
+  // |shared_list_| rather than in |dict_| or |list_|.
+  bool is_shared_ = false;
+
   union {
     bool bool_value_;
     int int_value_;
@@ -370,6 +434,8 @@ class WINBASE_EXPORT Value {
     BlobStorage binary_value_;
     DictStorage dict_;
     ListStorage list_;
+    scoped_refptr<SharedDict> shared_dict_;
+    scoped_refptr<SharedList> shared_list_;
   };
 
  private:
@@ -397,10 +463,10 @@ class WINBASE_EXPORT DictionaryValue : public Value {
   bool HasKey(StringPiece key) const;
 
   // Returns the number of Values in this dictionary.
-  size_t size() const { return dict_.size(); }
+  size_t size() const { return dict().size(); }
 
   // Returns whether the dictionary is empty.
-  bool empty() const { return dict_.empty(); }
+  bool empty() const { return dict().empty(); }
 
   // Clears any current contents of this dictionary.
   void Clear();
@@ -412,7 +478,9 @@ class WINBASE_EXPORT DictionaryValue : public Value {
   // If the key at any step of the way doesn't exist, or exists but isn't
   // a DictionaryValue, a new DictionaryValue will be created and attached
   // to the path in that location. |in_value| must be non-null.
-  // Returns a pointer to the inserted value.
+  // Returns a pointer to the inserted value. Like the pointers that the Get
+  // methods return, it is valid only until an entry is added to or removed
+  // from the dictionary that holds the value.
   // DEPRECATED, use Value::SetPath(path, value) instead.
   Value* Set(StringPiece path, std::unique_ptr<Value> in_value);
 
@@ -561,11 +629,11 @@ class WINBASE_EXPORT DictionaryValue : public Value {
     Iterator(const Iterator& other);
     ~Iterator();
 
-    bool IsAtEnd() const { return it_ == target_.dict_.end(); }
+    bool IsAtEnd() const { return it_ == target_.dict().end(); }
     void Advance() { ++it_; }
 
     const std::string& key() const { return it_->first; }
-    const Value& value() const { return *it_->second; }
+    const Value& value() const { return it_->second; }
 
    private:
     const DictionaryValue& target_;
@@ -574,12 +642,12 @@ class WINBASE_EXPORT DictionaryValue : public Value {
 
   // Iteration.
   // DEPRECATED, use Value::DictItems() instead.
-  iterator begin() { return dict_.begin(); }
-  iterator end() { return dict_.end(); }
+  iterator begin() { return mutable_dict().begin(); }
+  iterator end() { return mutable_dict().end(); }
 
   // DEPRECATED, use Value::DictItems() instead.
-  const_iterator begin() const { return dict_.begin(); }
-  const_iterator end() const { return dict_.end(); }
+  const_iterator begin() const { return dict().begin(); }
+  const_iterator end() const { return dict().end(); }
 
   // DEPRECATED, use Value::Clone() instead.
   // TODO(crbug.com/646113): Delete this and migrate callsites.
@@ -608,11 +676,11 @@ class WINBASE_EXPORT ListValue : public Value {
 
   // Returns the number of Values in this list.
   // DEPRECATED, use GetList()::size() instead.
-  size_t GetSize() const { return list_.size(); }
+  size_t GetSize() const { return list().size(); }
 
   // Returns whether the list is empty.
   // DEPRECATED, use GetList()::empty() instead.
-  bool empty() const { return list_.empty(); }
+  bool empty() const { return list().empty(); }
 
   // Reserves storage for at least |n| values.
   // DEPRECATED, use GetList()::reserve() instead.
@@ -716,14 +784,14 @@ class WINBASE_EXPORT ListValue : public Value {
 
   // Iteration.
   // DEPRECATED, use GetList()::begin() instead.
-  iterator begin() { return list_.begin(); }
+  iterator begin() { return mutable_list().begin(); }
   // DEPRECATED, use GetList()::end() instead.
-  iterator end() { return list_.end(); }
+  iterator end() { return mutable_list().end(); }
 
   // DEPRECATED, use GetList()::begin() instead.
-  const_iterator begin() const { return list_.begin(); }
+  const_iterator begin() const { return list().begin(); }
   // DEPRECATED, use GetList()::end() instead.
-  const_iterator end() const { return list_.end(); }
+  const_iterator end() const { return list().end(); }
 
   // DEPRECATED, use Value::Clone() instead.
   // TODO(crbug.com/646113): Delete this and migrate callsites.